@@ -15,6 +15,12 @@ HEADERS += \
     $$PWD/include/qappimageupdate_p.hpp \
     $$PWD/include/qappimageupdate.hpp \
     $$PWD/include/helpers_p.hpp \
+    $$PWD/include/bufferpool_p.hpp \
+    $$PWD/include/tracer_p.hpp \
+    $$PWD/include/updateengine_p.hpp \
+    $$PWD/include/seedindex_p.hpp \
+    $$PWD/include/zsynccontrolfilegenerator_p.hpp \
+    $$PWD/include/zsynccontrolfilegenerator.hpp \
     $$PWD/include/softwareupdatedialog_p.hpp 
 
 SOURCES += \
@@ -28,6 +34,12 @@ SOURCES += \
     $$PWD/src/qappimageupdate_p.cc \
     $$PWD/src/qappimageupdate.cc \
     $$PWD/src/helpers_p.cc \
+    $$PWD/src/bufferpool_p.cc \
+    $$PWD/src/tracer_p.cc \
+    $$PWD/src/updateengine_p.cc \
+    $$PWD/src/seedindex_p.cc \
+    $$PWD/src/zsynccontrolfilegenerator_p.cc \
+    $$PWD/src/zsynccontrolfilegenerator.cc \
     $$PWD/src/softwareupdatedialog_p.cc
 
 
@@ -39,6 +39,7 @@
 #include <QCryptographicHash>
 #include <QDateTime>
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QFileInfo>
 #include <QJsonObject>
@@ -70,6 +71,7 @@ class AppImageUpdateInformationPrivate : public QObject {
     void progress(int);
     void error(short);
     void logger(QString, QString);
+    void timing(QString, qint64);
 
   private:
     bool b_Busy = false;
@@ -0,0 +1,38 @@
+#ifndef BUFFER_POOL_PRIVATE_HPP_INCLUDED
+#define BUFFER_POOL_PRIVATE_HPP_INCLUDED
+#include <QByteArray>
+#include <QtGlobal>
+
+/*
+ * Process wide pool of recycled byte arrays used for the downloaded data.
+ * A buffer taken with acquire() must be given back with release() by
+ * whoever ends up owning it, instead of deleting it.
+ *
+ * Buffers come in size classes of BufferSize doubled up to MaxBufferSize,
+ * each with room for RangeSlack more bytes, so a range of whole blocks and
+ * the extra byte of its inclusive end fits the class of its blocks.
+*/
+class BufferPool {
+  public:
+    static constexpr int BufferSize = 256 * 1024; /* a multiple of every block size. */
+    static constexpr int MaxBufferSize = 4 * 1024 * 1024; /* the largest range. */
+    static constexpr int RangeSlack = 1;
+    static constexpr int MaxFreeBuffers = 64; /* of BufferSize, larger classes keep as many bytes. */
+
+    static QByteArray *acquire(int size = BufferSize);
+    static void release(QByteArray*);
+
+    /* Peak of the bytes held by acquired buffers since the last reset,
+     * this is process wide so concurrent updates share it. */
+    static qint64 peakBytesInUse();
+    static void resetPeakBytesInUse();
+
+    /* Cleanup for QScopedPointer. */
+    struct Deleter {
+        static inline void cleanup(QByteArray *buffer) {
+            BufferPool::release(buffer);
+        }
+    };
+};
+
+#endif // BUFFER_POOL_PRIVATE_HPP_INCLUDED
@@ -3,9 +3,39 @@
 #include <QObject>
 #include <QMetaMethod>
 #include <QMetaObject>
+#include <QNetworkRequest>
 #include <QNetworkReply>
+#include <QUrl>
+#include <QPair>
+#include <QVector>
+#include <QByteArray>
+
+/* Parallel segments a target file is split into when nothing of it can
+ * be reused from the seed files. */
+#define FULL_DOWNLOAD_SEGMENTS 8
+
+/* Largest range a single range reply asks for, see splitBlockRange(). */
+#define MAX_RANGE_BYTES (4 * 1024 * 1024)
 
 QMetaMethod getMethod(QObject*,const char*);
+void moveToThreadOf(QObject*, QObject*);
+void deleteInThread(QObject*);
+
+/* Cleanup for QScopedPointer, see deleteInThread(). */
+struct DeleteInThread {
+    static inline void cleanup(QObject *object) {
+        if(object) {
+            deleteInThread(object);
+        }
+    }
+};
 short translateQNetworkReplyError(QNetworkReply::NetworkError);
+QNetworkRequest makeProbeRequest(const QUrl&);
+bool parseProbeReply(QNetworkReply*, bool*, qint64*);
+qint32 blockCount(qint64, qint32);
+QByteArray makeRangeHeaderValue(qint32, qint32, qint32, qint64 skip = 0);
+QVector<QPair<qint32, qint32>> splitBlockRange(qint32, qint32, qint32, qint32 segments = 1);
+qint32 defaultBlockSize(qint64);
+void zsyncHashLengths(qint64, qint32, qint32*, qint32*, qint32*);
 
 #endif
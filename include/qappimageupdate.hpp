@@ -1,8 +1,12 @@
 #ifndef QAPPIMAGE_UPDATE_HPP_INCLUDED
 #define QAPPIMAGE_UPDATE_HPP_INCLUDED
 #include <QObject>
+#include <QMetaMethod>
 #include <QSharedPointer>
 #include <QString>
+#include <QList>
+#include <QStringList>
+#include <QUrl>
 #include <QFile>
 #include <QNetworkProxy>
 #include <QByteArray>
@@ -32,6 +36,7 @@ class QAppImageUpdate : public QObject {
     static QString errorCodeToString(short);
     static QString errorCodeToDescriptionString(short);
     static QString versionString();
+    static void setMaxConcurrentRequests(int);
   public Q_SLOTS:
     void setApplicationName(const QString&);
     void setIcon(QByteArray);
@@ -41,6 +46,12 @@ class QAppImageUpdate : public QObject {
     void setShowLog(bool);
     void setOutputDirectory(const QString&);
     void setProxy(const QNetworkProxy&);
+    void setHttp2Enabled(bool);
+    void setMirrors(const QList<QUrl>&);
+    void setSeedDirectories(const QStringList&);
+    void setEstimateDeltaSize(bool);
+    void setHashingThreads(int);
+    void setTraceFile(const QString&);
     void start(short action = Action::Update,
                int flags = GuiFlag::Default,
                QByteArray icon = QByteArray());
@@ -58,6 +69,10 @@ class QAppImageUpdate : public QObject {
     void error(short, short);
     void quit();
 
+  protected:
+    void connectNotify(const QMetaMethod&) override;
+    void disconnectNotify(const QMetaMethod&) override;
+
   private:
     QSharedPointer<QAppImageUpdatePrivate> m_Private;
 };
@@ -9,11 +9,13 @@
 #include <QByteArray>
 #include <QNetworkProxy>
 #include <QJsonObject>
+#include <QElapsedTimer>
 
 #include "qappimageupdatecodes.hpp"
 #include "appimageupdateinformation_p.hpp"
 #include "zsyncremotecontrolfileparser_p.hpp"
 #include "zsyncwriter_p.hpp"
+#include "helpers_p.hpp"
 
 #ifndef NO_GUI
 #include <QDialog>
@@ -45,8 +47,15 @@ class QAppImageUpdatePrivate : public QObject {
     void setAppImage(const QString&);
     void setAppImage(QFile*);
     void setShowLog(bool);
+    void setLoggerConnected(bool);
     void setOutputDirectory(const QString&);
     void setProxy(const QNetworkProxy&);
+    void setHttp2Enabled(bool);
+    void setMirrors(const QList<QUrl>&);
+    void setSeedDirectories(const QStringList&);
+    void setEstimateDeltaSize(bool);
+    void setHashingThreads(int);
+    void setTraceFile(const QString&);
     void start(short action = Action::Update,
                int flags = GuiFlag::None,
                QByteArray icon = QByteArray());
@@ -66,6 +75,9 @@ class QAppImageUpdatePrivate : public QObject {
     void handleUpdateCancel();
     void handleUpdateFinished(QJsonObject, QString);
     void handleUpdateError(short);
+    void handleTiming(QString, qint64);
+    void finishTrace();
+    QJsonObject statistics(QJsonObject);
 #ifndef NO_GUI
     void showWidget();
     void handleGUIConfirmationRejected();
@@ -101,14 +113,20 @@ class QAppImageUpdatePrivate : public QObject {
          b_Canceled = false,
          b_Running = false,
          b_CancelRequested = false,
-         b_GuiClassesConstructed = false;
+         b_GuiClassesConstructed = false,
+         b_Tracing = false;
     QString m_CurrentAppImagePath;
+    QString s_TraceFilePath; /* no trace is recorded if empty. */
     QString m_ApplicationName;
-    QScopedPointer<AppImageUpdateInformationPrivate> m_UpdateInformation;
-    QScopedPointer<ZsyncRemoteControlFileParserPrivate> m_ControlFileParser;
-    QScopedPointer<ZsyncWriterPrivate> m_DeltaWriter;
-    QScopedPointer<QThread> m_SharedThread;
-    QScopedPointer<QNetworkAccessManager> m_SharedNetworkAccessManager;
+    QJsonObject m_Timings; /* ms spent on each phase of the current action. */
+    QElapsedTimer m_ActionTimer;
+    /* Deleted in the threads of the engine they live in. */
+    QScopedPointer<AppImageUpdateInformationPrivate, DeleteInThread> m_UpdateInformation;
+    QScopedPointer<ZsyncRemoteControlFileParserPrivate, DeleteInThread> m_ControlFileParser;
+    QScopedPointer<ZsyncWriterPrivate, DeleteInThread> m_DeltaWriter;
+    QNetworkAccessManager *p_NetworkAccessManager; /* ours or the one of the engine. */
+    QThread *p_IOThread = nullptr; /* taken from the engine unless single threaded. */
+    QScopedPointer<QNetworkAccessManager> m_SharedNetworkAccessManager; /* only when single threaded. */
 #ifndef NO_GUI
     QScopedPointer<QDialog> m_UpdaterDialog;
     QSharedPointer<SoftwareUpdateDialog> m_ConfirmationDialog;
@@ -119,6 +119,7 @@ struct QAppImageUpdateEnums {
             NoPermissionToReadWriteTargetFile,
             CannotOpenTargetFile,
             TargetFileSha1HashMismatch,
+            CannotWriteControlFile,
 
             /* Library errors. */
             UnsupportedActionForBuild = 200,
@@ -12,12 +12,16 @@ class RangeDownloader : public QObject {
     QSharedPointer<RangeDownloaderPrivate> m_Private;
   public:
     RangeDownloader(QNetworkAccessManager*, QObject *parent = nullptr);
+    ~RangeDownloader();
   public Q_SLOTS:
     void setBlockSize(qint32);
     void setTargetFileUrl(const QUrl&);
-    void setTargetFileLength(qint32);
+    void setResolvedTargetFileUrl(const QUrl&);
+    void setTargetFileLength(qint64);
     void setBytesWritten(qint64);
     void setFullDownload(bool);
+    void setHttp2Enabled(bool);
+    void appendMirror(const QUrl&);
     void appendRange(qint32, qint32);
 
     void start();
@@ -27,6 +31,10 @@ class RangeDownloader : public QObject {
     void canceled();
     void finished();
     void error(QNetworkReply::NetworkError);
+    void targetFileUrlResolved(QUrl);
+    void networkProtocol(QString);
+    void retryCounters(qint32, qint64);
+    void requestCounter(qint32);
 
     void data(QByteArray *, bool);
     void rangeData(qint32, qint32, QByteArray *,bool);
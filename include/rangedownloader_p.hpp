@@ -6,6 +6,9 @@
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
 #include <QElapsedTimer>
+#include <QTimer>
+#include <QHash>
+#include <QSet>
 
 #include "rangereply.hpp"
 
@@ -17,9 +20,12 @@ class RangeDownloaderPrivate : public QObject {
   public Q_SLOTS:
     void setBlockSize(qint32);
     void setTargetFileUrl(const QUrl&);
+    void setResolvedTargetFileUrl(const QUrl&);
     void setBytesWritten(qint64);
-    void setTargetFileLength(qint32);
+    void setTargetFileLength(qint64);
     void setFullDownload(bool);
+    void setHttp2Enabled(bool);
+    void appendMirror(const QUrl&);
     void appendRange(qint32, qint32);
 
     void start();
@@ -28,9 +34,21 @@ class RangeDownloaderPrivate : public QObject {
   private Q_SLOTS:
     QNetworkRequest makeRangeRequest(const QUrl&, const QPair<qint32,qint32>&);
     void handleUrlCheckError(QNetworkReply::NetworkError);
-    void handleUrlCheck(qint64, qint64);
+    void checkUrl(int);
+    void abortUrlChecks();
+    void handleUrlCheck();
+    void handleUrlCheckFinished();
+    void handleUrlChecked(int, bool, QNetworkReply::NetworkError);
+    void startRangeRequests();
+    int pickMirror(int avoid = -1);
+    RangeReply *newRangeReply(int, const QPair<qint32,qint32>&, int avoidMirror = -1);
+    void releaseReply(int);
+    void handleRequestSlot();
+    void checkStragglers();
+    void dropHedge(int);
+    void stopAll();
     void handleRangeReplyCancel(int);
-    void handleRangeReplyRestart(int);
+    void handleRangeReplyRestart(int, qint64);
     void handleRangeReplyProgress(qint64, int);
     void handleRangeReplyError(QNetworkReply::NetworkError, int, bool);
     void handleRangeReplyFinished(qint32,qint32,QByteArray*, int);
@@ -39,6 +57,10 @@ class RangeDownloaderPrivate : public QObject {
     void canceled();
     void finished();
     void error(QNetworkReply::NetworkError);
+    void targetFileUrlResolved(QUrl);
+    void networkProtocol(QString);
+    void retryCounters(qint32, qint64);
+    void requestCounter(qint32);
 
     void data(QByteArray *, bool);
     void rangeData(qint32, qint32, QByteArray *, /*this is true when the given range is the last one*/bool);
@@ -48,19 +70,44 @@ class RangeDownloaderPrivate : public QObject {
     bool b_Finished = false,
          b_Running = false,
          b_CancelRequested = false,
-         b_FullDownload = false;
+         b_FullDownload = false,
+         b_Http2Enabled = false,
+         b_RequestsStarted = false;
     int n_Active = -1,
         n_Done = 0;
-    QUrl m_Url;
+    QUrl m_Url,
+         m_ResolvedUrl;
     qint32 n_BlockSize = 1024;
     qint64 n_BytesWritten = 0;
     qint64 n_TotalSize = -1;
     qint64 n_RecievedBytes;
+    qint32 n_Retries = 0,
+           n_Requests = 0;
+    qint64 n_BytesWasted = 0; /* received but thrown away on retries. */
 
     QNetworkAccessManager *m_Manager;
     QElapsedTimer m_ElapsedTimer;
+    QTimer m_StragglerTimer;
     QVector<QPair<qint32, qint32>> m_RequiredBlocks;
     QVector<RangeReply*> m_ActiveRequests;
 
+    /* Per reply state for the straggler detection, indexed like m_ActiveRequests. */
+    QVector<QPair<qint32, qint32>> m_ActiveRanges;
+    QVector<qint64> m_ReplyBytes,
+                    m_ReplyStarted;
+    QVector<double> m_Throughputs; /* bytes per ms of the finished ranges. */
+    QHash<int, int> m_HedgeOf; /* hedge index => straggler index. */
+    QSet<int> m_Hedged;
+
+    /* Mirrors of the target file, the first one is always the target file url. */
+    QVector<QUrl> m_Mirrors,
+                  m_MirrorUrls;
+    QVector<bool> m_MirrorUsable;
+    QVector<double> m_MirrorThroughput; /* moving average of bytes per ms, 0 if unknown. */
+    QVector<int> m_MirrorActive,
+                 m_MirrorFails,
+                 m_ReplyMirror; /* mirror of each reply, indexed like m_ActiveRequests. */
+    QHash<QNetworkReply*, int> m_UrlChecks; /* url check reply => mirror. */
+
 };
 #endif // RANGE_DOWNLOADER_PRIVATE_HPP_INCLUDED
@@ -10,14 +10,16 @@ class RangeReply : public QObject {
     Q_OBJECT
     QSharedPointer<RangeReplyPrivate> m_Private;
   public:
-    RangeReply(int, QNetworkReply*, const QPair<qint32, qint32>&);
+    RangeReply(int, QNetworkReply*, const QPair<qint32, qint32>&, qint32, const void *traceOwner = nullptr);
     ~RangeReply();
   public Q_SLOTS:
     void destroy();
     void retry(int timeout = 3000);
     void cancel();
+    void finishAt(qint32);
+    void setUrl(const QUrl&);
   Q_SIGNALS:
-    void restarted(int);
+    void restarted(int, qint64);
     void error(QNetworkReply::NetworkError, int, bool);
     void progress(qint64, int);
     void data(QByteArray*, bool);
@@ -10,26 +10,34 @@
 #include <QNetworkReply>
 #include <QScopedPointer>
 
+#include "bufferpool_p.hpp"
+
 
 class RangeReplyPrivate : public QObject {
     Q_OBJECT
   public:
-    RangeReplyPrivate(int, QNetworkReply*, const QPair<qint32, qint32>&);
+    RangeReplyPrivate(int, QNetworkReply*, const QPair<qint32, qint32>&, qint32, const void*);
     ~RangeReplyPrivate();
 
   public Q_SLOTS:
     void destroy();
     void retry(int);
     void cancel();
+    void finishAt(qint32);
+    void setUrl(const QUrl&);
 
   private Q_SLOTS:
+    void tryFinishEarly();
     void resetInternalFlags(bool value = false);
     void restart();
+    void readIntoData();
+    QByteArray *readFragment();
     void handleData(qint64, qint64);
     void handleError(QNetworkReply::NetworkError);
     void handleFinish();
+    void handleMetaData();
   Q_SIGNALS:
-    void restarted(int);
+    void restarted(int, qint64);
     void error(QNetworkReply::NetworkError, int, bool);
     void progress(qint64, int);
     void data(QByteArray*, bool);
@@ -42,16 +50,18 @@ class RangeReplyPrivate : public QObject {
          b_CancelRequested = false,
          b_Retrying = false,
          b_Halted = false,
-         b_FullDownload = false;
+         b_FullDownload = false,
+         b_FinishEarly = false;
     int n_Index;
     int n_Fails;
     qint64 n_BytesRecieved;
     qint32 n_FromBlock,
-           n_ToBlock;
+           n_ToBlock,
+           n_BlockSize;
     QTimer m_Timer;
     QScopedPointer<QNetworkReply> m_Reply;
     QNetworkRequest m_Request;
     QNetworkAccessManager *m_Manager;
-    QScopedPointer<QByteArray> m_Data;
+    QScopedPointer<QByteArray, BufferPool::Deleter> m_Data;
 };
 #endif // RANGE_REPLY_PRIVATE_INCLUDED
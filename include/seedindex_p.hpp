@@ -0,0 +1,68 @@
+#ifndef SEED_INDEX_PRIVATE_HPP_INCLUDED
+#define SEED_INDEX_PRIVATE_HPP_INCLUDED
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+#include <QVector>
+
+#include "zsyncinternalstructures_p.hpp"
+
+/*
+ * Signatures of the block aligned blocks of a seed file at a given block
+ * size, that is the weak checksum and the full MD4 of every block. The
+ * index is kept in a cache file per block size which is memory mapped when
+ * loaded, so a seed which did not change is not read again to find what
+ * it has in common with a target file. A cached index is thrown away when
+ * the size, the modification time or the inode of the seed changed.
+ *
+ * An index can also be built from data fed to it while the seed is read
+ * for something else, such that the seed is not read twice. The cache is
+ * kept under a size limit by removing the indexes used least recently.
+*/
+class SeedIndex {
+  public:
+    SeedIndex(const QString&, qint32);
+
+    bool load(const bool *canceled = nullptr);
+    bool loadCached();
+    bool beginBuild();
+    void addData(const char*, qint64);
+    bool finishBuild();
+    qint32 blocks() const;
+    const rsum *rsums() const;
+    const unsigned char *checksum(qint32) const;
+    double overlap(const rsum*, qint32, unsigned short) const;
+    QVector<zs_blockid> matchBlocks(const rsum*, const unsigned char*, qint32,
+                                    qint32, unsigned short, qint32) const;
+
+    static QString cacheDirectory();
+    static void evictCache();
+  private:
+    Q_DISABLE_COPY(SeedIndex)
+
+    bool stat();
+    bool readCache();
+    bool build(const bool*);
+    void addBlock(const char*);
+    void clearIndex();
+    void writeCache() const;
+    QString cacheFilePath() const;
+
+    QString s_FilePath;
+    qint32 n_BlockSize = 0,
+           n_Blocks = 0;
+    qint64 n_Size = 0,
+           n_MTime = 0;
+    quint64 n_Inode = 0;
+
+    /* Points into the mapped cache file or the built index below. */
+    const rsum *p_Rsums = nullptr;
+    const unsigned char *p_Checksums = nullptr; /* CHECKSUM_SIZE per block. */
+
+    QFile m_Cache;
+    QVector<rsum> m_Rsums;
+    QByteArray m_Checksums;
+    QByteArray m_Partial; /* the start of a block fed to the index. */
+};
+
+#endif // SEED_INDEX_PRIVATE_HPP_INCLUDED
@@ -6,6 +6,7 @@
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
 #include <QTemporaryFile>
+#include <QVector>
 
 class TorrentDownloaderPrivate;
 
@@ -20,6 +21,7 @@ class TorrentDownloader : public QObject {
     void setTargetFile(QTemporaryFile*);
     void setTorrentFileUrl(const QUrl&);
     void setTargetFileUrl(const QUrl&);
+    void setKnownRanges(const QVector<qint64>&);
 
     void start();
     void cancel();
@@ -1,26 +1,44 @@
 #ifndef TORRENT_DOWNLOADER_PRIVATE_HPP_INCLUDED
 #define TORRENT_DOWNLOADER_PRIVATE_HPP_INCLUDED
 #ifdef DECENTRALIZED_UPDATE_ENABLED
+#include <QAtomicInt>
 #include <QObject>
 #include <QScopedPointer>
+#include <QSharedPointer>
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
 #include <QNetworkRequest>
 #include <QTemporaryFile>
+#include <QThreadPool>
 #include <QTimer>
+#include <QVector>
+#include <functional>
+#include <memory>
 
 #include <libtorrent/session.hpp>
 #include <libtorrent/settings_pack.hpp>
 #include <libtorrent/add_torrent_params.hpp>
 #include <libtorrent/torrent_info.hpp>
 #include <libtorrent/torrent_handle.hpp>
+#include <libtorrent/alert.hpp>
 #include <libtorrent/alert_types.hpp>
 #include <libtorrent/bencode.hpp>
 #include <libtorrent/torrent_status.hpp>
+#include <libtorrent/download_priority.hpp>
 #include <libtorrent/entry.hpp>
 #include <libtorrent/error_code.hpp>
 
 
+/* The pieces of the target file which are already known, hashed off the
+ * thread of the downloader before the torrent is added. */
+struct PieceVerification {
+    QString fileName;
+    QVector<qint64> ranges; /* begin and end of the known byte ranges, sorted. */
+    std::shared_ptr<const lt::torrent_info> info;
+    QVector<int> known; /* pieces which match their hash, set by the job. */
+    QAtomicInt canceled;
+};
+
 class TorrentDownloaderPrivate : public QObject {
     Q_OBJECT
   public:
@@ -32,6 +50,7 @@ class TorrentDownloaderPrivate : public QObject {
     void setTargetFile(QTemporaryFile*);
     void setTorrentFileUrl(const QUrl&);
     void setTargetFileUrl(const QUrl&);
+    void setKnownRanges(const QVector<qint64>&);
 
     void start();
     void cancel();
@@ -41,8 +60,10 @@ class TorrentDownloaderPrivate : public QObject {
     void handleTorrentFileError(QNetworkReply::NetworkError);
     void handleTorrentFileFinish();
     void handleTimeout();
+    void handlePiecesVerified();
 
-    void torrentLoop();
+    void postTorrentUpdates();
+    void handleAlerts();
 
   Q_SIGNALS:
     void started();
@@ -60,15 +81,24 @@ class TorrentDownloaderPrivate : public QObject {
 
     qint64 n_TargetFileLength,
            n_TargetFileDone;
-    QTimer m_Timer;
+    QTimer m_Timer; /* asks libtorrent for the status of the torrent. */
     QTimer m_TimeoutTimer;
     QUrl m_TorrentFileUrl,
          m_TargetFileUrl;
     QTemporaryFile *m_File;
+    QVector<qint64> m_KnownRanges; /* begin and end of the known byte ranges, sorted. */
     QNetworkAccessManager *m_Manager;
     QScopedPointer<QByteArray> m_TorrentMeta;
     QScopedPointer<lt::session> m_Session;
+    std::shared_ptr<lt::torrent_info> m_TorrentInfo; /* until it is added. */
+    QSharedPointer<PieceVerification> m_Verification;
+    QThreadPool m_VerifyPool; /* hashes the known pieces. */
     lt::torrent_handle m_Handle;
+
+    void addTorrent(const QVector<int>&);
+    void handleStatus(const lt::torrent_status&);
+    void stopSession();
+    static void notifyAlerts(TorrentDownloaderPrivate*);
 };
 #endif // DECENTRALIZED_UPDATE_ENABLED
 #endif // TORRENT_DOWNLOADER_PRIVATE_HPP_INCLUDED
@@ -0,0 +1,90 @@
+#ifndef TRACER_PRIVATE_HPP_INCLUDED
+#define TRACER_PRIVATE_HPP_INCLUDED
+#include <QAtomicInt>
+#include <QString>
+
+/*
+ * Recorder of trace events, written as a Chrome trace JSON file which can
+ * be opened in Perfetto or chrome://tracing. Unless a trace is started an
+ * event costs a single atomic load.
+ *
+ * Every trace is a session of its own, keyed by the object which started
+ * it. An event is recorded by an owner, the session is found by following
+ * the objects the owner is attached to, so updaters tracing at the same
+ * time never see each other's events. Events of owners which belong to no
+ * session in progress are dropped.
+ *
+ * Begin and end events nest on the thread which records them, async events
+ * are matched by the id given, which is the address of the traced object
+ * and also its owner.
+*/
+class Tracer {
+  public:
+    static void start(const void*);
+    static bool finish(const void*, const QString&);
+    static void abandon(const void*);
+
+    static void attach(const void*, const void*);
+    static void detach(const void*);
+
+    static inline bool isEnabled() {
+        return s_Enabled.loadAcquire() > 0;
+    }
+
+    static inline void begin(const void *owner, const char *name, const QString &detail = QString()) {
+        if(isEnabled()) {
+            record(owner, 'B', name, nullptr, detail);
+        }
+    }
+
+    static inline void end(const void *owner, const char *name) {
+        if(isEnabled()) {
+            record(owner, 'E', name, nullptr, QString());
+        }
+    }
+
+    static inline void asyncBegin(const char *name, const void *id, const QString &detail = QString()) {
+        if(isEnabled()) {
+            record(id, 'b', name, id, detail);
+        }
+    }
+
+    /* A named point in the lifetime of an async event. */
+    static inline void asyncStep(const char *step, const void *id) {
+        if(isEnabled()) {
+            record(id, 'n', step, id, QString());
+        }
+    }
+
+    static inline void asyncEnd(const char *name, const void *id) {
+        if(isEnabled()) {
+            record(id, 'e', name, id, QString());
+        }
+    }
+
+    /* Begin and end events for the enclosing scope. */
+    class Scope {
+      public:
+        Scope(const void *owner, const char *name, const QString &detail = QString())
+            : p_Owner(owner),
+              p_Name(isEnabled() ? name : nullptr) {
+            if(p_Name) {
+                record(p_Owner, 'B', p_Name, nullptr, detail);
+            }
+        }
+
+        ~Scope() {
+            if(p_Name) {
+                end(p_Owner, p_Name);
+            }
+        }
+      private:
+        const void *p_Owner;
+        const char *p_Name;
+    };
+  private:
+    static void record(const void*, char, const char*, const void*, const QString&);
+    static QAtomicInt s_Enabled; /* sessions in progress. */
+};
+
+#endif // TRACER_PRIVATE_HPP_INCLUDED
@@ -0,0 +1,52 @@
+#ifndef UPDATE_ENGINE_PRIVATE_HPP_INCLUDED
+#define UPDATE_ENGINE_PRIVATE_HPP_INCLUDED
+#include <QByteArray>
+#include <QNetworkAccessManager>
+#include <QNetworkProxy>
+#include <QObject>
+#include <QString>
+#include <QThread>
+
+/*
+ * Process wide state shared by every updater. Updaters which are not single
+ * threaded run in the threads of the engine and share its network access
+ * manager, and with it the connections to every host. The files of an
+ * updater are read and written in an I/O thread of a small pool, where it
+ * is alone unless more updaters run than the pool has threads. The range requests of
+ * all updaters share a budget of requests in flight, which is handed out
+ * in turns, such that one large update cannot starve the others.
+*/
+class UpdateEngine {
+  public:
+    static QThread *networkThread();
+    /* The least busy I/O thread, every thread taken must be given back. */
+    static QThread *acquireIOThread();
+    static void releaseIOThread(QThread*);
+    static QNetworkAccessManager *networkAccessManager(); /* lives in the network thread. */
+    /* One for every proxy, shared by the updaters which use the same proxy.
+     * Its proxy is set before it moves to the network thread and is never
+     * changed after that. */
+    static QNetworkAccessManager *networkAccessManager(const QNetworkProxy&);
+
+    /* 0 means no limit, which is the default. */
+    static void setMaxConcurrentRequests(int);
+    static int maxConcurrentRequests();
+
+    /*
+     * Takes a request slot for the given requester. Without a free slot the
+     * requester waits in line when asked to, and its handleRequestSlot() slot
+     * is invoked once a slot was taken for it. Every slot taken must be given
+     * back with releaseRequests(), withdraw() gives back all of them.
+    */
+    static bool acquireRequest(QObject*, bool wait = true);
+    static void releaseRequests(QObject*, int count = 1);
+    static void withdraw(QObject*);
+    static int requestsInFlight();
+
+    /* SHA-1 of the local files, valid as long as the size and the
+     * modification time of the file do not change. */
+    static QString cachedSha1(const QString&);
+    static void cacheSha1(const QString&, const QString&);
+};
+
+#endif // UPDATE_ENGINE_PRIVATE_HPP_INCLUDED
@@ -0,0 +1,31 @@
+#ifndef ZSYNC_CONTROL_FILE_GENERATOR_HPP_INCLUDED
+#define ZSYNC_CONTROL_FILE_GENERATOR_HPP_INCLUDED
+#include <QObject>
+#include <QSharedPointer>
+#include <QJsonObject>
+#include <QString>
+
+class ZsyncControlFileGeneratorPrivate;
+
+class ZsyncControlFileGenerator : public QObject {
+    Q_OBJECT
+    QSharedPointer<ZsyncControlFileGeneratorPrivate> m_Private;
+  public:
+    ZsyncControlFileGenerator(QObject *parent = nullptr);
+  public Q_SLOTS:
+    void setTargetFile(const QString&);
+    void setOutputFile(const QString&);
+    void setTargetFileUrl(const QString&);
+    void setBlockSize(qint32);
+    void setThreads(int);
+
+    void start();
+    void cancel();
+  Q_SIGNALS:
+    void started();
+    void canceled();
+    void finished(QJsonObject);
+    void progress(int);
+    void error(short);
+};
+#endif // ZSYNC_CONTROL_FILE_GENERATOR_HPP_INCLUDED
@@ -0,0 +1,83 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2018-2019, Antony jr
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @filename    : zsynccontrolfilegenerator_p.hpp
+ * @description : This is where the ZsyncControlFileGeneratorPrivate is described.
+ * This class writes the zsync control file of a given file, just like zsyncmake
+ * does, with the blocks hashed in parallel.
+*/
+#ifndef ZSYNC_CONTROL_FILE_GENERATOR_PRIVATE_HPP_INCLUDED
+#define ZSYNC_CONTROL_FILE_GENERATOR_PRIVATE_HPP_INCLUDED
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonObject>
+#include <QObject>
+#include <QString>
+#include <QThread>
+#include <QThreadPool>
+
+class ZsyncControlFileGeneratorPrivate : public QObject {
+    Q_OBJECT
+  public:
+    ZsyncControlFileGeneratorPrivate(QObject *parent = nullptr);
+    ~ZsyncControlFileGeneratorPrivate();
+  public Q_SLOTS:
+    void setTargetFile(const QString&);
+    void setOutputFile(const QString&);
+    void setTargetFileUrl(const QString&);
+    void setBlockSize(qint32);
+    void setThreads(int);
+    void start();
+    void cancel();
+
+  private Q_SLOTS:
+    short writeControlFile(QFile*, QJsonObject*);
+
+  Q_SIGNALS:
+    void started();
+    void canceled();
+    void finished(QJsonObject);
+    void progress(int);
+    void error(short);
+  private:
+    bool b_Started = false,
+         b_CancelRequested = false;
+    qint32 n_BlockSize = 0; /* 0 picks it like zsyncmake. */
+    QString s_TargetFilePath,
+            s_OutputFilePath, /* next to the target file if empty. */
+            s_TargetFileUrl; /* the file name of the target if empty. */
+    QThreadPool m_HashPool; /* hashes the blocks of a batch. */
+};
+
+#endif // ZSYNC_CONTROL_FILE_GENERATOR_PRIVATE_HPP_INCLUDED
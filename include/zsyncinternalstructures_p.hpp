@@ -39,15 +39,30 @@
 static constexpr unsigned short CHECKSUM_SIZE = 16;
 static constexpr unsigned short BITHASHBITS = 3;
 typedef qint32 zs_blockid;
+static constexpr zs_blockid NO_BLOCK = -1; /* end of a hash chain. */
 
 struct rsum {
     unsigned short	a;
     unsigned short	b;
 } __attribute__((packed));
 
-struct hash_entry {
-    struct hash_entry *next;    /* next entry with the same rsum */
-    struct rsum r;
-    unsigned char checksum[CHECKSUM_SIZE];
-};
+/*
+ * Zsync uses the same modified version of the Adler32 checksum
+ * as in rsync as the rolling checksum , here after denoted by rsum.
+ * Calculate the rsum for a single block of data. */
+static inline rsum __attribute__ ((pure)) calc_rsum_block(const unsigned char *data, size_t len) {
+    unsigned short a = 0;
+    unsigned short b = 0;
+
+    while (len) {
+        unsigned char c = *data++;
+        a += c;
+        b += len * c;
+        len--;
+    }
+    {
+        struct rsum r = { a, b };
+        return r;
+    }
+}
 #endif // ZSYNC_INTERNAL_STRUCTURES_HPP_INCLUDED
@@ -40,6 +40,7 @@
 #include <cmath>
 #include <QCoreApplication>
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QtEndian>
 #include <QJsonArray>
 #include <QJsonDocument>
@@ -49,6 +50,7 @@
 #include <QObject>
 #include <QString>
 #include <QScopedPointer>
+#include <QThreadPool>
 #include <QTime>
 #include <QNetworkAccessManager>
 #include <QNetworkRequest>
@@ -67,14 +69,19 @@ class ZsyncRemoteControlFileParserPrivate : public QObject {
     void setControlFileUrl(const QUrl&);
     void setControlFileUrl(QJsonObject);
     void setLoggerName(const QString&);
+    void setNetworkAccessManager(QNetworkAccessManager*);
     void setShowLog(bool);
     void setUseBittorrent(bool);
+    void setEstimateDeltaSize(bool);
+    void setDryRun(bool);
     void getControlFile(void);
     void getUpdateCheckInformation(void);
     void getZsyncInformation(void);
 
   private Q_SLOTS:
-    void checkHeadTargetFileUrl(qint64, qint64);
+    void checkHeadTargetFileUrl(void);
+    bool startDeltaEstimate(void);
+    void handleDeltaEstimate(qint64, QJsonObject);
     void handleBintrayRedirection(const QUrl&);
     void handleGithubMarkdownParsed(void);
     void handleGithubAPIResponse(void);
@@ -87,19 +94,25 @@ class ZsyncRemoteControlFileParserPrivate : public QObject {
 #endif // LOGGING_DISABLED
   Q_SIGNALS:
     void zsyncInformation(qint32,qint32,qint32,
-                          qint32,qint32,qint32,
+                          qint32,qint32,qint64,
                           QString,QString,QString,
-                          QUrl,QBuffer*,bool,QUrl);
+                          QUrl,QBuffer*,bool,QUrl,
+                          QList<QUrl>,QUrl);
     void updateCheckInformation(QJsonObject);
     void receiveControlFile(void);
     void progress(int);
     void error(short);
     void logger(QString, QString);
+    void timing(QString, qint64);
   private:
     bool b_AcceptRange = false,
          b_Busy = false,
-         b_WithBT = false;
-    QJsonObject j_UpdateInformation;
+         b_WithBT = false,
+         b_EstimateDelta = false,
+         b_DryRun = false;
+    QJsonObject j_UpdateInformation,
+                j_PendingCheck; /* waits for the delta estimate. */
+    qint64 n_EstimateSequence = 0; /* estimates of an older check are dropped. */
     QString s_ZsyncMakeVersion,
             s_ZsyncFileName, /* only used for github transport. */
             s_TargetFileName,
@@ -113,22 +126,26 @@ class ZsyncRemoteControlFileParserPrivate : public QObject {
             ;
 #endif // LOGGING_DISABLED
     QDateTime m_MTime;
+    QElapsedTimer m_FetchTimer; /* from the update information to the probed target file. */
     qint32 n_TargetFileBlockSize = 0,
-           n_TargetFileLength = 0,
            n_TargetFileBlocks = 0;
+    qint64 n_TargetFileLength = 0;
     qint32 n_WeakCheckSumBytes = 0,
            n_StrongCheckSumBytes = 0,
            n_ConsecutiveMatchNeeded = 0;
     qint64 n_CheckSumBlocksOffset = 0;
     QUrl u_TargetFileUrl,
+         u_ResolvedTargetFileUrl, /* where the probe ended up, if it supports ranges. */
          u_ControlFileUrl,
          u_TorrentFile;
+    QList<QUrl> m_MirrorUrls;
 
 #ifndef LOGGING_DISABLED
     QScopedPointer<QDebug> p_Logger;
 #endif // LOGGING_DISABLED
     QScopedPointer<QBuffer> p_ControlFile;
     QNetworkAccessManager *p_NManager = nullptr;
+    QThreadPool m_EstimatePool; /* reads the local AppImage for the delta estimate. */
 };
 
 #endif //ZSYNC_CONTROL_FILE_PARSER_PRIVATE_HPP_INCLUDED
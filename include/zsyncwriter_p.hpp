@@ -43,15 +43,26 @@
 #include <QtEndian>
 #include <QFileInfo>
 #include <QtGlobal>
+#include <QJsonArray>
 #include <QJsonObject>
 #include <QObject>
 #include <QUrl>
+#include <QStringList>
 #include <QString>
 #include <QScopedPointer>
 #include <QElapsedTimer>
 #include <QTimer>
 #include <QTemporaryFile>
 #include <QNetworkAccessManager>
+#include <QThread>
+#include <QThreadPool>
+#include <QAtomicInt>
+#include <QSharedPointer>
+#include <QVector>
+#include <QMap>
+#include <QHash>
+#include <QBitArray>
+#include <QSet>
 
 #include "rangedownloader.hpp"
 #ifdef DECENTRALIZED_UPDATE_ENABLED
@@ -59,6 +70,24 @@
 #include "torrentdownloader.hpp"
 #endif
 #include "zsyncinternalstructures_p.hpp"
+#include "bufferpool_p.hpp"
+
+class SeedIndex;
+
+/* A downloaded range waiting for its blocks to be verified in the
+ * verification pool. */
+struct RangeVerification {
+    qint32 fromBlock = 0,
+           toBlock = 0,
+           blockSize = 0,
+           strongCheckSumBytes = 0;
+    bool isLast = false,
+         done = false; /* only touched by the writer. */
+    QScopedPointer<QByteArray, BufferPool::Deleter> data;
+    QByteArray expected; /* strong checksum bytes of the blocks in the range. */
+    QVector<zs_blockid> firstBad; /* first mismatching block of each batch, NO_BLOCK if none. */
+    QAtomicInt pending; /* batches not verified yet. */
+};
 
 class ZsyncWriterPrivate : public QObject {
     Q_OBJECT
@@ -69,14 +98,22 @@ class ZsyncWriterPrivate : public QObject {
     void setShowLog(bool);
     void setLoggerName(const QString&);
     void setOutputDirectory(const QString&);
+    void setHttp2Enabled(bool);
+    void setNetworkAccessManager(QNetworkAccessManager*);
+    void setMirrors(const QList<QUrl>&);
+    void setSeedDirectories(const QStringList&);
+    void setHashingThreads(int);
+    void setDryRun(bool);
     void setConfiguration(qint32,qint32,qint32,
-                          qint32,qint32,qint32,
+                          qint32,qint32,qint64,
                           const QString&,const QString&,const QString&,
-                          QUrl, QBuffer*,bool,QUrl);
+                          QUrl, QBuffer*,bool,QUrl,
+                          const QList<QUrl>&,QUrl);
     void start();
     void cancel();
 
   private Q_SLOTS:
+    void appendMirrors(void);
 #ifndef LOGGING_DISABLED
     void handleLogMessage(QString, QString);
 #endif // LOGGING_DISABLED
@@ -85,22 +122,34 @@ class ZsyncWriterPrivate : public QObject {
     void addToRanges(zs_blockid);
     qint32 alreadyGotBlock(zs_blockid);
     qint32 buildHash();
-    qint32 checkCheckSumsOnHashChain(const hash_entry *, const unsigned char *, qint32 );
-    quint32 calcRHash(const hash_entry *const);
+    quint32 calcRHash(zs_blockid);
     void calcMd4Checksum(unsigned char *, const unsigned char*,size_t);
-    zs_blockid getHashEntryBlockId(const hash_entry *);
+    const unsigned char *blockChecksum(zs_blockid);
+    void freeBlockTable();
     short tryOpenSourceFile(const QString&, QFile**);
+    QStringList findSeedFiles();
     short parseTargetFileCheckSumBlocks();
     void writeBlocks(const unsigned char *, zs_blockid, zs_blockid);
     void removeBlockFromHash(zs_blockid);
-    qint32 submitSourceData(unsigned char*, size_t, off_t);
-    qint32 submitSourceFile(QFile*);
+    qint32 submitSourceFile(QFile*, SeedIndex *index = nullptr);
+    qint32 submitSeedFile(QFile*);
+    qint32 joinSeedIndex(QFile*, const SeedIndex&);
     qint32 rangeBeforeBlock(zs_blockid);
     zs_blockid nextKnownBlock(zs_blockid);
     bool getBlockRanges();
+    bool planBlockRanges(QVector<QPair<qint32, qint32>>*);
+    void recordSeedReuse(const QString&, qint64, qint64);
+    QJsonObject statistics();
+    void finishDryRun();
     void writeBlockRanges(qint32, qint32, QByteArray*, bool);
+    void handleRangeVerified(qint64);
+    void commitVerifiedRange(RangeVerification*);
     void writeDataSequential(QByteArray*, bool);
     void handleNetworkError(QNetworkReply::NetworkError);
+    void handleTargetFileUrlResolved(QUrl);
+    void handleNetworkProtocol(QString);
+    void handleRetryCounters(qint32, qint64);
+    void handleRequestCounter(qint32);
 #ifdef DECENTRALIZED_UPDATE_ENABLED
 #if LIBTORRENT_VERSION_NUM >= 10208
     void handleTorrentError(QNetworkReply::NetworkError);
@@ -119,15 +168,45 @@ class ZsyncWriterPrivate : public QObject {
     void error(short);
     void logger(QString, QString);
   private:
+    /* The matcher is instantiated for every header combination zsyncmake
+     * produces, and the one which fits the control file is picked once in
+     * setConfiguration. */
+    template <int SeqMatches, unsigned short WeakMask>
+    qint32 checkCheckSumsOnHashChain(zs_blockid, const unsigned char *, qint32);
+    template <int SeqMatches, unsigned short WeakMask>
+    qint32 submitSourceData(unsigned char*, size_t, off_t);
+    typedef qint32 (ZsyncWriterPrivate::*SubmitSourceDataFunction)(unsigned char*, size_t, off_t);
+    SubmitSourceDataFunction p_SubmitSourceData = nullptr;
+
     bool b_Started = false,
          b_CancelRequested = false,
          b_AcceptRange = true,
          b_Configured = false,
-         b_TorrentAvail = false;
+         b_TorrentAvail = false,
+         b_Http2Enabled = false,
+         b_DryRun = false;
     QUrl u_TargetFileUrl,
+         u_ResolvedTargetFileUrl, /* cached for this session, skips the url check. */
          u_TorrentFileUrl;
+    QList<QUrl> m_Mirrors, /* given through the api. */
+                m_ControlFileMirrors; /* extra urls in the control file. */
+    QStringList m_SeedDirectories; /* searched for other AppImages to use as seeds. */
+    QJsonArray m_SeedReuse; /* bytes each seed gave and the time it took to scan. */
     QPair<rsum, rsum> p_CurrentWeakCheckSums = qMakePair(rsum({ 0, 0 }), rsum({ 0, 0 }));
-    qint64 n_BytesWritten = 0;
+    qint64 n_BytesWritten = 0,
+           n_BytesWasted = 0; /* received but thrown away on retries. */
+    qint32 n_Retries = 0,
+           n_Requests = 0;
+    /* Counters of the matcher and the time in ms spent on each phase,
+     * reported in finished. */
+    qint64 n_HashHits = 0,
+           n_WeakHits = 0,
+           n_CheckSummed = 0,
+           n_StrongHits = 0,
+           n_HashBuildTime = 0,
+           n_SeedScanTime = 0,
+           n_DownloadTime = 0,
+           n_VerificationTime = 0;
     qint32 n_Blocks = 0,
            n_BlockSize = 0,
            n_BlockShift = 0, /* log2(blocksize). */
@@ -135,18 +214,25 @@ class ZsyncWriterPrivate : public QObject {
            n_WeakCheckSumBytes = 0,
            n_StrongCheckSumBytes = 0, /* no. of bytes available for the strong checksum. */
            n_SeqMatches = 0,
-           n_Skip = 0,    /* skip forward on next submit_source_data. */
-           n_TargetFileLength = 0;
+           n_Skip = 0;    /* skip forward on next submit_source_data. */
+    qint64 n_TargetFileLength = 0;
     unsigned short p_WeakCheckSumMask = 0; /* This will be applied to the first 16 bits of the weak checksum. */
 
-    const hash_entry *p_Rover = nullptr,
-                      *p_NextMatch = nullptr;
+    zs_blockid n_Rover = NO_BLOCK,
+               n_NextMatch = NO_BLOCK;
     zs_blockid n_NextKnown = 0;
 
-    /* Hash table for rsync algorithm */
+    /* Block table of the target file, indexed by block id. It has n_SeqMatches
+     * extra zeroed entries at the end for the lookahead. The weak sums, the
+     * strong checksum bytes and the hash chain links are kept in separate
+     * arrays so only the bytes the control file carries are stored. */
+    rsum *p_BlockRsums = nullptr;
+    unsigned char *p_BlockChecksums = nullptr; /* n_StrongCheckSumBytes per block. */
+    zs_blockid *p_BlockNext = nullptr; /* next block in the same hash chain. */
+
+    /* Hash table for rsync algorithm, heads of the hash chains. */
     quint32 p_HashMask = 0;
-    hash_entry *p_BlockHashes = nullptr;
-    hash_entry **p_RsumHash = nullptr;
+    zs_blockid *p_RsumHash = nullptr;
 
     /* And a 1-bit per rsum value table to allow fast negative lookups for hash
      * values that don't occur in the target file. */
@@ -157,10 +243,15 @@ class ZsyncWriterPrivate : public QObject {
     zs_blockid *p_Ranges = nullptr; /* Ranges needed to finish the under construction target file. */
     QScopedPointer<QBuffer> p_TargetFileCheckSumBlocks; /* Checksum blocks that needs to be loaded into the memory.*/
     QScopedPointer<QCryptographicHash> p_Md4Ctx; /* Md4 Hasher context.*/
+    QThreadPool m_VerifyPool; /* verifies the downloaded blocks. */
+    QMap<qint64, QSharedPointer<RangeVerification>> m_Verifications; /* committed in order of the key. */
+    qint64 n_NextVerification = 0;
     QString s_SourceFilePath,
             s_TargetFileName,
             s_TargetFileSHA1,
-            s_OutputDirectory;
+            s_OutputDirectory,
+            s_TargetFileDirectory, /* where the target file is constructed. */
+            s_NetworkProtocol; /* protocol negotiated with the target file host. */
     QScopedPointer<QTemporaryFile> p_TargetFile; /* under construction target file. */
     QScopedPointer<QElapsedTimer> p_TransferSpeed;
     QScopedPointer<RangeDownloader> m_RangeDownloader;
@@ -34,21 +34,31 @@
  * from AppImages is implemented.
 */
 #include <QBuffer>
+#include <QMetaMethod>
 #include <QProcessEnvironment>
 
 #include "appimageupdateinformation_p.hpp"
 #include "qappimageupdateenums.hpp"
+#include "tracer_p.hpp"
+#include "updateengine_p.hpp"
 
 /*
  * An efficient logging system.
  * Warning: Hard coded to work only with this class.
 */
 #ifndef LOGGING_DISABLED
-#define LOGS *(p_Logger.data()) <<
+/* Nothing is formatted unless someone listens to the logger signal. */
+static QMetaMethod loggerSignal() {
+    static const QMetaMethod signal = QMetaMethod::fromSignal(&AppImageUpdateInformationPrivate::logger);
+    return signal;
+}
+
+#define LOGS if(isSignalConnected(loggerSignal())) { *(p_Logger.data()) <<
 #define LOGR <<
 #define LOGE ; \
 	     emit(logger(s_LogBuffer , s_AppImagePath)); \
-	     s_LogBuffer.clear();
+	     s_LogBuffer.clear(); \
+	     }
 #else
 #define LOGS (void)
 #define LOGR ;(void)
@@ -415,6 +425,11 @@ void AppImageUpdateInformationPrivate::getInfo(void) {
         return;
     }
 
+    Tracer::Scope trace(this, "getInfo");
+    QElapsedTimer timer;
+    timer.start();
+    qint64 sha1Time = 0;
+
     /* If this class is constructed without an AppImage to operate on ,
      * Then lets guess it. */
     if(!p_AppImage && s_AppImagePath.isEmpty()) {
@@ -649,14 +664,22 @@ void AppImageUpdateInformationPrivate::getInfo(void) {
             bufferSize = 1024; // copy per 1 KiB.
         }
 
-        QCryptographicHash *SHA1Hasher = new QCryptographicHash(QCryptographicHash::Sha1);
-        while(!p_AppImage->atEnd()) {
-            SHA1Hasher->addData(p_AppImage->read(bufferSize));
-            QCoreApplication::processEvents();
+        QElapsedTimer sha1Timer;
+        sha1Timer.start();
+        /* Other updaters in this process may have hashed it already. */
+        AppImageSHA1 = UpdateEngine::cachedSha1(p_AppImage->fileName());
+        if(AppImageSHA1.isEmpty()) {
+            QCryptographicHash *SHA1Hasher = new QCryptographicHash(QCryptographicHash::Sha1);
+            while(!p_AppImage->atEnd()) {
+                SHA1Hasher->addData(p_AppImage->read(bufferSize));
+                QCoreApplication::processEvents();
+            }
+            AppImageSHA1 = QString(SHA1Hasher->result().toHex().toUpper());
+            delete SHA1Hasher;
+            UpdateEngine::cacheSha1(p_AppImage->fileName(), AppImageSHA1);
         }
         p_AppImage->seek(0); // rewind file to the top for later use.
-        AppImageSHA1 = QString(SHA1Hasher->result().toHex().toUpper());
-        delete SHA1Hasher;
+        sha1Time = sha1Timer.elapsed();
     }
 
     QCoreApplication::processEvents();
@@ -827,6 +850,8 @@ void AppImageUpdateInformationPrivate::getInfo(void) {
     }
 
     emit(progress(100)); /*Signal progress.*/
+    emit(timing(QString::fromUtf8("ReadUpdateInformation"), timer.elapsed() - sha1Time));
+    emit(timing(QString::fromUtf8("LocalSha1"), sha1Time));
     emit(info(m_Info));
     INFO_START  " getInfo : finished." INFO_END;
     return;
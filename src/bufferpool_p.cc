@@ -0,0 +1,100 @@
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QVector>
+
+#include "bufferpool_p.hpp"
+#include "helpers_p.hpp"
+
+/* BufferSize, doubled until MaxBufferSize. */
+#define SIZE_CLASSES 5
+
+static_assert((BufferPool::BufferSize << (SIZE_CLASSES - 1)) == BufferPool::MaxBufferSize,
+              "the largest size class must be MaxBufferSize");
+static_assert(MAX_RANGE_BYTES <= BufferPool::MaxBufferSize,
+              "every range must fit the largest size class");
+
+static QMutex g_PoolMutex;
+static QVector<QByteArray*> g_FreeBuffers[SIZE_CLASSES];
+static QHash<QByteArray*, qint64> g_BuffersInUse; /* buffer => bytes it held when acquired. */
+static qint64 g_BytesInUse = 0,
+              g_PeakBytesInUse = 0;
+
+constexpr int BufferPool::BufferSize;
+constexpr int BufferPool::MaxBufferSize;
+constexpr int BufferPool::RangeSlack;
+constexpr int BufferPool::MaxFreeBuffers;
+
+static int classCapacity(int sizeClass) {
+    return (BufferPool::BufferSize << sizeClass) + BufferPool::RangeSlack;
+}
+
+/* The smallest class which holds the given size, -1 if none does. */
+static int sizeClassOf(int size) {
+    for(int sizeClass = 0; sizeClass < SIZE_CLASSES; ++sizeClass) {
+        if(size <= classCapacity(sizeClass)) {
+            return sizeClass;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Returns an empty buffer which can hold at least the given number of
+ * bytes without a reallocation. Anything up to MaxBufferSize comes from the
+ * pool, anything larger gets a buffer of its own.
+*/
+QByteArray *BufferPool::acquire(int size) {
+    QByteArray *buffer = nullptr;
+    int sizeClass = sizeClassOf(size);
+    QMutexLocker locker(&g_PoolMutex);
+    if(sizeClass != -1 && !g_FreeBuffers[sizeClass].isEmpty()) {
+        buffer = g_FreeBuffers[sizeClass].takeLast();
+    } else {
+        locker.unlock();
+        buffer = new QByteArray;
+        buffer->reserve(sizeClass != -1 ? classCapacity(sizeClass) : size);
+        locker.relock();
+    }
+
+    qint64 bytes = buffer->capacity();
+    g_BuffersInUse.insert(buffer, bytes);
+    g_BytesInUse += bytes;
+    g_PeakBytesInUse = qMax(g_PeakBytesInUse, g_BytesInUse);
+    return buffer;
+}
+
+/*
+ * Takes back a buffer. Since the capacity is reserved, resizing to zero
+ * keeps the memory, so it can be handed out again as it is. Every class
+ * keeps at most as many bytes as MaxFreeBuffers of BufferSize, buffers
+ * beyond that, which grew or are of their own size are simply freed.
+*/
+void BufferPool::release(QByteArray *buffer) {
+    if(!buffer) {
+        return;
+    }
+
+    int sizeClass = sizeClassOf(buffer->capacity());
+    QMutexLocker locker(&g_PoolMutex);
+    g_BytesInUse -= g_BuffersInUse.take(buffer);
+    if(sizeClass != -1 && buffer->capacity() == classCapacity(sizeClass) &&
+            g_FreeBuffers[sizeClass].size() < qMax(1, MaxFreeBuffers >> sizeClass)) {
+        buffer->resize(0);
+        g_FreeBuffers[sizeClass].append(buffer);
+        return;
+    }
+    locker.unlock();
+    delete buffer;
+}
+
+qint64 BufferPool::peakBytesInUse() {
+    QMutexLocker locker(&g_PoolMutex);
+    return g_PeakBytesInUse;
+}
+
+/* Starts the peak over from what is held right now. */
+void BufferPool::resetPeakBytesInUse() {
+    QMutexLocker locker(&g_PoolMutex);
+    g_PeakBytesInUse = g_BytesInUse;
+}
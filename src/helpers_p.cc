@@ -1,3 +1,6 @@
+#include <cmath>
+#include <QThread>
+
 #include "qappimageupdateenums.hpp"
 #include "helpers_p.hpp"
 
@@ -6,6 +9,25 @@ QMetaMethod getMethod(QObject *object, const char *function) {
     return metaObject->method(metaObject->indexOfMethod(QMetaObject::normalizedSignature(function)));
 }
 
+/* Moves the object to the thread of the given one, such that it can use it
+ * directly. */
+void moveToThreadOf(QObject *object, QObject *other) {
+    if(other && other->thread() != object->thread()) {
+        object->moveToThread(other->thread());
+    }
+}
+
+/* Deletes the object in its own thread, or right away when that thread
+ * is the current one or is not running anymore. */
+void deleteInThread(QObject *object) {
+    auto thread = object->thread();
+    if(!thread || thread == QThread::currentThread() || !thread->isRunning()) {
+        delete object;
+        return;
+    }
+    object->deleteLater();
+}
+
 short translateQNetworkReplyError(QNetworkReply::NetworkError errorCode) {
     short e = 0;
     if(errorCode > 0 && errorCode < 101) {
@@ -33,3 +55,128 @@ short translateQNetworkReplyError(QNetworkReply::NetworkError errorCode) {
     }
     return e;
 }
+
+/*
+ * A zero length range request(bytes=0-0) resolves all redirections, confirms
+ * range support and gets the total length of the target file in a single
+ * round trip. Since the body is just a single byte, the reply can be read to
+ * the end instead of being aborted, which keeps the connection alive so that
+ * the next request to the same host reuses it.
+*/
+QNetworkRequest makeProbeRequest(const QUrl &url) {
+    QNetworkRequest request;
+    request.setUrl(url);
+    request.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
+    request.setRawHeader("Range", "bytes=0-0");
+    return request;
+}
+
+/*
+ * Reads the response headers of a probe request. Returns false if the
+ * headers are not of the final response yet(i.e. still redirecting), or
+ * are of a failed request which is left to the error signal of the reply.
+ * The total length is set to -1 if the server did not give it.
+ *
+ * Only a 206 reply really supports ranges, a server which answers with
+ * 200 is sending the entire file whatever its Accept-Ranges header says,
+ * so such a reply has to be aborted by the caller.
+*/
+bool parseProbeReply(QNetworkReply *reply, bool *acceptRanges, qint64 *totalLength) {
+    auto code = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if(code >= 300) {
+        return false;
+    }
+
+    /* HTTP Status code 206 => partial retrival */
+    *acceptRanges = (code == 206);
+    *totalLength = -1;
+
+    if(code == 206) {
+        /* Content-Range: bytes 0-0/<total length> */
+        auto contentRange = reply->rawHeader("Content-Range");
+        auto pos = contentRange.lastIndexOf('/');
+        if(pos != -1) {
+            bool ok = false;
+            auto length = contentRange.mid(pos + 1).trimmed().toLongLong(&ok);
+            if(ok) {
+                *totalLength = length;
+            }
+        }
+    } else {
+        auto length = reply->header(QNetworkRequest::ContentLengthHeader);
+        if(length.isValid()) {
+            *totalLength = length.toLongLong();
+        }
+    }
+    return true;
+}
+
+/*
+ * Block numbers always fit in 32 bits but the byte offsets of a target file
+ * larger than 2 GiB do not, so all the byte math below is done in 64 bits.
+*/
+qint32 blockCount(qint64 length, qint32 blockSize) {
+    if(blockSize <= 0) {
+        return 0;
+    }
+    return static_cast<qint32>((length + blockSize - 1) / blockSize);
+}
+
+/*
+ * Range header value for the blocks [fromBlock, toBlock), skipping the
+ * given number of bytes at the start which we already have.
+*/
+QByteArray makeRangeHeaderValue(qint32 fromBlock, qint32 toBlock, qint32 blockSize, qint64 skip) {
+    QByteArray value = "bytes=";
+    value += QByteArray::number(static_cast<qint64>(fromBlock) * blockSize + skip);
+    value += "-";
+    value += QByteArray::number(static_cast<qint64>(toBlock) * blockSize);
+    return value;
+}
+
+/*
+ * A range reply keeps its entire range in memory, so a range is split into
+ * pieces of at most MAX_RANGE_BYTES. Without this a target file which
+ * changed entirely would need a single buffer as big as itself, and the
+ * downloader bounds the bytes in flight by the number of replies.
+ *
+ * When asked for more than one segment the range is also split into about
+ * that many pieces so they can be downloaded in parallel, but never into
+ * pieces smaller than MIN_SEGMENT_BYTES.
+*/
+#define MIN_SEGMENT_BYTES (1024 * 1024)
+
+QVector<QPair<qint32, qint32>> splitBlockRange(qint32 fromBlock, qint32 toBlock, qint32 blockSize, qint32 segments) {
+    QVector<QPair<qint32, qint32>> ranges;
+    qint32 step = (blockSize > 0) ? qMax(1, MAX_RANGE_BYTES / blockSize) : (toBlock - fromBlock);
+    if(blockSize > 0 && segments > 1) {
+        qint32 segmentBlocks = (toBlock - fromBlock + segments - 1) / segments;
+        segmentBlocks = qMax(segmentBlocks, qMax(1, MIN_SEGMENT_BYTES / blockSize));
+        step = qMin(step, segmentBlocks);
+    }
+    for(qint32 from = fromBlock; from < toBlock; from += step) {
+        ranges.append(qMakePair(from, qMin(toBlock, from + step)));
+    }
+    return ranges;
+}
+
+/* The block size zsyncmake picks for a file of the given length. */
+qint32 defaultBlockSize(qint64 length) {
+    return (length < 100000000) ? 2048 : 4096;
+}
+
+/*
+ * The number of consecutive matches needed, the weak checksum bytes and the
+ * strong checksum bytes per block zsyncmake picks, that is just enough to
+ * keep false matches unlikely for a file of this length and block size.
+*/
+void zsyncHashLengths(qint64 length, qint32 blockSize, qint32 *seqMatches, qint32 *weakBytes, qint32 *strongBytes) {
+    double len = qMax<qint64>(1, length),
+           /* zsyncmake divides the integer length, so the blocks are whole. */
+           blocks = static_cast<double>(qMax<qint64>(1, length) / blockSize);
+    *seqMatches = (len > blockSize) ? 2 : 1;
+    *weakBytes = static_cast<qint32>(std::ceil(((std::log(len) + std::log(blockSize)) / std::log(2) - 8.6) / *seqMatches / 8));
+    *weakBytes = qBound(2, *weakBytes, 4);
+    *strongBytes = static_cast<qint32>(std::ceil((20 + (std::log(len) + std::log(1 + blocks)) / std::log(2)) / *seqMatches / 8));
+    *strongBytes = qMin(qMax(*strongBytes, static_cast<qint32>((7.9 + (20 + std::log(1 + blocks) / std::log(2))) / 8)), 16);
+}
@@ -4,6 +4,7 @@
 #include "qappimageupdate.hpp"
 #include "qappimageupdate_p.hpp"
 #include "helpers_p.hpp"
+#include "updateengine_p.hpp"
 
 QAppImageUpdate::QAppImageUpdate(bool singleThreaded, QObject *parent)
     : QObject(parent) {
@@ -39,6 +40,26 @@ QAppImageUpdate::QAppImageUpdate(QFile *AppImage, bool singleThreaded, QObject *
 
 QAppImageUpdate::~QAppImageUpdate() { }
 
+/// Log messages are only formatted while someone listens to the logger
+//  signal or the log is shown.
+void QAppImageUpdate::connectNotify(const QMetaMethod &signal) {
+    if(signal == QMetaMethod::fromSignal(&QAppImageUpdate::logger)) {
+        getMethod(m_Private.data(), "setLoggerConnected(bool)")
+        .invoke(m_Private.data(),
+                Qt::QueuedConnection,
+                Q_ARG(bool, true));
+    }
+}
+
+void QAppImageUpdate::disconnectNotify(const QMetaMethod &signal) {
+    if(signal == QMetaMethod::fromSignal(&QAppImageUpdate::logger)) {
+        getMethod(m_Private.data(), "setLoggerConnected(bool)")
+        .invoke(m_Private.data(),
+                Qt::QueuedConnection,
+                Q_ARG(bool, isSignalConnected(signal)));
+    }
+}
+
 void QAppImageUpdate::setApplicationName(const QString &applicationName) {
     getMethod(m_Private.data(), "setApplicationName(const QString&)")
     .invoke(m_Private.data(),
@@ -95,6 +116,48 @@ void QAppImageUpdate::setProxy(const QNetworkProxy &Proxy) {
             Q_ARG(QNetworkProxy, Proxy));
 }
 
+void QAppImageUpdate::setHttp2Enabled(bool choice) {
+    getMethod(m_Private.data(), "setHttp2Enabled(bool)")
+    .invoke(m_Private.data(),
+            Qt::QueuedConnection,
+            Q_ARG(bool, choice));
+}
+
+void QAppImageUpdate::setMirrors(const QList<QUrl> &mirrors) {
+    getMethod(m_Private.data(), "setMirrors(const QList<QUrl>&)")
+    .invoke(m_Private.data(),
+            Qt::QueuedConnection,
+            Q_ARG(QList<QUrl>, mirrors));
+}
+
+void QAppImageUpdate::setSeedDirectories(const QStringList &directories) {
+    getMethod(m_Private.data(), "setSeedDirectories(const QStringList&)")
+    .invoke(m_Private.data(),
+            Qt::QueuedConnection,
+            Q_ARG(QStringList, directories));
+}
+
+void QAppImageUpdate::setEstimateDeltaSize(bool choice) {
+    getMethod(m_Private.data(), "setEstimateDeltaSize(bool)")
+    .invoke(m_Private.data(),
+            Qt::QueuedConnection,
+            Q_ARG(bool, choice));
+}
+
+void QAppImageUpdate::setHashingThreads(int threads) {
+    getMethod(m_Private.data(), "setHashingThreads(int)")
+    .invoke(m_Private.data(),
+            Qt::QueuedConnection,
+            Q_ARG(int, threads));
+}
+
+void QAppImageUpdate::setTraceFile(const QString &path) {
+    getMethod(m_Private.data(), "setTraceFile(const QString&)")
+    .invoke(m_Private.data(),
+            Qt::QueuedConnection,
+            Q_ARG(QString, path));
+}
+
 void QAppImageUpdate::start(short action, int flags, QByteArray icon) {
     getMethod(m_Private.data(), "start(short, int, QByteArray)")
     .invoke(m_Private.data(),
@@ -130,3 +193,7 @@ QString QAppImageUpdate::errorCodeToDescriptionString(short errorCode) {
 QString QAppImageUpdate::versionString() {
     return QAppImageUpdatePrivate::versionString();
 }
+
+void QAppImageUpdate::setMaxConcurrentRequests(int requests) {
+    UpdateEngine::setMaxConcurrentRequests(requests);
+}
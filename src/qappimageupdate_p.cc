@@ -35,6 +35,8 @@
 
 #include "qappimageupdate_p.hpp"
 #include "helpers_p.hpp"
+#include "tracer_p.hpp"
+#include "updateengine_p.hpp"
 
 #ifndef NO_GUI
 #include <QApplication>
@@ -51,24 +53,38 @@
 QAppImageUpdatePrivate::QAppImageUpdatePrivate(bool singleThreaded, QObject *parent)
     : QObject(parent) {
     setObjectName("QAppImageUpdatePrivate");
-    if(!singleThreaded) {
-        m_SharedThread.reset(new QThread);
-        m_SharedThread->start();
+    qRegisterMetaType<QList<QUrl>>("QList<QUrl>");
+    qRegisterMetaType<QNetworkAccessManager*>("QNetworkAccessManager*");
+    /*
+     * Unless single threaded, the updater runs in the threads of the process
+     * wide engine. The network access manager and everything which talks to
+     * it lives in the network thread, while the update information reader and
+     * the delta writer which read, scan and write files live in an I/O thread
+     * of the engine, so network replies are never held up by disk work. Every
+     * updater shares the network thread and the connections of the network
+     * access manager, the I/O thread is only shared when the pool of the
+     * engine has no idle one left.
+    */
+    if(singleThreaded) {
+        m_SharedNetworkAccessManager.reset(new QNetworkAccessManager);
+        p_NetworkAccessManager = m_SharedNetworkAccessManager.data();
+    } else {
+        p_NetworkAccessManager = UpdateEngine::networkAccessManager();
     }
 
-
-    m_SharedNetworkAccessManager.reset(new QNetworkAccessManager);
     m_UpdateInformation.reset(new AppImageUpdateInformationPrivate);
-    m_DeltaWriter.reset(new ZsyncWriterPrivate(m_SharedNetworkAccessManager.data()));
+    m_DeltaWriter.reset(new ZsyncWriterPrivate(p_NetworkAccessManager));
+    m_ControlFileParser.reset(new ZsyncRemoteControlFileParserPrivate(p_NetworkAccessManager));
     if(!singleThreaded) {
-        m_SharedNetworkAccessManager->moveToThread(m_SharedThread.data());
-        m_UpdateInformation->moveToThread(m_SharedThread.data());
-        m_DeltaWriter->moveToThread(m_SharedThread.data());
-    }
-    m_ControlFileParser.reset(new ZsyncRemoteControlFileParserPrivate(m_SharedNetworkAccessManager.data()));
-    if(!singleThreaded) {
-        m_ControlFileParser->moveToThread(m_SharedThread.data());
+        m_ControlFileParser->moveToThread(UpdateEngine::networkThread());
+        p_IOThread = UpdateEngine::acquireIOThread();
+        m_UpdateInformation->moveToThread(p_IOThread);
+        m_DeltaWriter->moveToThread(p_IOThread);
     }
+    /* Whatever these record goes to the trace of this updater only. */
+    Tracer::attach(m_UpdateInformation.data(), this);
+    Tracer::attach(m_DeltaWriter.data(), this);
+    Tracer::attach(m_ControlFileParser.data(), this);
     m_ControlFileParser->setObjectName("ZsyncRemoteControlFileParserPrivate");
     m_UpdateInformation->setObjectName("AppImageUpdateInformationPrivate");
     m_DeltaWriter->setObjectName("ZsyncWriterPrivate");
@@ -80,23 +96,20 @@ QAppImageUpdatePrivate::QAppImageUpdatePrivate(bool singleThreaded, QObject *par
 
 
     // Update information
-    connect(m_UpdateInformation.data(), &AppImageUpdateInformationPrivate::logger,
-            this, &QAppImageUpdatePrivate::logger,
-            (Qt::ConnectionType)(Qt::DirectConnection | Qt::UniqueConnection));
     connect(m_UpdateInformation.data(), SIGNAL(operatingAppImagePath(QString)),
             this, SLOT(setCurrentAppImagePath(QString)),
             Qt::QueuedConnection);
+    connect(m_UpdateInformation.data(), &AppImageUpdateInformationPrivate::timing,
+            this, &QAppImageUpdatePrivate::handleTiming,
+            (Qt::ConnectionType)(Qt::QueuedConnection | Qt::UniqueConnection));
 
 
     // Control file parsing
-    connect(m_ControlFileParser.data(), &ZsyncRemoteControlFileParserPrivate::logger,
-            this, &QAppImageUpdatePrivate::logger,
-            (Qt::ConnectionType)(Qt::DirectConnection | Qt::UniqueConnection));
+    connect(m_ControlFileParser.data(), &ZsyncRemoteControlFileParserPrivate::timing,
+            this, &QAppImageUpdatePrivate::handleTiming,
+            (Qt::ConnectionType)(Qt::QueuedConnection | Qt::UniqueConnection));
 
     // Delta Writer and Downloader
-    connect(m_DeltaWriter.data(), &ZsyncWriterPrivate::logger,
-            this, &QAppImageUpdatePrivate::logger,
-            (Qt::ConnectionType)(Qt::DirectConnection | Qt::UniqueConnection));
     connect(m_DeltaWriter.data(), &ZsyncWriterPrivate::started,
             this, &QAppImageUpdatePrivate::handleUpdateStart,
             (Qt::ConnectionType)(Qt::QueuedConnection | Qt::UniqueConnection));
@@ -108,6 +121,17 @@ QAppImageUpdatePrivate::QAppImageUpdatePrivate(bool singleThreaded, QObject *par
     connect(m_DeltaWriter.data(), &ZsyncWriterPrivate::torrentStatus,
             this, &QAppImageUpdatePrivate::torrentStatus,
             (Qt::ConnectionType)(Qt::DirectConnection | Qt::UniqueConnection));
+
+    // Write the trace once the action is over, whichever way it ends.
+    connect(this, &QAppImageUpdatePrivate::finished,
+            this, &QAppImageUpdatePrivate::finishTrace,
+            (Qt::ConnectionType)(Qt::DirectConnection | Qt::UniqueConnection));
+    connect(this, &QAppImageUpdatePrivate::error,
+            this, &QAppImageUpdatePrivate::finishTrace,
+            (Qt::ConnectionType)(Qt::DirectConnection | Qt::UniqueConnection));
+    connect(this, &QAppImageUpdatePrivate::canceled,
+            this, &QAppImageUpdatePrivate::finishTrace,
+            (Qt::ConnectionType)(Qt::DirectConnection | Qt::UniqueConnection));
 }
 
 QAppImageUpdatePrivate::QAppImageUpdatePrivate(const QString &AppImagePath, bool singleThreaded, QObject *parent)
@@ -126,10 +150,13 @@ QAppImageUpdatePrivate::~QAppImageUpdatePrivate() {
     if(b_Started || b_Running) {
         cancel();
     }
-
-    if(!m_SharedThread.isNull()) {
-        m_SharedThread->quit();
-        m_SharedThread->wait();
+    finishTrace();
+    Tracer::abandon(this);
+    Tracer::detach(m_UpdateInformation.data());
+    Tracer::detach(m_DeltaWriter.data());
+    Tracer::detach(m_ControlFileParser.data());
+    if(p_IOThread) {
+        UpdateEngine::releaseIOThread(p_IOThread);
     }
     return;
 }
@@ -182,6 +209,29 @@ void QAppImageUpdatePrivate::setAppImage(QFile *AppImage) {
             Q_ARG(QFile*,AppImage));
 }
 
+/* Forwards the log messages only while the logger signal is connected, such
+ * that nothing is formatted when nobody listens. */
+void QAppImageUpdatePrivate::setLoggerConnected(bool choice) {
+    if(choice) {
+        connect(m_UpdateInformation.data(), &AppImageUpdateInformationPrivate::logger,
+                this, &QAppImageUpdatePrivate::logger,
+                (Qt::ConnectionType)(Qt::DirectConnection | Qt::UniqueConnection));
+        connect(m_ControlFileParser.data(), &ZsyncRemoteControlFileParserPrivate::logger,
+                this, &QAppImageUpdatePrivate::logger,
+                (Qt::ConnectionType)(Qt::DirectConnection | Qt::UniqueConnection));
+        connect(m_DeltaWriter.data(), &ZsyncWriterPrivate::logger,
+                this, &QAppImageUpdatePrivate::logger,
+                (Qt::ConnectionType)(Qt::DirectConnection | Qt::UniqueConnection));
+        return;
+    }
+    disconnect(m_UpdateInformation.data(), &AppImageUpdateInformationPrivate::logger,
+               this, &QAppImageUpdatePrivate::logger);
+    disconnect(m_ControlFileParser.data(), &ZsyncRemoteControlFileParserPrivate::logger,
+               this, &QAppImageUpdatePrivate::logger);
+    disconnect(m_DeltaWriter.data(), &ZsyncWriterPrivate::logger,
+               this, &QAppImageUpdatePrivate::logger);
+}
+
 void QAppImageUpdatePrivate::setShowLog(bool choice) {
     if(b_Started || b_Running) {
         return;
@@ -215,11 +265,99 @@ void QAppImageUpdatePrivate::setOutputDirectory(const QString &dir) {
     return;
 }
 
+/*
+ * The network access manager of the engine is shared by every updater, so
+ * a proxy is never set on it. Instead the updater switches to the manager
+ * the engine keeps for this proxy, which is handed to the parser and the
+ * writer in their own threads.
+*/
 void QAppImageUpdatePrivate::setProxy(const QNetworkProxy &proxy) {
     if(b_Started || b_Running) {
         return;
     }
-    m_SharedNetworkAccessManager->setProxy(proxy);
+
+    if(!m_SharedNetworkAccessManager.isNull()) {
+        m_SharedNetworkAccessManager->setProxy(proxy);
+        return;
+    }
+
+    p_NetworkAccessManager = UpdateEngine::networkAccessManager(proxy);
+    getMethod(m_ControlFileParser.data(), "setNetworkAccessManager(QNetworkAccessManager*)")
+    .invoke(m_ControlFileParser.data(),
+            Qt::QueuedConnection,
+            Q_ARG(QNetworkAccessManager*, p_NetworkAccessManager));
+    getMethod(m_DeltaWriter.data(), "setNetworkAccessManager(QNetworkAccessManager*)")
+    .invoke(m_DeltaWriter.data(),
+            Qt::QueuedConnection,
+            Q_ARG(QNetworkAccessManager*, p_NetworkAccessManager));
+    return;
+}
+
+void QAppImageUpdatePrivate::setHttp2Enabled(bool choice) {
+    if(b_Started || b_Running) {
+        return;
+    }
+
+    getMethod(m_DeltaWriter.data(), "setHttp2Enabled(bool)")
+    .invoke(m_DeltaWriter.data(),
+            Qt::QueuedConnection,
+            Q_ARG(bool, choice));
+    return;
+}
+
+void QAppImageUpdatePrivate::setMirrors(const QList<QUrl> &mirrors) {
+    if(b_Started || b_Running) {
+        return;
+    }
+
+    getMethod(m_DeltaWriter.data(), "setMirrors(const QList<QUrl>&)")
+    .invoke(m_DeltaWriter.data(),
+            Qt::QueuedConnection,
+            Q_ARG(QList<QUrl>, mirrors));
+    return;
+}
+
+void QAppImageUpdatePrivate::setSeedDirectories(const QStringList &directories) {
+    if(b_Started || b_Running) {
+        return;
+    }
+
+    getMethod(m_DeltaWriter.data(), "setSeedDirectories(const QStringList&)")
+    .invoke(m_DeltaWriter.data(),
+            Qt::QueuedConnection,
+            Q_ARG(QStringList, directories));
+    return;
+}
+
+void QAppImageUpdatePrivate::setHashingThreads(int threads) {
+    if(b_Started || b_Running) {
+        return;
+    }
+
+    getMethod(m_DeltaWriter.data(), "setHashingThreads(int)")
+    .invoke(m_DeltaWriter.data(),
+            Qt::QueuedConnection,
+            Q_ARG(int, threads));
+    return;
+}
+
+void QAppImageUpdatePrivate::setEstimateDeltaSize(bool choice) {
+    if(b_Started || b_Running) {
+        return;
+    }
+
+    getMethod(m_ControlFileParser.data(), "setEstimateDeltaSize(bool)")
+    .invoke(m_ControlFileParser.data(),
+            Qt::QueuedConnection,
+            Q_ARG(bool, choice));
+    return;
+}
+
+void QAppImageUpdatePrivate::setTraceFile(const QString &path) {
+    if(b_Started || b_Running) {
+        return;
+    }
+    s_TraceFilePath = path;
     return;
 }
 
@@ -245,6 +383,8 @@ void QAppImageUpdatePrivate::start(short action, int flags, QByteArray icon) {
     b_Started = b_Running = true;
     b_Canceled = false;
     b_Finished = false;
+    m_Timings = QJsonObject();
+    m_ActionTimer.start();
 
     if(b_CancelRequested) {
         b_Started = b_Running = false;
@@ -254,6 +394,11 @@ void QAppImageUpdatePrivate::start(short action, int flags, QByteArray icon) {
         return;
     }
 
+    if(!s_TraceFilePath.isEmpty() && !b_Tracing) {
+        Tracer::start(this);
+        b_Tracing = true;
+    }
+
     if(flags == GuiFlag::None) {
         flags = (n_GuiFlag != GuiFlag::None) ? n_GuiFlag : GuiFlag::Default;
     }
@@ -263,6 +408,17 @@ void QAppImageUpdatePrivate::start(short action, int flags, QByteArray icon) {
         icon = m_Icon;
     }
 
+    /* Only a dry run skips probing the target file and writing it. */
+    getMethod(m_ControlFileParser.data(), "setDryRun(bool)")
+    .invoke(m_ControlFileParser.data(),
+            Qt::QueuedConnection,
+            Q_ARG(bool, action == Action::DryRunUpdate));
+
+    getMethod(m_DeltaWriter.data(), "setDryRun(bool)")
+    .invoke(m_DeltaWriter.data(),
+            Qt::QueuedConnection,
+            Q_ARG(bool, action == Action::DryRunUpdate));
+
     if(action == Action::GetEmbeddedInfo) {
         n_CurrentAction = action;
         connect(m_UpdateInformation.data(),  &AppImageUpdateInformationPrivate::info,
@@ -315,7 +471,8 @@ void QAppImageUpdatePrivate::start(short action, int flags, QByteArray icon) {
         emit started(Action::CheckForUpdate);
         getMethod(m_UpdateInformation.data(), "getInfo(void)")
         .invoke(m_UpdateInformation.data(), Qt::QueuedConnection);
-    } else if(action == Action::Update || action == Action::UpdateWithTorrent) {
+    } else if(action == Action::Update || action == Action::UpdateWithTorrent ||
+              action == Action::DryRunUpdate) {
         n_CurrentAction = action;
 
         //// With respect to GDPR, It is strongly adviced
@@ -619,6 +776,14 @@ void QAppImageUpdatePrivate::redirectUpdateCheck(QJsonObject info) {
 	{ "TorrentFileUrl", torrentFileUrl }
     };
 
+    auto estimate = info["DeltaEstimate"].toObject();
+    if(!estimate.isEmpty()) {
+        updateinfo["EstimatedBytesToDownload"] = estimate["BytesToDownload"].toDouble();
+        updateinfo["EstimatedMatchedPercentage"] = estimate["MatchedPercentage"].toDouble();
+        updateinfo["EstimatedRequests"] = estimate["Requests"].toInt();
+    }
+    updateinfo["Statistics"] = statistics(QJsonObject());
+
     b_Started = b_Running = false;
     b_Finished = true;
     b_Canceled = false;
@@ -633,6 +798,37 @@ void QAppImageUpdatePrivate::redirectUpdateCheck(QJsonObject info) {
     emit finished(updateinfo, n_CurrentAction);
 }
 
+/* Writes the events this updater traced since start to the trace file. */
+void QAppImageUpdatePrivate::finishTrace() {
+    if(!b_Tracing) {
+        return;
+    }
+    b_Tracing = false;
+    Tracer::finish(this, s_TraceFilePath);
+}
+
+void QAppImageUpdatePrivate::handleTiming(QString phase, qint64 ms) {
+    m_Timings[phase] = ms;
+}
+
+/*
+ * Adds the time spent reading the update information, hashing the local
+ * AppImage and fetching the control file, and the total time of the action,
+ * to the statistics of the delta writer.
+*/
+QJsonObject QAppImageUpdatePrivate::statistics(QJsonObject writerStatistics) {
+    auto timings = writerStatistics["Timings"].toObject();
+    for(auto iter = m_Timings.constBegin(),
+            end = m_Timings.constEnd();
+            iter != end;
+            ++iter) {
+        timings[iter.key()] = iter.value();
+    }
+    timings["Total"] = m_ActionTimer.elapsed();
+    writerStatistics["Timings"] = timings;
+    return writerStatistics;
+}
+
 void QAppImageUpdatePrivate::handleUpdateStart() {
     emit started(n_CurrentAction);
 }
@@ -730,8 +926,18 @@ void QAppImageUpdatePrivate::handleUpdateFinished(QJsonObject info, QString oldV
         {"NewVersionPath", info["AbsolutePath"].toString()},
         {"NewVersionSha1Hash", info["Sha1Hash"].toString()},
         {"UsedTorrent", info["UsedTorrent"].toBool()},
-	{"TorrentFileUrl", info["TorrentFileUrl"].toString()}
+	{"TorrentFileUrl", info["TorrentFileUrl"].toString()},
+        {"NetworkProtocol", info["NetworkProtocol"].toString()},
+        {"Retries", info["Retries"].toInt()},
+        {"BytesWasted", info["BytesWasted"].toDouble()},
+        {"Statistics", statistics(info["Statistics"].toObject())}
     };
+    if(n_CurrentAction == Action::DryRunUpdate) {
+        /* The plan of the update, nothing was written. */
+        result = info;
+        result["OldVersionPath"] = oldVersionPath;
+        result["Statistics"] = statistics(info["Statistics"].toObject());
+    }
     b_Started = b_Running = false;
     b_Finished = true;
     b_Canceled = false;
@@ -1192,7 +1398,11 @@ void QAppImageUpdatePrivate::handleGUIUpdateFinished(QJsonObject info, QString o
         {"OldVersionPath", oldVersionPath},
         {"NewVersionPath", info["AbsolutePath"].toString()},
         {"NewVersionSha1Hash", info["Sha1Hash"].toString()},
-        {"UsedTorrent", info["UsedTorrent"].toBool()}
+        {"UsedTorrent", info["UsedTorrent"].toBool()},
+        {"NetworkProtocol", info["NetworkProtocol"].toString()},
+        {"Retries", info["Retries"].toInt()},
+        {"BytesWasted", info["BytesWasted"].toDouble()},
+        {"Statistics", statistics(info["Statistics"].toObject())}
     };
     b_Started = b_Running = false;
     b_Finished = true;
@@ -1486,6 +1696,9 @@ QString QAppImageUpdatePrivate::errorCodeToString(short errorCode) {
     case QAppImageUpdateEnums::Error::TargetFileSha1HashMismatch:
         ret += "TargetFileSha1HashMismatch";
         break;
+    case QAppImageUpdateEnums::Error::CannotWriteControlFile:
+        ret += "CannotWriteControlFile";
+        break;
     case QAppImageUpdateEnums::Error::UnsupportedActionForBuild:
         ret += "UnsupportedActionForBuild";
         break;
@@ -1674,6 +1887,9 @@ QString QAppImageUpdatePrivate::errorCodeToDescriptionString(short errorCode) {
     case QAppImageUpdateEnums::Error::TargetFileSha1HashMismatch:
         errorString = QString::fromUtf8("The newly constructed AppImage failed the integrity check, please try again.");
         break;
+    case QAppImageUpdateEnums::Error::CannotWriteControlFile:
+        errorString = QString::fromUtf8("The zsync control file cannot be written.");
+        break;
     case QAppImageUpdateEnums::Error::UnsupportedActionForBuild:
         errorString = QString::fromUtf8("The current build of the core library does not support the requested action.");
         break;
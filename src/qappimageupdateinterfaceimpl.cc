@@ -99,6 +99,8 @@ int QAppImageUpdateInterfaceImpl::getConstant(const QString &constant) {
             r = QAppImageUpdate::Action::UpdateWithGUI;
         } else if(constName == QString::fromUtf8("updatewithguiandtorrent")) {
             r = QAppImageUpdate::Action::UpdateWithGUIAndTorrent;
+        } else if(constName == QString::fromUtf8("dryrunupdate")) {
+            r = QAppImageUpdate::Action::DryRunUpdate;
         } else {
             r = 0;
         }
@@ -1,11 +1,16 @@
 #include "rangedownloader.hpp"
 #include "rangedownloader_p.hpp"
 #include "helpers_p.hpp"
+#include "tracer_p.hpp"
 
 RangeDownloader::RangeDownloader(QNetworkAccessManager *manager, QObject *parent)
     : QObject(parent) {
-    m_Private = QSharedPointer<RangeDownloaderPrivate>(new RangeDownloaderPrivate(manager));
+    /// The replies are handled in the thread of the network access manager,
+    //  which need not be ours.
+    m_Private = QSharedPointer<RangeDownloaderPrivate>(new RangeDownloaderPrivate(manager), deleteInThread);
+    moveToThreadOf(m_Private.data(), manager);
     auto obj = m_Private.data();
+    Tracer::attach(obj, this);
 
     connect(obj, &RangeDownloaderPrivate::started,
             this, &RangeDownloader::started,
@@ -23,6 +28,22 @@ RangeDownloader::RangeDownloader(QNetworkAccessManager *manager, QObject *parent
             this, &RangeDownloader::error,
             Qt::DirectConnection);
 
+    connect(obj, &RangeDownloaderPrivate::targetFileUrlResolved,
+            this, &RangeDownloader::targetFileUrlResolved,
+            Qt::DirectConnection);
+
+    connect(obj, &RangeDownloaderPrivate::networkProtocol,
+            this, &RangeDownloader::networkProtocol,
+            Qt::DirectConnection);
+
+    connect(obj, &RangeDownloaderPrivate::retryCounters,
+            this, &RangeDownloader::retryCounters,
+            Qt::DirectConnection);
+
+    connect(obj, &RangeDownloaderPrivate::requestCounter,
+            this, &RangeDownloader::requestCounter,
+            Qt::DirectConnection);
+
     connect(obj, &RangeDownloaderPrivate::data,
             this, &RangeDownloader::data,
             Qt::DirectConnection);
@@ -36,6 +57,9 @@ RangeDownloader::RangeDownloader(QNetworkAccessManager *manager, QObject *parent
             Qt::DirectConnection);
 }
 
+RangeDownloader::~RangeDownloader() {
+    Tracer::detach(this);
+}
 
 void RangeDownloader::setBlockSize(qint32 blockSize) {
     getMethod(m_Private.data(), "setBlockSize(qint32)")
@@ -55,11 +79,18 @@ void RangeDownloader::setTargetFileUrl(const QUrl &url) {
 
 }
 
-void RangeDownloader::setTargetFileLength(qint32 n) {
-    getMethod(m_Private.data(), "setTargetFileLength(qint32)")
+void RangeDownloader::setResolvedTargetFileUrl(const QUrl &url) {
+    getMethod(m_Private.data(), "setResolvedTargetFileUrl(const QUrl&)")
     .invoke(m_Private.data(),
             Qt::QueuedConnection,
-            Q_ARG(qint32,n));
+            Q_ARG(QUrl,url));
+}
+
+void RangeDownloader::setTargetFileLength(qint64 n) {
+    getMethod(m_Private.data(), "setTargetFileLength(qint64)")
+    .invoke(m_Private.data(),
+            Qt::QueuedConnection,
+            Q_ARG(qint64,n));
 }
 
 void RangeDownloader::setBytesWritten(qint64 n) {
@@ -77,6 +108,20 @@ void RangeDownloader::setFullDownload(bool choice) {
             Q_ARG(bool,choice));
 }
 
+void RangeDownloader::setHttp2Enabled(bool choice) {
+    getMethod(m_Private.data(), "setHttp2Enabled(bool)")
+    .invoke(m_Private.data(),
+            Qt::QueuedConnection,
+            Q_ARG(bool,choice));
+}
+
+void RangeDownloader::appendMirror(const QUrl &url) {
+    getMethod(m_Private.data(), "appendMirror(const QUrl&)")
+    .invoke(m_Private.data(),
+            Qt::QueuedConnection,
+            Q_ARG(QUrl,url));
+}
+
 void RangeDownloader::appendRange(qint32 from, qint32 to) {
     getMethod(m_Private.data(), "appendRange(qint32,qint32)")
     .invoke(m_Private.data(),
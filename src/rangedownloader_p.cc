@@ -2,14 +2,48 @@
 #include <QThread>
 
 #include "rangedownloader_p.hpp"
+#include "helpers_p.hpp"
+#include "bufferpool_p.hpp"
+#include "updateengine_p.hpp"
+#include "tracer_p.hpp"
+
+#include <algorithm>
+
+/// How often we look for slow replies(ms), how long a reply must run
+//  before it can be judged(ms), and how many times slower than the median
+//  it has to be to get a hedge.
+#define HEDGE_CHECK_INTERVAL 1000
+#define HEDGE_MIN_AGE 3000
+#define HEDGE_SLOWDOWN_FACTOR 4
+
+/// Failed replies in a row on a mirror after which it is not used
+//  anymore, as long as there is another mirror left.
+#define MIRROR_FAIL_THRESHOLD 5
+
+/// Bytes a single downloader may have in flight, every range reply holds
+//  up to MAX_RANGE_BYTES in memory until it is handed to the writer.
+#define MAX_BYTES_IN_FLIGHT (64 * 1024 * 1024)
+
+/// Replies a single downloader keeps running at a time, the engine may
+//  allow fewer when it is shared with other updates.
+static int maxActiveRequests() {
+    return qMin(QThread::idealThreadCount() * 2, MAX_BYTES_IN_FLIGHT / MAX_RANGE_BYTES);
+}
 
 RangeDownloaderPrivate::RangeDownloaderPrivate(QNetworkAccessManager *manager, QObject *parent)
     : QObject(parent) {
     m_Manager = manager;
-    m_Manager->clearAccessCache();
+
+    m_StragglerTimer.setParent(this); // moves along with us.
+    m_StragglerTimer.setInterval(HEDGE_CHECK_INTERVAL);
+    connect(&m_StragglerTimer, SIGNAL(timeout()),
+            this, SLOT(checkStragglers()));
 }
 
 RangeDownloaderPrivate::~RangeDownloaderPrivate() {
+    Tracer::detach(this);
+    UpdateEngine::withdraw(this);
+    abortUrlChecks();
     if(b_Running) {
         for(auto iter = m_ActiveRequests.begin(),
                 end = m_ActiveRequests.end();
@@ -39,7 +73,16 @@ void RangeDownloaderPrivate::setTargetFileUrl(const QUrl &url) {
     m_Url = url;
 }
 
-void RangeDownloaderPrivate::setTargetFileLength(qint32 len) {
+/// If the resolved url is already known for this session then
+//  we can skip the url check altogether.
+void RangeDownloaderPrivate::setResolvedTargetFileUrl(const QUrl &url) {
+    if(b_Running) {
+        return;
+    }
+    m_ResolvedUrl = url;
+}
+
+void RangeDownloaderPrivate::setTargetFileLength(qint64 len) {
     if(b_Running) {
         return;
     }
@@ -60,6 +103,16 @@ void RangeDownloaderPrivate::setFullDownload(bool fullDownload) {
     b_FullDownload = fullDownload;
 }
 
+/// When enabled, all range requests to a host which speaks h2 are
+//  multiplexed on a single connection instead of being queued behind
+//  the six connections per host limit of HTTP/1.1.
+void RangeDownloaderPrivate::setHttp2Enabled(bool choice) {
+    if(b_Running) {
+        return;
+    }
+    b_Http2Enabled = choice;
+}
+
 void RangeDownloaderPrivate::appendRange(qint32 from, qint32 to) {
     if(b_Running) {
         return;
@@ -69,36 +122,69 @@ void RangeDownloaderPrivate::appendRange(qint32 from, qint32 to) {
     m_RequiredBlocks.append(qMakePair<qint32, qint32>(from,to));
 }
 
+/// Extra mirrors of the target file, ranges are spread across these and
+//  the target file url by how fast each one serves us.
+void RangeDownloaderPrivate::appendMirror(const QUrl &url) {
+    if(b_Running || !url.isValid() || m_Mirrors.contains(url)) {
+        return;
+    }
+    m_Mirrors.append(url);
+}
+
 void RangeDownloaderPrivate::start() {
     if(b_Running) {
         return;
     }
-    b_Running = b_Finished = false;
+    b_Running = b_Finished = b_RequestsStarted = false;
     n_Active = -1;
 
-    QNetworkRequest request;
-
-    // Before starting the download we have to resolve the url such that it
-    // does not have any redirections whatsoever.
-    // For this we send a get request and abort it before it even begin.
-    // We should not send a HEAD request since it may not be supported by some
-    // hosts.
-    request.setUrl(m_Url);
-    request.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
+    /// The first mirror is always the target file url.
+    m_MirrorUrls.clear();
+    m_MirrorUrls.append(m_Url);
+    for(auto iter = m_Mirrors.constBegin(),
+            end = m_Mirrors.constEnd();
+            iter != end;
+            ++iter) {
+        if(!m_MirrorUrls.contains(*iter)) {
+            m_MirrorUrls.append(*iter);
+        }
+    }
+    auto mirrors = m_MirrorUrls.size();
+    m_MirrorUsable.fill(false, mirrors);
+    m_MirrorThroughput.fill(0, mirrors);
+    m_MirrorActive.fill(0, mirrors);
+    m_MirrorFails.fill(0, mirrors);
 
-    auto reply = m_Manager->get(request);
-    connect(reply, SIGNAL(error(QNetworkReply::NetworkError)),
-            this, SLOT(handleUrlCheckError(QNetworkReply::NetworkError)));
-    connect(reply, SIGNAL(downloadProgress(qint64, qint64)),
-            this, SLOT(handleUrlCheck(qint64, qint64)));
     b_Running = true;
     emit started();
+
+    /// Every mirror is checked in parallel, we start with the
+    //  first one which turns out to be usable.
+    for(int mirror = 1; mirror < mirrors; ++mirror) {
+        checkUrl(mirror);
+    }
+
+    if(!m_ResolvedUrl.isEmpty()) {
+        m_Url = m_MirrorUrls[0] = m_ResolvedUrl;
+        handleUrlChecked(0, true, QNetworkReply::NoError);
+        return;
+    }
+    checkUrl(0);
 }
 
 void RangeDownloaderPrivate::cancel() {
     if(!b_Running || b_CancelRequested) {
         return;
     }
+    abortUrlChecks();
+
+    /// Nothing was started yet, so nothing to wait for.
+    if(!b_RequestsStarted) {
+        b_Running = b_Finished = false;
+        emit canceled();
+        return;
+    }
+
     b_CancelRequested = true;
     for(auto iter = m_ActiveRequests.begin(),
             end = m_ActiveRequests.end();
@@ -109,6 +195,14 @@ void RangeDownloaderPrivate::cancel() {
         }
 	QCoreApplication::processEvents();
     }
+
+    /// Nothing is running while we wait for a request slot.
+    if(n_Active == -1) {
+        UpdateEngine::withdraw(this);
+        m_StragglerTimer.stop();
+        b_Running = b_Finished = b_CancelRequested = false;
+        emit canceled();
+    }
 }
 
 /// Private Slots
@@ -117,39 +211,61 @@ QNetworkRequest RangeDownloaderPrivate::makeRangeRequest(const QUrl &url, const
 
     request.setUrl(url);
     if(range.first || range.second) {
-
-        auto fromRange = range.first * n_BlockSize;
-        auto toRange = range.second * n_BlockSize;
-
-
-        QByteArray rangeHeaderValue = "bytes=" + QByteArray::number(fromRange) + "-";
-        rangeHeaderValue += QByteArray::number(toRange);
-        request.setRawHeader("Range", rangeHeaderValue);
+        request.setRawHeader("Range", makeRangeHeaderValue(range.first, range.second, n_BlockSize));
     }
     request.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
+    request.setAttribute(QNetworkRequest::Http2AllowedAttribute, b_Http2Enabled);
     return request;
 }
 
 
 // Slots which does the url check routine
+void RangeDownloaderPrivate::checkUrl(int mirror) {
+    // Before starting the download we have to resolve the url such that it
+    // does not have any redirections whatsoever.
+    // For this we send a zero length range request which also tells us if
+    // the server really accepts ranges and the total length of the file.
+    // We should not send a HEAD request since it may not be supported by some
+    // hosts.
+    auto request = makeProbeRequest(m_MirrorUrls.at(mirror));
+    request.setAttribute(QNetworkRequest::Http2AllowedAttribute, b_Http2Enabled);
+
+    auto reply = m_Manager->get(request);
+    m_UrlChecks.insert(reply, mirror);
+    connect(reply, SIGNAL(error(QNetworkReply::NetworkError)),
+            this, SLOT(handleUrlCheckError(QNetworkReply::NetworkError)));
+    connect(reply, SIGNAL(metaDataChanged()),
+            this, SLOT(handleUrlCheck()));
+}
+
+void RangeDownloaderPrivate::abortUrlChecks() {
+    for(auto iter = m_UrlChecks.begin(),
+            end = m_UrlChecks.end();
+            iter != end;
+            ++iter) {
+        iter.key()->disconnect();
+        iter.key()->abort();
+        iter.key()->deleteLater();
+    }
+    m_UrlChecks.clear();
+}
+
 void RangeDownloaderPrivate::handleUrlCheckError(QNetworkReply::NetworkError code) {
     QNetworkReply *reply = qobject_cast<QNetworkReply*>(QObject::sender());
-    if(!reply) {
+    if(!reply || !m_UrlChecks.contains(reply)) {
         return;
     }
 
+    auto mirror = m_UrlChecks.take(reply);
     reply->disconnect();
     reply->deleteLater();
 
-    emit error(code);
+    handleUrlChecked(mirror, false, code);
 }
 
-void RangeDownloaderPrivate::handleUrlCheck(qint64 br, qint64 bt) {
-    Q_UNUSED(br);
-    Q_UNUSED(bt);
-
+void RangeDownloaderPrivate::handleUrlCheck() {
     auto reply = qobject_cast<QNetworkReply*>(QObject::sender());
-    if(!reply) {
+    if(!reply || !m_UrlChecks.contains(reply)) {
         return;
     }
 
@@ -157,46 +273,133 @@ void RangeDownloaderPrivate::handleUrlCheck(qint64 br, qint64 bt) {
         return;
     }
 
-    m_Url = reply->url();
+    bool acceptRanges = false;
+    qint64 totalLength = -1;
+    if(!parseProbeReply(reply, &acceptRanges, &totalLength)) {
+        return; // Still redirecting, or failed.
+    }
+
+    disconnect(reply, SIGNAL(metaDataChanged()),
+               this, SLOT(handleUrlCheck()));
+
+    auto mirror = m_UrlChecks.value(reply);
+    m_MirrorUrls[mirror] = reply->url();
+    if(mirror == 0) {
+        m_Url = reply->url();
+        emit networkProtocol(reply->attribute(QNetworkRequest::HTTP2WasUsedAttribute).toBool() ?
+                             QString::fromUtf8("HTTP/2") : QString::fromUtf8("HTTP/1.1"));
+    }
+
+    /// The server ignored the range and is sending the entire file, so
+    //  abort it. This is fine for a full download from the target file
+    //  url but range requests will never work with this server.
+    if(!acceptRanges) {
+        m_UrlChecks.remove(reply);
+        reply->disconnect();
+        reply->abort();
+        reply->deleteLater();
+
+        if(b_FullDownload && mirror == 0) {
+            handleUrlChecked(mirror, true, QNetworkReply::NoError);
+            return;
+        }
+        handleUrlChecked(mirror, false, QNetworkReply::ProtocolInvalidOperationError);
+        return;
+    }
+
+    /// The length given in the control file does not match the
+    //  file in the server, no point in downloading anything from it.
+    if(totalLength > 0 && n_TotalSize > 0 && totalLength != n_TotalSize) {
+        m_UrlChecks.remove(reply);
+        reply->disconnect();
+        reply->abort();
+        reply->deleteLater();
+
+        handleUrlChecked(mirror, false, QNetworkReply::UnknownContentError);
+        return;
+    }
+
+    if(mirror == 0) {
+        m_ResolvedUrl = m_Url;
+        emit targetFileUrlResolved(m_ResolvedUrl);
+    }
+
+    /// Let the single byte arrive such that the connection is reused
+    //  for the first range request.
+    if(reply->isFinished()) {
+        m_UrlChecks.remove(reply);
+        reply->disconnect();
+        reply->deleteLater();
+        handleUrlChecked(mirror, true, QNetworkReply::NoError);
+        return;
+    }
+    connect(reply, SIGNAL(finished()),
+            this, SLOT(handleUrlCheckFinished()));
+}
+
+void RangeDownloaderPrivate::handleUrlCheckFinished() {
+    auto reply = qobject_cast<QNetworkReply*>(QObject::sender());
+    if(!reply || !m_UrlChecks.contains(reply)) {
+        return;
+    }
+
+    if(reply->error() != QNetworkReply::NoError) {
+        return;
+    }
 
+    auto mirror = m_UrlChecks.take(reply);
     reply->disconnect();
-    reply->abort();
     reply->deleteLater();
 
+    handleUrlChecked(mirror, true, QNetworkReply::NoError);
+}
+
+/// Called once for every mirror when its check is over. The download
+//  starts with the first usable mirror and only fails when none of the
+//  mirrors can be used.
+void RangeDownloaderPrivate::handleUrlChecked(int mirror, bool usable, QNetworkReply::NetworkError code) {
+    if(!b_Running) {
+        return;
+    }
+
+    m_MirrorUsable[mirror] = usable;
+    if(usable) {
+        if(!b_RequestsStarted) {
+            startRangeRequests();
+        }
+        return;
+    }
+
+    if(b_RequestsStarted || !m_UrlChecks.isEmpty()) {
+        return;
+    }
+
+    b_Running = false;
+    emit error(code);
+}
+
+void RangeDownloaderPrivate::startRangeRequests() {
     /// Now we will start the actual download since we got
     //  the clean url to the target file.
+    b_RequestsStarted = true;
 
     /// Amount of bytes downloaded
     n_RecievedBytes = 0;
+    n_Retries = 0;
+    n_Requests = 0;
+    n_BytesWasted = 0;
+    m_Throughputs.clear();
+    m_HedgeOf.clear();
+    m_Hedged.clear();
     m_ElapsedTimer.start();
 
     /// If this flag is set then it means we can't use range request and
     //  we have to initiate a very simple download.
     if(b_FullDownload) {
-        /// Full download just launch a single RangeReply object.
+        /// Full download just launch a single RangeReply object
+        //  from the target file url.
         ++n_Active;
-        auto range = qMakePair<qint32,qint32>(0,0);
-        auto rangeReply = new RangeReply(n_Active, m_Manager->get(makeRangeRequest(m_Url, range)), range);
-
-        connect(rangeReply, SIGNAL(canceled(int)),
-                this, SLOT(handleRangeReplyCancel(int)),
-                Qt::QueuedConnection);
-
-        connect(rangeReply, SIGNAL(restarted(int)),
-                this, SLOT(handleRangeReplyRestart(int)),
-                Qt::QueuedConnection);
-
-        connect(rangeReply, SIGNAL(error(QNetworkReply::NetworkError, int,bool)),
-                this, SLOT(handleRangeReplyError(QNetworkReply::NetworkError, int,bool)),
-                Qt::QueuedConnection);
-
-        connect(rangeReply, SIGNAL(finished(qint32,qint32, QByteArray*, int)),
-                this, SLOT(handleRangeReplyFinished(qint32,qint32, QByteArray*, int)),
-                Qt::QueuedConnection);
-
-        connect(rangeReply, SIGNAL(progress(qint64, int)),
-                this, SLOT(handleRangeReplyProgress(qint64, int)),
-                Qt::QueuedConnection);
+        auto rangeReply = newRangeReply(n_Active, qMakePair<qint32,qint32>(0,0));
 
         connect(rangeReply, SIGNAL(data(QByteArray*, bool)),
                 this, SIGNAL(data(QByteArray*, bool)),
@@ -208,79 +411,291 @@ void RangeDownloaderPrivate::handleUrlCheck(qint64 br, qint64 bt) {
     }
 
     // Now we will determine the maximum no. of requests to be handled at
-    // a time.
-    int max_allowed = QThread::idealThreadCount() * 2;
+    // a time. Without a free slot in the engine we wait in line for one.
+    int max_allowed = maxActiveRequests();
     int i = n_Done;
 
     for(; i < m_RequiredBlocks.size(); ++i) {
         if(n_Active + 1 >= max_allowed) {
             break;
         }
+        if(!UpdateEngine::acquireRequest(this)) {
+            break;
+        }
 
-        auto range = m_RequiredBlocks.at(i);
-
-        QNetworkRequest request = makeRangeRequest(m_Url, range);
         ++n_Active;
+        m_ActiveRequests.append(newRangeReply(n_Active, m_RequiredBlocks.at(i)));
+    }
+    n_Done = i;
 
-        auto rangeReply = new RangeReply(n_Active, m_Manager->get(request), range);
+    m_StragglerTimer.start();
+}
+
+/// Picks the mirror which is expected to serve the next range the fastest,
+//  that is the one with the best throughput per active reply. A mirror we
+//  have not measured yet is assumed to be as fast as the best one so it
+//  gets a fair share to be measured.
+int RangeDownloaderPrivate::pickMirror(int avoid) {
+    double best = 0;
+    for(auto iter = m_MirrorThroughput.constBegin(),
+            end = m_MirrorThroughput.constEnd();
+            iter != end;
+            ++iter) {
+        best = qMax(best, *iter);
+    }
+    if(best <= 0) {
+        best = 1;
+    }
 
-        connect(rangeReply, SIGNAL(canceled(int)),
-                this, SLOT(handleRangeReplyCancel(int)),
-                Qt::QueuedConnection);
+    int picked = -1;
+    double pickedScore = -1;
+    for(int mirror = 0; mirror < m_MirrorUrls.size(); ++mirror) {
+        if(!m_MirrorUsable.at(mirror) || mirror == avoid) {
+            continue;
+        }
+        double throughput = m_MirrorThroughput.at(mirror) > 0 ? m_MirrorThroughput.at(mirror) : best;
+        double score = throughput / (m_MirrorActive.at(mirror) + 1);
+        if(score > pickedScore) {
+            picked = mirror;
+            pickedScore = score;
+        }
+    }
 
-        connect(rangeReply, SIGNAL(restarted(int)),
-                this, SLOT(handleRangeReplyRestart(int)),
-                Qt::QueuedConnection);
+    /// Only the avoided mirror is usable, or none is while the checks
+    //  are still running, never a mirror whose check failed.
+    if(picked == -1) {
+        picked = (avoid != -1) ? pickMirror() : qMax(0, m_MirrorUsable.indexOf(true));
+    }
+    return picked;
+}
 
-        connect(rangeReply, SIGNAL(error(QNetworkReply::NetworkError, int,bool)),
-                this, SLOT(handleRangeReplyError(QNetworkReply::NetworkError, int,bool)),
-                Qt::QueuedConnection);
+RangeReply *RangeDownloaderPrivate::newRangeReply(int index, const QPair<qint32, qint32> &range, int avoidMirror) {
+    /// A full download is never split, so it comes from the first mirror
+    //  which passed its check, the target file url if that one did.
+    int mirror = b_FullDownload ? qMax(0, m_MirrorUsable.indexOf(true)) : pickMirror(avoidMirror);
+    auto rangeReply = new RangeReply(index,
+                                     m_Manager->get(makeRangeRequest(m_MirrorUrls.at(mirror), range)),
+                                     range, n_BlockSize, this);
+    emit requestCounter(++n_Requests);
 
-        connect(rangeReply, SIGNAL(finished(qint32,qint32, QByteArray*, int)),
-                this, SLOT(handleRangeReplyFinished(qint32,qint32, QByteArray*, int)),
-                Qt::QueuedConnection);
+    connect(rangeReply, SIGNAL(canceled(int)),
+            this, SLOT(handleRangeReplyCancel(int)),
+            Qt::QueuedConnection);
 
-        connect(rangeReply, SIGNAL(progress(qint64, int)),
-                this, SLOT(handleRangeReplyProgress(qint64, int)),
-                Qt::QueuedConnection);
+    connect(rangeReply, SIGNAL(restarted(int, qint64)),
+            this, SLOT(handleRangeReplyRestart(int, qint64)),
+            Qt::QueuedConnection);
 
-        m_ActiveRequests.append(rangeReply);
+    connect(rangeReply, SIGNAL(error(QNetworkReply::NetworkError, int, bool)),
+            this, SLOT(handleRangeReplyError(QNetworkReply::NetworkError, int, bool)),
+            Qt::QueuedConnection);
+
+    connect(rangeReply, SIGNAL(finished(qint32, qint32, QByteArray*, int)),
+            this, SLOT(handleRangeReplyFinished(qint32, qint32, QByteArray*, int)),
+            Qt::QueuedConnection);
+
+    connect(rangeReply, SIGNAL(progress(qint64, int)),
+            this, SLOT(handleRangeReplyProgress(qint64, int)),
+            Qt::QueuedConnection);
+
+    /// Book keeping for the straggler detection.
+    if(index >= m_ActiveRanges.size()) {
+        m_ActiveRanges.resize(index + 1);
+        m_ReplyBytes.resize(index + 1);
+        m_ReplyStarted.resize(index + 1);
+        m_ReplyMirror.resize(index + 1);
+    }
+    m_ActiveRanges[index] = range;
+    m_ReplyBytes[index] = 0;
+    m_ReplyStarted[index] = m_ElapsedTimer.elapsed();
+    m_ReplyMirror[index] = mirror;
+    ++m_MirrorActive[mirror];
+    m_Hedged.remove(index);
+    return rangeReply;
+}
+
+/// Destroys the reply at the given index and frees its slot on the mirror.
+void RangeDownloaderPrivate::releaseReply(int index) {
+    auto reply = m_ActiveRequests.value(index);
+    if(!reply) {
+        return;
+    }
+    reply->disconnect();
+    reply->destroy();
+    m_ActiveRequests[index] = nullptr;
+    --m_MirrorActive[m_ReplyMirror.at(index)];
+    if(!b_FullDownload) {
+        UpdateEngine::releaseRequests(this);
     }
-    n_Done = i;
+}
+
+/// The engine took a request slot for us while we waited in line.
+void RangeDownloaderPrivate::handleRequestSlot() {
+    if(!b_Running || b_CancelRequested || b_FullDownload || n_Done >= m_RequiredBlocks.size()) {
+        UpdateEngine::releaseRequests(this);
+        return;
+    }
+
+    int index = m_ActiveRequests.size();
+    ++n_Active;
+    m_ActiveRequests.append(nullptr);
+    m_ActiveRequests[index] = newRangeReply(index, m_RequiredBlocks.at(n_Done++));
+    m_StragglerTimer.start();
+
+    /// Back in line for the next one as long as we are below our own limit.
+    if(n_Done < m_RequiredBlocks.size() && n_Active + 1 < maxActiveRequests() &&
+            UpdateEngine::acquireRequest(this)) {
+        QMetaObject::invokeMethod(this, "handleRequestSlot", Qt::QueuedConnection);
+    }
+}
+
+/// A single slow reply at the tail holds up the entire update, so when a
+//  reply is far slower than the median of the finished ones, we request
+//  the blocks it did not get yet once more and take whichever comes first.
+void RangeDownloaderPrivate::checkStragglers() {
+    if(!b_Running || b_CancelRequested || b_FullDownload) {
+        m_StragglerTimer.stop();
+        return;
+    }
+
+    /// Only at the tail, when there are no more ranges left to start.
+    if(n_Done < m_RequiredBlocks.size() || m_Throughputs.isEmpty()) {
+        return;
+    }
+
+    auto sorted = m_Throughputs;
+    std::sort(sorted.begin(), sorted.end());
+    double median = sorted.at(sorted.size() / 2);
+
+    auto now = m_ElapsedTimer.elapsed();
+    int count = m_ActiveRequests.size();
+    for(int index = 0; index < count; ++index) {
+        if(!m_ActiveRequests.at(index) ||
+                m_HedgeOf.contains(index) ||
+                m_Hedged.contains(index)) {
+            continue;
+        }
+
+        auto age = now - m_ReplyStarted.at(index);
+        if(age < HEDGE_MIN_AGE) {
+            continue;
+        }
+
+        double throughput = static_cast<double>(m_ReplyBytes.at(index)) / age;
+        if(throughput * HEDGE_SLOWDOWN_FACTOR >= median) {
+            continue;
+        }
+
+        auto range = m_ActiveRanges.at(index);
+        auto split = range.first + static_cast<qint32>(m_ReplyBytes.at(index) / n_BlockSize);
+        if(split >= range.second) {
+            continue;
+        }
+
+        /// Hedges only use a slot nobody waits for.
+        if(!UpdateEngine::acquireRequest(this, /*wait=*/false)) {
+            return;
+        }
+
+        int hedgeIndex = m_ActiveRequests.size();
+        ++n_Active;
+        m_ActiveRequests.append(nullptr);
+        m_ActiveRequests[hedgeIndex] = newRangeReply(hedgeIndex, qMakePair(split, range.second),
+                                       m_ReplyMirror.at(index));
+        m_HedgeOf.insert(hedgeIndex, index);
+        m_Hedged.insert(index);
+    }
+}
+
+/// Drops the hedge of a straggler which finished first.
+void RangeDownloaderPrivate::dropHedge(int straggler) {
+    auto hedgeIndex = m_HedgeOf.key(straggler, -1);
+    if(hedgeIndex == -1) {
+        return;
+    }
+    m_HedgeOf.remove(hedgeIndex);
+
+    if(m_ActiveRequests.at(hedgeIndex)) {
+        releaseReply(hedgeIndex);
+        --n_Active;
+    }
+
+    n_BytesWasted += m_ReplyBytes.at(hedgeIndex);
+    n_RecievedBytes -= m_ReplyBytes.at(hedgeIndex);
+    emit retryCounters(n_Retries, n_BytesWasted);
+}
+
+void RangeDownloaderPrivate::stopAll() {
+    n_Active = -1;
+    m_StragglerTimer.stop();
+    abortUrlChecks();
+    UpdateEngine::withdraw(this);
+    for(auto iter = m_ActiveRequests.begin(),
+            end = m_ActiveRequests.end();
+            iter != end;
+            ++iter) {
+        if(*iter) {
+            (*iter)->disconnect();
+            (*iter)->destroy();
+        }
+    }
+    m_ActiveRequests.clear();
+    m_MirrorActive.fill(0);
+    m_HedgeOf.clear();
+    m_Hedged.clear();
 }
 
 /// ----
 
 /// Range Reply Handlers
 void RangeDownloaderPrivate::handleRangeReplyCancel(int index) {
-    (m_ActiveRequests.at(index))->destroy();
-    m_ActiveRequests[index] = nullptr;
+    if(!m_ActiveRequests.value(index)) {
+        return;
+    }
+    releaseReply(index);
     --n_Active;
     if(n_Active == -1) {
+        m_StragglerTimer.stop();
         b_Running = b_Finished = b_CancelRequested = false;
         emit canceled();
     }
 }
 
 
-void RangeDownloaderPrivate::handleRangeReplyRestart(int index) {
-    Q_UNUSED(index);
-
+void RangeDownloaderPrivate::handleRangeReplyRestart(int index, qint64 bytesDiscarded) {
+    /// The discarded bytes will be received again, so don't
+    //  count them twice in the progress.
+    ++n_Retries;
+    n_BytesWasted += bytesDiscarded;
+    n_RecievedBytes -= bytesDiscarded;
+    if(index < m_ReplyBytes.size()) {
+        m_ReplyBytes[index] -= bytesDiscarded;
+    }
+    emit retryCounters(n_Retries, n_BytesWasted);
 }
 
 void RangeDownloaderPrivate::handleRangeReplyError(QNetworkReply::NetworkError code, int index, bool threshReached) {
+    if(!m_ActiveRequests.value(index)) {
+        return;
+    }
+
     if(b_CancelRequested) {
-        (m_ActiveRequests.at(index))->destroy();
-        m_ActiveRequests[index] = nullptr;
+        releaseReply(index);
         --n_Active;
         if(n_Active == -1) {
+            m_StragglerTimer.stop();
             b_Running = b_Finished = b_CancelRequested = false;
             emit canceled();
         }
         return;
     }
 
-
+    /// A failed hedge is not worth retrying, the straggler
+    //  is still there to give us the blocks.
+    if(m_HedgeOf.contains(index)) {
+        dropHedge(m_HedgeOf.value(index));
+        return;
+    }
 
     /// Let's try to retry some type of errors.
     /// We don't try to retry a full download, if it
@@ -288,43 +703,69 @@ void RangeDownloaderPrivate::handleRangeReplyError(QNetworkReply::NetworkError c
     /// start. This is because even if we try to restart
     /// we have to download it from the begining and so
     /// It has some complications.
-    if((code == QNetworkReply::RemoteHostClosedError ||
-            code == QNetworkReply::HostNotFoundError ||
-            code == QNetworkReply::TimeoutError ||
-            code == QNetworkReply::TemporaryNetworkFailureError ||
-            code == QNetworkReply::BackgroundRequestNotAllowedError ||
-            code == QNetworkReply::ProxyConnectionClosedError ||
-            code == QNetworkReply::ProxyTimeoutError ||
-            code == QNetworkReply::ContentAccessDenied ||
-            code == QNetworkReply::ContentReSendError ||
-            code == QNetworkReply::InternalServerError ||
-            code == QNetworkReply::ServiceUnavailableError) && !threshReached && !b_FullDownload) {
+    bool retryable = (code == QNetworkReply::RemoteHostClosedError ||
+                      code == QNetworkReply::HostNotFoundError ||
+                      code == QNetworkReply::TimeoutError ||
+                      code == QNetworkReply::TemporaryNetworkFailureError ||
+                      code == QNetworkReply::BackgroundRequestNotAllowedError ||
+                      code == QNetworkReply::ProxyConnectionClosedError ||
+                      code == QNetworkReply::ProxyTimeoutError ||
+                      code == QNetworkReply::ContentAccessDenied ||
+                      code == QNetworkReply::ContentReSendError ||
+                      code == QNetworkReply::InternalServerError ||
+                      code == QNetworkReply::ServiceUnavailableError);
+
+    /// With more than one usable mirror, a mirror which keeps failing
+    //  or gives an error we cannot retry is dropped and the range
+    //  continues from another mirror.
+    if(!b_FullDownload) {
+        auto mirror = m_ReplyMirror.at(index);
+        ++m_MirrorFails[mirror];
+        if((!retryable || threshReached || m_MirrorFails.at(mirror) >= MIRROR_FAIL_THRESHOLD) &&
+                m_MirrorUsable.count(true) > 1) {
+            m_MirrorUsable[mirror] = false;
+        }
+
+        if(!m_MirrorUsable.at(mirror)) {
+            auto other = pickMirror(mirror);
+            if(other != mirror && m_MirrorUsable.at(other)) {
+                --m_MirrorActive[mirror];
+                ++m_MirrorActive[other];
+                m_ReplyMirror[index] = other;
+                (m_ActiveRequests.at(index))->setUrl(m_MirrorUrls.at(other));
+                (m_ActiveRequests.at(index))->retry(0);
+                return;
+            }
+        }
+    }
+
+    if(retryable && !threshReached && !b_FullDownload) {
         (m_ActiveRequests.at(index))->retry();
         return;
     } else {
-        n_Active = -1;
-        for(auto iter = m_ActiveRequests.begin(),
-                end = m_ActiveRequests.end();
-                iter != end;
-                ++iter) {
-            if(*iter) {
-                (*iter)->disconnect();
-                (*iter)->destroy();
-            }
-        }
-        m_ActiveRequests.clear();
+        stopAll();
         b_Running = b_Finished = b_CancelRequested = false;
         emit error(code);
     }
 }
 
 void RangeDownloaderPrivate::handleRangeReplyFinished(qint32 from, qint32 to, QByteArray *Data, int index) {
-    (m_ActiveRequests.at(index))->destroy();
-    m_ActiveRequests[index] = nullptr;
+    if(!m_ActiveRequests.value(index)) {
+        BufferPool::release(Data); // A dropped hedge.
+        return;
+    }
+    releaseReply(index);
+
+    /// Only failures in a row count against a mirror, so a few
+    //  transient errors spread over a long download do not drop it.
+    if(!b_FullDownload) {
+        m_MirrorFails[m_ReplyMirror.at(index)] = 0;
+    }
 
     if(b_CancelRequested) {
         --n_Active;
         if(n_Active == -1) {
+            m_StragglerTimer.stop();
             b_Running = b_Finished = b_CancelRequested = false;
             emit canceled();
         }
@@ -334,14 +775,54 @@ void RangeDownloaderPrivate::handleRangeReplyFinished(qint32 from, qint32 to, QB
     if(b_FullDownload) {
         emit data(Data, true);
         return;
+    }
+
+    /// The hedge won, so the straggler only has to give
+    //  the blocks it already got.
+    if(m_HedgeOf.contains(index)) {
+        auto straggler = m_HedgeOf.take(index);
+        --n_Active;
+        emit rangeData(from, to, Data, false);
+
+        if(m_ActiveRequests.at(straggler)) {
+            m_ActiveRequests.at(straggler)->finishAt(from);
+        }
+        return;
+    }
+
+    if(m_Hedged.contains(index)) {
+        /// The straggler won, the hedge is not needed anymore.
+        dropHedge(index);
+
+        /// Whatever the straggler got beyond the hedge is wasted.
+        auto wasted = m_ReplyBytes.at(index) - Data->size();
+        if(wasted > 0) {
+            n_BytesWasted += wasted;
+            n_RecievedBytes -= wasted;
+            emit retryCounters(n_Retries, n_BytesWasted);
+        }
     } else {
-        bool isLast = (n_Done >= m_RequiredBlocks.size() && n_Active - 1 == -1);
-        emit rangeData(from, to,  Data, isLast);
+        auto age = m_ElapsedTimer.elapsed() - m_ReplyStarted.at(index);
+        if(age > 0) {
+            double throughput = static_cast<double>(m_ReplyBytes.at(index)) / age;
+            m_Throughputs.append(throughput);
+
+            /// Moving average such that a mirror which slows down
+            //  during the download gets fewer ranges.
+            auto mirror = m_ReplyMirror.at(index);
+            m_MirrorThroughput[mirror] = m_MirrorThroughput.at(mirror) > 0 ?
+                                         0.7 * m_MirrorThroughput.at(mirror) + 0.3 * throughput :
+                                         throughput;
+        }
     }
 
+    bool isLast = (n_Done >= m_RequiredBlocks.size() && n_Active - 1 == -1);
+    emit rangeData(from, to,  Data, isLast);
+
     if(n_Done >= m_RequiredBlocks.size()) {
         --n_Active;
         if(n_Active == -1) {
+            m_StragglerTimer.stop();
             b_Running = false;
             b_Finished = true;
             emit finished();
@@ -349,36 +830,19 @@ void RangeDownloaderPrivate::handleRangeReplyFinished(qint32 from, qint32 to, QB
         return;
     }
 
-    auto range = m_RequiredBlocks.at(n_Done++);
-    QNetworkRequest request = makeRangeRequest(m_Url, range);
-    auto rangeReply = new RangeReply(index, m_Manager->get(request), range);
-    m_ActiveRequests[index] = rangeReply;
-
-    connect(rangeReply, SIGNAL(canceled(int)),
-            this, SLOT(handleRangeReplyCancel(int)),
-            Qt::QueuedConnection);
-
-    connect(rangeReply, SIGNAL(restarted(int)),
-            this, SLOT(handleRangeReplyRestart(int)),
-            Qt::QueuedConnection);
-
-    connect(rangeReply, SIGNAL(error(QNetworkReply::NetworkError, int, bool)),
-            this, SLOT(handleRangeReplyError(QNetworkReply::NetworkError, int, bool)),
-            Qt::QueuedConnection);
-
-    connect(rangeReply, SIGNAL(finished(qint32, qint32, QByteArray*, int)),
-            this, SLOT(handleRangeReplyFinished(qint32, qint32, QByteArray*, int)),
-            Qt::QueuedConnection);
-
-    connect(rangeReply, SIGNAL(progress(qint64, int)),
-            this, SLOT(handleRangeReplyProgress(qint64, int)),
-            Qt::QueuedConnection);
-
-
+    /// The slot of this reply went back to the engine, so we may
+    //  have to wait in line for the next one.
+    if(!UpdateEngine::acquireRequest(this)) {
+        --n_Active;
+        return;
+    }
+    m_ActiveRequests[index] = newRangeReply(index, m_RequiredBlocks.at(n_Done++));
 }
 
 void RangeDownloaderPrivate::handleRangeReplyProgress(qint64 bytesRc, int index) {
-    Q_UNUSED(index);
+    if(index < m_ReplyBytes.size()) {
+        m_ReplyBytes[index] += bytesRc;
+    }
 
     n_RecievedBytes += bytesRc;
     qint64 totalBytesRecieved = n_BytesWritten + n_RecievedBytes;
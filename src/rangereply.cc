@@ -4,10 +4,11 @@
 
 #include <QCoreApplication>
 
-RangeReply::RangeReply(int index, QNetworkReply *reply, const QPair<qint32, qint32> &range)
+RangeReply::RangeReply(int index, QNetworkReply *reply, const QPair<qint32, qint32> &range, qint32 blockSize,
+                       const void *traceOwner)
     : QObject() {
     m_Private = QSharedPointer<RangeReplyPrivate>(
-                    new RangeReplyPrivate(index, reply, range));
+                    new RangeReplyPrivate(index, reply, range, blockSize, traceOwner));
 
     auto ptr = m_Private.data();
     connect(ptr, &RangeReplyPrivate::restarted,
@@ -49,6 +50,16 @@ void RangeReply::retry(int timeout) {
 
 }
 
+void RangeReply::finishAt(qint32 toBlock) {
+    getMethod(m_Private.data(), "finishAt(qint32)")
+    .invoke(m_Private.data(), Qt::QueuedConnection, Q_ARG(qint32, toBlock));
+}
+
+void RangeReply::setUrl(const QUrl &url) {
+    getMethod(m_Private.data(), "setUrl(const QUrl&)")
+    .invoke(m_Private.data(), Qt::QueuedConnection, Q_ARG(QUrl, url));
+}
+
 void RangeReply::cancel() {
     getMethod(m_Private.data(), "cancel()")
     .invoke(m_Private.data(), Qt::QueuedConnection);
@@ -1,22 +1,34 @@
 #include <QDebug>
 #include "rangereply_p.hpp"
+#include "helpers_p.hpp"
+#include "tracer_p.hpp"
 
 /// The number of times a request can be retried if the error
 /// is not severe.
 #define FAIL_THRESHOLD 50
 
-RangeReplyPrivate::RangeReplyPrivate(int index, QNetworkReply *reply, const QPair<qint32, qint32> &blockRange) {
+RangeReplyPrivate::RangeReplyPrivate(int index, QNetworkReply *reply, const QPair<qint32, qint32> &blockRange, qint32 blockSize,
+                                     const void *traceOwner) {
+    /// Our events go to the trace of whoever asked for the range.
+    if(traceOwner) {
+        Tracer::attach(this, traceOwner);
+    }
     n_Index = index;
     n_BytesRecieved = 0;
     n_FromBlock = blockRange.first;
     n_ToBlock = blockRange.second;
+    n_BlockSize = blockSize;
     n_Fails = 0;
     m_Request = reply->request();
     m_Manager = reply->manager();
     b_FullDownload = (!n_FromBlock && !n_ToBlock); // Careful on this logic expression
     m_Reply.reset(reply);
     if(!b_FullDownload) {
-        m_Data.reset(new QByteArray);
+        /// Sized for the entire range so it is never reallocated, the
+        //  writer keeps ranges small enough for a single buffer. The end
+        //  of the Range header is inclusive, so the server sends one byte
+        //  more than the blocks, which the writer ignores.
+        m_Data.reset(BufferPool::acquire((n_ToBlock - n_FromBlock) * n_BlockSize + 1));
     }
     m_Timer.setSingleShot(true);
 
@@ -32,9 +44,18 @@ RangeReplyPrivate::RangeReplyPrivate(int index, QNetworkReply *reply, const QPai
     //// Connect timer for retry action
     connect(&m_Timer, SIGNAL(timeout()),
             this, SLOT(restart()));
+
+    if(Tracer::isEnabled()) {
+        Tracer::asyncBegin("RangeReply", this, b_FullDownload ? QString::fromUtf8("full") :
+                           QString::fromUtf8("blocks %1-%2").arg(n_FromBlock).arg(n_ToBlock));
+        connect(reply, SIGNAL(metaDataChanged()),
+                this, SLOT(handleMetaData()));
+    }
 }
 
 RangeReplyPrivate::~RangeReplyPrivate() {
+    Tracer::asyncEnd("RangeReply", this);
+    Tracer::detach(this);
     if(b_Halted) {
         return;
     } else if(b_Retrying) {
@@ -89,6 +110,7 @@ void RangeReplyPrivate::cancel() {
         m_Timer.stop();
         resetInternalFlags();
         b_Canceled = true;
+        Tracer::asyncStep("canceled", this);
         emit canceled(n_Index);
         return;
     }
@@ -105,6 +127,7 @@ void RangeReplyPrivate::cancel() {
 	    m_Reply->abort();
 	    resetInternalFlags();
 	    b_Canceled = true;
+	    Tracer::asyncStep("canceled", this);
 	    emit canceled(n_Index);
 	    return;
     }
@@ -113,9 +136,58 @@ void RangeReplyPrivate::cancel() {
     m_Reply->abort();
 }
 
+/// Shrinks the range to end at the given block, this is used when
+//  another reply already got the rest of the range. Finishes right
+//  away if we already have the data.
+void RangeReplyPrivate::finishAt(qint32 toBlock) {
+    if(b_FullDownload ||
+            b_Halted ||
+            b_Finished ||
+            b_Canceled ||
+            b_CancelRequested) {
+        return;
+    }
+
+    if(toBlock < n_FromBlock || toBlock >= n_ToBlock) {
+        return;
+    }
+
+    n_ToBlock = toBlock;
+    b_FinishEarly = true;
+    tryFinishEarly();
+}
+
+/// Moves the reply to another mirror, takes effect on the next retry.
+void RangeReplyPrivate::setUrl(const QUrl &url) {
+    if(b_Running || b_Halted) {
+        return;
+    }
+    m_Request.setUrl(url);
+}
+
 /// Private Slots
 //=================================
 
+void RangeReplyPrivate::tryFinishEarly() {
+    qint64 needed = static_cast<qint64>(n_ToBlock - n_FromBlock) * n_BlockSize;
+    if(m_Data.isNull() || m_Data->size() < needed) {
+        return;
+    }
+
+    if(b_Retrying) {
+        m_Timer.stop();
+    } else if(!m_Reply.isNull()) {
+        m_Reply->disconnect();
+        m_Reply->abort();
+    }
+
+    m_Data->truncate(static_cast<int>(needed));
+    resetInternalFlags();
+    b_Finished = true;
+    Tracer::asyncStep("finished", this);
+    emit finished(n_FromBlock, n_ToBlock, m_Data.take(), n_Index);
+}
+
 void RangeReplyPrivate::resetInternalFlags(bool value) {
     b_Halted = b_Running = b_Finished = b_CancelRequested = b_Retrying = value;
 }
@@ -126,8 +198,25 @@ void RangeReplyPrivate::restart() {
     }
 
     resetInternalFlags();
+    n_BytesRecieved = 0;
 
-    m_Reply.reset(m_Manager->get(m_Request));
+    /// Keep the block aligned part of the range which we already
+    //  received and only request the rest of it. The partial block
+    //  at the end is thrown away since a block is verified as a whole.
+    QNetworkRequest request = m_Request;
+    qint64 bytesDiscarded = 0;
+    if(!b_FullDownload && n_BlockSize > 0) {
+        qint64 bytesKept = (m_Data->size() / n_BlockSize) * n_BlockSize;
+        bytesDiscarded = m_Data->size() - bytesKept;
+        m_Data->truncate(bytesKept);
+
+        if(bytesKept) {
+            request.setRawHeader("Range", makeRangeHeaderValue(n_FromBlock, n_ToBlock, n_BlockSize, bytesKept));
+        }
+    }
+
+    m_Reply.reset(m_Manager->get(request));
+    Tracer::asyncStep("retried", this);
 
     auto reply = m_Reply.data();
     connect(reply, SIGNAL(downloadProgress(qint64, qint64)),
@@ -139,19 +228,26 @@ void RangeReplyPrivate::restart() {
     connect(reply, SIGNAL(error(QNetworkReply::NetworkError)),
             this, SLOT(handleError(QNetworkReply::NetworkError)),
             Qt::QueuedConnection);
+    if(Tracer::isEnabled()) {
+        connect(reply, SIGNAL(metaDataChanged()),
+                this, SLOT(handleMetaData()));
+    }
 
     b_Running = true;
-    emit restarted(n_Index);
+    emit restarted(n_Index, bytesDiscarded);
 }
 
 void RangeReplyPrivate::handleData(qint64 bytesRec, qint64 bytesTotal) {
     Q_UNUSED(bytesTotal);
 
 
-    if(b_CancelRequested || b_Canceled || b_Halted) {
+    if(b_CancelRequested || b_Canceled || b_Halted || b_Finished) {
 	    return;
     }
 
+    if(!n_BytesRecieved && bytesRec > 0) {
+        Tracer::asyncStep("first byte", this);
+    }
     qint64 actualBytesRec = bytesRec - n_BytesRecieved;
     n_BytesRecieved = bytesRec;
 
@@ -167,11 +263,14 @@ void RangeReplyPrivate::handleData(qint64 bytesRec, qint64 bytesTotal) {
 
     if(m_Reply->isOpen() && m_Reply->isReadable()) {
         if(!b_FullDownload) {
-            m_Data->append(m_Reply->readAll());
+            readIntoData();
+            if(b_FinishEarly) {
+                tryFinishEarly();
+            }
         } else {
-            QByteArray *datafrag = new QByteArray;
-            datafrag->append(m_Reply->readAll());
-            emit data(datafrag, false);
+            while(m_Reply->bytesAvailable() > 0) {
+                emit data(readFragment(), false);
+            }
         }
 
     }
@@ -179,22 +278,36 @@ void RangeReplyPrivate::handleData(qint64 bytesRec, qint64 bytesTotal) {
 
 
 void RangeReplyPrivate::handleError(QNetworkReply::NetworkError code) {
-    if(b_Halted) {
+    if(b_Halted || b_Finished) {
         return;
     }
 
     if(code == QNetworkReply::OperationCanceledError || b_CancelRequested) {
         if(!b_FullDownload) {
-            m_Data->clear();
+            m_Data->truncate(0);
         }
         m_Reply->disconnect();
 
         resetInternalFlags();
         b_Canceled = true;
 
+        Tracer::asyncStep("canceled", this);
         emit canceled(n_Index);
         return;
     }
+    /// Whatever we got before the error is still good.
+    if(!b_FullDownload && m_Reply->isOpen() && m_Reply->isReadable()) {
+        readIntoData();
+        if(b_FinishEarly) {
+            tryFinishEarly();
+            if(b_Finished) {
+                return;
+            }
+        }
+    }
+    m_Reply->disconnect();
+    Tracer::asyncStep("error", this);
+
     resetInternalFlags();
     ++n_Fails;
     bool thresholdReached = (n_Fails > FAIL_THRESHOLD);
@@ -204,35 +317,79 @@ void RangeReplyPrivate::handleError(QNetworkReply::NetworkError code) {
 }
 
 void RangeReplyPrivate::handleFinish() {
-    if(b_Halted || b_Canceled) {
+    /// A failed reply also emits finished after the error, which
+    //  must not be taken as the end of the range.
+    if(b_Halted || b_Canceled || !b_Running) {
         return;
     }
 
     if(b_CancelRequested) {
         if(!b_FullDownload) {
-            m_Data->clear();
+            m_Data->truncate(0);
         }
         resetInternalFlags();
         b_Canceled = true;
 
+        Tracer::asyncStep("canceled", this);
         emit canceled(n_Index);
         return;
     }
     resetInternalFlags();
     b_Finished = true;
+    Tracer::asyncStep("finished", this);
 
     /// Append any data that is left.
     if(!b_FullDownload) {
-        m_Data->append(m_Reply->readAll());
+        readIntoData();
+        if(b_FinishEarly) {
+            m_Data->truncate((n_ToBlock - n_FromBlock) * n_BlockSize);
+        }
     }
 
     /// Finish the range reply
     if(!b_FullDownload) {
         emit finished(n_FromBlock, n_ToBlock, m_Data.take(), n_Index);
     } else {
-        QByteArray *datafrag = new QByteArray;
-        datafrag->append(m_Reply->readAll());
+        QByteArray *datafrag = readFragment();
+        while(m_Reply->bytesAvailable() > 0) {
+            emit data(datafrag, false);
+            datafrag = readFragment();
+        }
         emit finished(n_FromBlock, n_ToBlock, datafrag, n_Index);
     }
     m_Reply->disconnect();
 }
+
+/// Only connected when tracing, the headers of the reply are in.
+void RangeReplyPrivate::handleMetaData() {
+    Tracer::asyncStep("connected", this);
+}
+
+/// Reads whatever is available straight into the range buffer, which
+//  already has room for the entire range.
+void RangeReplyPrivate::readIntoData() {
+    auto available = m_Reply->bytesAvailable();
+    if(available <= 0) {
+        return;
+    }
+
+    auto size = m_Data->size();
+    m_Data->resize(size + static_cast<int>(available));
+    auto got = m_Reply->read(m_Data->data() + size, available);
+    m_Data->resize(size + static_cast<int>(qMax(Q_INT64_C(0), got)));
+}
+
+/// Reads at most a pool buffer worth of data for a full download, the
+//  receiver gives the buffer back to the pool.
+QByteArray *RangeReplyPrivate::readFragment() {
+    auto fragment = BufferPool::acquire();
+    auto available = qMin(m_Reply->bytesAvailable(), static_cast<qint64>(BufferPool::BufferSize));
+    if(available <= 0) {
+        return fragment;
+    }
+
+    fragment->resize(static_cast<int>(available));
+    auto got = m_Reply->read(fragment->data(), available);
+    fragment->resize(static_cast<int>(qMax(Q_INT64_C(0), got)));
+    return fragment;
+}
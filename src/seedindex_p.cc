@@ -0,0 +1,387 @@
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFileInfo>
+#include <QMultiHash>
+#include <QSaveFile>
+#include <QSet>
+#include <QStandardPaths>
+
+#include <cstring>
+#include <sys/stat.h>
+#include <utime.h>
+
+#include "seedindex_p.hpp"
+#include "helpers_p.hpp"
+
+/* Layout of a cache file, followed by the weak checksums of all the blocks
+ * and then the MD4 of all the blocks. */
+struct SeedIndexHeader {
+    char magic[8];
+    qint64 size;
+    qint64 mtime; /* in ms since epoch. */
+    quint64 inode;
+    qint32 blockSize;
+    qint32 blocks;
+};
+
+/* Chunks read while building an index between two looks at the event loop. */
+#define BUILD_CHUNKS_PER_EVENT_CHECK 64
+
+/* Bytes of all the cached indexes together, the least recently used ones
+ * are removed beyond it. */
+#define CACHE_MAX_BYTES (Q_INT64_C(256) * 1024 * 1024)
+
+/* Seed blocks with the same weak checksum tried for a target block. */
+#define MATCH_MAX_CANDIDATES 16
+
+static const char SeedIndexMagic[8] = { 'Q', 'A', 'I', 'S', 'E', 'E', 'D', '2' };
+
+static qint64 cacheFileSize(qint32 blocks) {
+    return static_cast<qint64>(sizeof(SeedIndexHeader)) +
+           static_cast<qint64>(blocks) * (sizeof(rsum) + CHECKSUM_SIZE);
+}
+
+SeedIndex::SeedIndex(const QString &filePath, qint32 blockSize)
+    : s_FilePath(QFileInfo(filePath).absoluteFilePath()),
+      n_BlockSize(blockSize) { }
+
+/*
+ * Loads the index from the cache or builds it by reading the seed once,
+ * the built index is written back to the cache. Returns false if the seed
+ * cannot be read, or if the given flag is set while the index is built,
+ * which the events processed in the meantime can set.
+*/
+bool SeedIndex::load(const bool *canceled) {
+    if(loadCached()) {
+        return true;
+    }
+    if(!beginBuild()) {
+        return false;
+    }
+    if(!build(canceled)) {
+        clearIndex();
+        return false;
+    }
+    return finishBuild();
+}
+
+/* Only loads the index if it is cached, the seed is not read. */
+bool SeedIndex::loadCached() {
+    clearIndex();
+    if(n_BlockSize <= 0 || !stat()) {
+        return false;
+    }
+    if(readCache()) {
+        return true;
+    }
+    m_Cache.close();
+    return false;
+}
+
+/* Starts an index which is fed with the entire seed in order by addData(). */
+bool SeedIndex::beginBuild() {
+    clearIndex();
+    if(n_BlockSize <= 0 || !stat()) {
+        return false;
+    }
+    qint32 blocks = blockCount(n_Size, n_BlockSize);
+    m_Rsums.reserve(blocks);
+    m_Checksums.reserve(blocks * CHECKSUM_SIZE);
+    return true;
+}
+
+void SeedIndex::addData(const char *data, qint64 size) {
+    if(!data || size <= 0) {
+        return;
+    }
+    if(!m_Partial.isEmpty()) {
+        qint64 take = qMin(size, static_cast<qint64>(n_BlockSize - m_Partial.size()));
+        m_Partial.append(data, static_cast<int>(take));
+        data += take;
+        size -= take;
+        if(m_Partial.size() < n_BlockSize) {
+            return;
+        }
+        addBlock(m_Partial.constData());
+        m_Partial.clear();
+    }
+    for(; size >= n_BlockSize; data += n_BlockSize, size -= n_BlockSize) {
+        addBlock(data);
+    }
+    if(size > 0) {
+        m_Partial.append(data, static_cast<int>(size));
+    }
+}
+
+/*
+ * Ends an index fed by addData() and writes it to the cache. Returns false
+ * if it does not cover the seed or the seed changed while it was read.
+*/
+bool SeedIndex::finishBuild() {
+    /* The last block is padded with zeros just like zsyncmake does. */
+    if(!m_Partial.isEmpty()) {
+        m_Partial.append(QByteArray(n_BlockSize - m_Partial.size(), '\0'));
+        addBlock(m_Partial.constData());
+        m_Partial.clear();
+    }
+
+    qint64 size = n_Size,
+           mtime = n_MTime;
+    quint64 inode = n_Inode;
+    if(m_Rsums.size() != blockCount(n_Size, n_BlockSize) || !stat() ||
+            n_Size != size || n_MTime != mtime || n_Inode != inode) {
+        clearIndex();
+        return false;
+    }
+
+    n_Blocks = m_Rsums.size();
+    p_Rsums = m_Rsums.constData();
+    p_Checksums = reinterpret_cast<const unsigned char*>(m_Checksums.constData());
+    writeCache();
+    evictCache();
+    return true;
+}
+
+qint32 SeedIndex::blocks() const {
+    return n_Blocks;
+}
+
+const rsum *SeedIndex::rsums() const {
+    return p_Rsums;
+}
+
+/* Returns the MD4 of the given block, all CHECKSUM_SIZE bytes of it. */
+const unsigned char *SeedIndex::checksum(qint32 block) const {
+    return p_Checksums + static_cast<size_t>(block) * CHECKSUM_SIZE;
+}
+
+/*
+ * Returns the fraction of the target blocks whose weak checksum is also the
+ * weak checksum of an aligned block of the seed. The given weak checksums
+ * are already masked with the given mask, just like in the block table of
+ * the writer.
+*/
+double SeedIndex::overlap(const rsum *targetRsums, qint32 targetBlocks, unsigned short weakMask) const {
+    if(!targetRsums || targetBlocks <= 0 || !n_Blocks) {
+        return 0;
+    }
+
+    QSet<quint32> seedRsums;
+    seedRsums.reserve(n_Blocks);
+    for(qint32 i = 0; i < n_Blocks; ++i) {
+        seedRsums.insert((static_cast<quint32>(p_Rsums[i].a & weakMask) << 16) | p_Rsums[i].b);
+    }
+
+    qint32 found = 0;
+    for(qint32 id = 0; id < targetBlocks; ++id) {
+        if(seedRsums.contains((static_cast<quint32>(targetRsums[id].a) << 16) | targetRsums[id].b)) {
+            ++found;
+        }
+    }
+    return static_cast<double>(found) / targetBlocks;
+}
+
+/*
+ * Finds the seed block for every target block, NO_BLOCK if there is none.
+ * The target blocks are given just like in the block table of the writer,
+ * with strongCheckSumBytes of the MD4 per block. Since only a part of the
+ * strong checksum is known, a match must be part of a run of at least
+ * seqMatches blocks which match in sequence, unless the run reaches the end
+ * of the target.
+*/
+QVector<zs_blockid> SeedIndex::matchBlocks(const rsum *targetRsums, const unsigned char *targetChecksums,
+        qint32 targetBlocks, qint32 strongCheckSumBytes,
+        unsigned short weakMask, qint32 seqMatches) const {
+    QVector<zs_blockid> matches(qMax(0, targetBlocks), NO_BLOCK);
+    if(!targetRsums || !targetChecksums || targetBlocks <= 0 || !n_Blocks) {
+        return matches;
+    }
+
+    QMultiHash<quint32, zs_blockid> seedBlocks;
+    seedBlocks.reserve(n_Blocks);
+    for(zs_blockid i = 0; i < n_Blocks; ++i) {
+        seedBlocks.insert((static_cast<quint32>(p_Rsums[i].a & weakMask) << 16) | p_Rsums[i].b, i);
+    }
+
+    zs_blockid id = 0;
+    while(id < targetBlocks) {
+        quint32 key = (static_cast<quint32>(targetRsums[id].a) << 16) | targetRsums[id].b;
+
+        /* The longest run of blocks starting at one of the candidates. */
+        zs_blockid runFrom = NO_BLOCK;
+        qint32 runLength = 0,
+               candidates = 0;
+        for(auto iter = seedBlocks.constFind(key);
+                iter != seedBlocks.constEnd() && iter.key() == key && candidates < MATCH_MAX_CANDIDATES;
+                ++iter, ++candidates) {
+            qint32 length = 0;
+            while(id + length < targetBlocks && iter.value() + length < n_Blocks) {
+                zs_blockid seedBlock = iter.value() + length,
+                           targetBlock = id + length;
+                if((p_Rsums[seedBlock].a & weakMask) != targetRsums[targetBlock].a ||
+                        p_Rsums[seedBlock].b != targetRsums[targetBlock].b ||
+                        memcmp(checksum(seedBlock),
+                               targetChecksums + static_cast<size_t>(targetBlock) * strongCheckSumBytes,
+                               strongCheckSumBytes)) {
+                    break;
+                }
+                ++length;
+            }
+            if(length > runLength) {
+                runFrom = iter.value();
+                runLength = length;
+            }
+        }
+
+        if(runLength >= seqMatches || (runLength > 0 && id + runLength == targetBlocks)) {
+            for(qint32 i = 0; i < runLength; ++i) {
+                matches[id + i] = runFrom + i;
+            }
+            id += runLength;
+        } else {
+            ++id;
+        }
+    }
+    return matches;
+}
+
+QString SeedIndex::cacheDirectory() {
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + "/QAppImageUpdate/seeds";
+}
+
+/* Removes the indexes used least recently until the cache fits its limit,
+ * a cache file is touched whenever it is loaded. */
+void SeedIndex::evictCache() {
+    auto files = QDir(cacheDirectory()).entryInfoList(QStringList() << "*.idx",
+                 QDir::Files, QDir::Time);
+    qint64 total = 0;
+    for(auto iter = files.constBegin(),
+            end = files.constEnd();
+            iter != end;
+            ++iter) {
+        total += (*iter).size();
+        if(total > CACHE_MAX_BYTES) {
+            QFile::remove((*iter).absoluteFilePath());
+        }
+    }
+}
+
+/* Gets what identifies the current contents of the seed. */
+bool SeedIndex::stat() {
+    struct stat info;
+    if(::stat(QFile::encodeName(s_FilePath).constData(), &info) != 0 || !S_ISREG(info.st_mode)) {
+        return false;
+    }
+    n_Size = static_cast<qint64>(info.st_size);
+    n_MTime = static_cast<qint64>(info.st_mtim.tv_sec) * 1000 + info.st_mtim.tv_nsec / 1000000;
+    n_Inode = static_cast<quint64>(info.st_ino);
+    return true;
+}
+
+/* Maps the cache file, the mapping lives as long as this index. */
+bool SeedIndex::readCache() {
+    m_Cache.setFileName(cacheFilePath());
+    if(!m_Cache.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    qint32 blocks = blockCount(n_Size, n_BlockSize);
+    if(m_Cache.size() != cacheFileSize(blocks)) {
+        return false;
+    }
+
+    auto mapped = m_Cache.map(0, m_Cache.size());
+    if(!mapped) {
+        return false;
+    }
+
+    SeedIndexHeader header;
+    memcpy(&header, mapped, sizeof(header));
+    if(memcmp(header.magic, SeedIndexMagic, sizeof(SeedIndexMagic)) ||
+            header.size != n_Size ||
+            header.mtime != n_MTime ||
+            header.inode != n_Inode ||
+            header.blockSize != n_BlockSize ||
+            header.blocks != blocks) {
+        return false;
+    }
+
+    n_Blocks = blocks;
+    p_Rsums = reinterpret_cast<const rsum*>(mapped + sizeof(header));
+    p_Checksums = mapped + sizeof(header) + static_cast<size_t>(blocks) * sizeof(rsum);
+
+    /* Keeps it from being evicted first. */
+    ::utime(QFile::encodeName(m_Cache.fileName()).constData(), nullptr);
+    return true;
+}
+
+/* Reads the seed and feeds it to the index being built. */
+bool SeedIndex::build(const bool *canceled) {
+    QFile seed(s_FilePath);
+    if(!seed.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    qint32 chunk = n_BlockSize * 16;
+    QByteArray buffer(chunk, '\0');
+    qint64 got = 0;
+    qint32 chunks = 0;
+    while((got = seed.read(buffer.data(), chunk)) > 0) {
+        if(canceled && ++chunks % BUILD_CHUNKS_PER_EVENT_CHECK == 0) {
+            QCoreApplication::processEvents();
+            if(*canceled) {
+                return false;
+            }
+        }
+        addData(buffer.constData(), got);
+    }
+    return got == 0;
+}
+
+/* The signatures of one whole block. */
+void SeedIndex::addBlock(const char *block) {
+    m_Rsums.append(calc_rsum_block(reinterpret_cast<const unsigned char*>(block), n_BlockSize));
+    m_Checksums.append(QCryptographicHash::hash(QByteArray::fromRawData(block, n_BlockSize),
+                       QCryptographicHash::Md4));
+}
+
+void SeedIndex::clearIndex() {
+    m_Cache.close();
+    m_Rsums.clear();
+    m_Checksums.clear();
+    m_Partial.clear();
+    p_Rsums = nullptr;
+    p_Checksums = nullptr;
+    n_Blocks = 0;
+}
+
+/* A failure to write the cache is not an error, it is built again next time. */
+void SeedIndex::writeCache() const {
+    if(!QDir().mkpath(cacheDirectory())) {
+        return;
+    }
+
+    SeedIndexHeader header;
+    memcpy(header.magic, SeedIndexMagic, sizeof(SeedIndexMagic));
+    header.size = n_Size;
+    header.mtime = n_MTime;
+    header.inode = n_Inode;
+    header.blockSize = n_BlockSize;
+    header.blocks = n_Blocks;
+
+    QSaveFile cache(cacheFilePath());
+    if(!cache.open(QIODevice::WriteOnly)) {
+        return;
+    }
+    cache.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    cache.write(reinterpret_cast<const char*>(p_Rsums), static_cast<qint64>(n_Blocks) * sizeof(rsum));
+    cache.write(reinterpret_cast<const char*>(p_Checksums), static_cast<qint64>(n_Blocks) * CHECKSUM_SIZE);
+    cache.commit();
+}
+
+/* One cache file per seed and block size. */
+QString SeedIndex::cacheFilePath() const {
+    auto key = QCryptographicHash::hash(s_FilePath.toUtf8(), QCryptographicHash::Sha1).toHex();
+    return cacheDirectory() + "/" + QString::fromLatin1(key) + "-" + QString::number(n_BlockSize) + ".idx";
+}
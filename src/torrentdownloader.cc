@@ -5,7 +5,9 @@
 
 TorrentDownloader::TorrentDownloader(QNetworkAccessManager *manager, QObject *parent)
     : QObject(parent) {
-    m_Private = QSharedPointer<TorrentDownloaderPrivate>(new TorrentDownloaderPrivate(manager));
+    qRegisterMetaType<QVector<qint64>>("QVector<qint64>");
+    m_Private = QSharedPointer<TorrentDownloaderPrivate>(new TorrentDownloaderPrivate(manager), deleteInThread);
+    moveToThreadOf(m_Private.data(), manager);
     auto obj = m_Private.data();
 
     connect(obj, &TorrentDownloaderPrivate::started,
@@ -72,6 +74,14 @@ void TorrentDownloader::setTargetFileUrl(const QUrl &url) {
 
 }
 
+void TorrentDownloader::setKnownRanges(const QVector<qint64> &ranges) {
+    getMethod(m_Private.data(), "setKnownRanges(const QVector<qint64>&)")
+    .invoke(m_Private.data(),
+            Qt::QueuedConnection,
+            Q_ARG(QVector<qint64>,ranges));
+
+}
+
 void TorrentDownloader::setTargetFile(QTemporaryFile *file) {
     getMethod(m_Private.data(), "setTargetFile(QTemporaryFile*)")
     .invoke(m_Private.data(),
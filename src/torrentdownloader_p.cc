@@ -1,14 +1,67 @@
 #ifdef DECENTRALIZED_UPDATE_ENABLED
+#include <QCryptographicHash>
+#include <QFile>
 #include <QFileInfo>
 #include <QDebug>
 #include <QThread>
 #include <QCoreApplication>
 #include <QNetworkProxy>
+#include <QRunnable>
 #include <vector>
 #include <iostream>
 
 #include "torrentdownloader_p.hpp"
 
+/// Hashes the pieces which are entirely inside the known byte ranges and
+/// keeps the ones which match the hash of the torrent, then tells the
+/// downloader. Reads the target file through a handle of its own.
+class PieceVerifier : public QRunnable {
+  public:
+    PieceVerifier(QObject *downloader, QSharedPointer<PieceVerification> verification)
+        : m_Downloader(downloader),
+          m_Verification(verification) { }
+
+    void run() {
+        auto v = m_Verification.data();
+        QFile file(v->fileName);
+        if(file.open(QIODevice::ReadOnly)) {
+            const lt::torrent_info &ti = *v->info;
+            int range = 0;
+            for(int i = 0; i < ti.num_pieces() && !v->canceled.load(); ++i) {
+                lt::piece_index_t piece(i);
+                qint64 from = static_cast<qint64>(i) * ti.piece_length(),
+                       to = from + ti.piece_size(piece);
+
+                while(range < v->ranges.size() && v->ranges.at(range + 1) <= from) {
+                    range += 2;
+                }
+                if(range >= v->ranges.size() ||
+                   v->ranges.at(range) > from ||
+                   v->ranges.at(range + 1) < to) {
+                    continue;
+                }
+
+                if(!file.seek(from)) {
+                    continue;
+                }
+                auto data = file.read(to - from);
+                auto hash = ti.hash_for_piece(piece);
+                if(data.size() != to - from ||
+                   QCryptographicHash::hash(data, QCryptographicHash::Sha1) !=
+                   QByteArray(hash.data(), static_cast<int>(hash.size()))) {
+                    continue;
+                }
+                v->known.append(i);
+            }
+        }
+
+        QMetaObject::invokeMethod(m_Downloader, "handlePiecesVerified", Qt::QueuedConnection);
+    }
+  private:
+    QObject *m_Downloader;
+    QSharedPointer<PieceVerification> m_Verification;
+};
+
 TorrentDownloaderPrivate::TorrentDownloaderPrivate(QNetworkAccessManager *manager)
     : QObject() {
     n_TargetFileLength = n_TargetFileDone = 0;
@@ -44,9 +97,12 @@ TorrentDownloaderPrivate::TorrentDownloaderPrivate(QNetworkAccessManager *manage
     }
 
     m_Manager = manager;
+    m_VerifyPool.setMaxThreadCount(1);
     m_Session.reset(new lt::session(p));
     m_TorrentMeta.reset(new QByteArray);
 
+    m_TimeoutTimer.setParent(this); // moves along with us.
+    m_Timer.setParent(this);
     m_TimeoutTimer.setSingleShot(true);
     m_TimeoutTimer.setInterval(100 * 1000); // 100 seconds
 
@@ -54,14 +110,21 @@ TorrentDownloaderPrivate::TorrentDownloaderPrivate(QNetworkAccessManager *manage
             this, &TorrentDownloaderPrivate::handleTimeout,
             Qt::QueuedConnection);
 
+    /// The status only comes as an alert, so this does not wake us up
+    /// unless the torrent changed.
     m_Timer.setSingleShot(false);
-    m_Timer.setInterval(100); // 1ms?
+    m_Timer.setInterval(500);
     connect(&m_Timer, &QTimer::timeout,
-            this, &TorrentDownloaderPrivate::torrentLoop,
+            this, &TorrentDownloaderPrivate::postTorrentUpdates,
             Qt::QueuedConnection);
 }
 TorrentDownloaderPrivate::~TorrentDownloaderPrivate() {
-
+    if(!m_Verification.isNull()) {
+        m_Verification->canceled.store(1);
+    }
+    m_VerifyPool.waitForDone();
+    /// The session is destroyed after us and could still post alerts.
+    m_Session->set_alert_notify(std::function<void()>());
 }
 
 void TorrentDownloaderPrivate::setTargetFileDone(qint64 done) {
@@ -103,6 +166,13 @@ void TorrentDownloaderPrivate::setTargetFileUrl(const QUrl &url) {
 
 }
 
+void TorrentDownloaderPrivate::setKnownRanges(const QVector<qint64> &ranges) {
+    if(b_Running) {
+        return;
+    }
+    m_KnownRanges = ranges;
+}
+
 void TorrentDownloaderPrivate::start() {
     if(b_Running) {
         return;
@@ -132,6 +202,18 @@ void TorrentDownloaderPrivate::cancel() {
         return;
     }
     b_CancelRequested = true;
+
+    /// The known pieces are still being hashed, they are not needed anymore.
+    if(!m_Verification.isNull()) {
+        m_Verification->canceled.store(1);
+        return;
+    }
+
+    /// Nothing else would wake up the alert handler while the torrent
+    /// is idle.
+    if(m_Handle.is_valid()) {
+        QMetaObject::invokeMethod(this, "handleAlerts", Qt::QueuedConnection);
+    }
 }
 
 void TorrentDownloaderPrivate::handleTorrentFileError(QNetworkReply::NetworkError code) {
@@ -180,10 +262,6 @@ void TorrentDownloaderPrivate::handleTorrentFileFinish() {
         return;
     }
 
-    lt::add_torrent_params params;
-    QString savePath = QFileInfo(m_File->fileName()).path() + "/";
-
-    params.save_path = savePath.toStdString();
     auto ti = std::make_shared<lt::torrent_info>(m_TorrentMeta->constData(), (int)m_TorrentMeta->size());
 
     /// We know that MakeAppImageTorrent only packs a single file that is the
@@ -203,6 +281,63 @@ void TorrentDownloaderPrivate::handleTorrentFileFinish() {
     /// See BEP 17 and BEP 19
     ti->add_url_seed(m_TargetFileUrl.toString().toStdString());
 
+    m_TorrentInfo = ti;
+
+    /// Hashing the pieces we already have takes a while for a large target
+    /// file, so it is done in the pool and the torrent is added after.
+    if(!m_KnownRanges.isEmpty() && ti->total_size() == n_TargetFileLength) {
+        m_Verification.reset(new PieceVerification);
+        m_Verification->fileName = m_File->fileName();
+        m_Verification->ranges = m_KnownRanges;
+        m_Verification->info = ti;
+        m_VerifyPool.start(new PieceVerifier(this, m_Verification));
+        return;
+    }
+    addTorrent(QVector<int>());
+}
+
+void TorrentDownloaderPrivate::handlePiecesVerified() {
+    if(m_Verification.isNull()) {
+        return;
+    }
+    auto verification = m_Verification;
+    m_Verification.reset();
+
+    if(b_CancelRequested) {
+        m_TorrentInfo.reset();
+        m_File->setAutoRemove(true);
+        m_File->open();
+        b_CancelRequested = false;
+        b_Running = b_Finished = false;
+        emit canceled();
+        return;
+    }
+    addTorrent(verification->known);
+}
+
+/// The known pieces are marked as had and are not downloaded again.
+void TorrentDownloaderPrivate::addTorrent(const QVector<int> &known) {
+    auto ti = m_TorrentInfo;
+    m_TorrentInfo.reset();
+
+    lt::add_torrent_params params;
+    QString savePath = QFileInfo(m_File->fileName()).path() + "/";
+    params.save_path = savePath.toStdString();
+
+    if(!known.isEmpty()) {
+        params.have_pieces.resize(ti->num_pieces(), false);
+        params.piece_priorities.assign(ti->num_pieces(), lt::default_priority);
+        for(auto iter = known.constBegin(),
+                end = known.constEnd();
+                iter != end;
+                ++iter) {
+            params.have_pieces.set_bit(lt::piece_index_t(*iter));
+            params.piece_priorities[static_cast<std::size_t>(*iter)] = lt::dont_download;
+        }
+        emit logger(QString::fromUtf8(" addTorrent: %1 of %2 pieces are already known.")
+                    .arg(known.size()).arg(ti->num_pieces()));
+    }
+
     params.ti = ti;
     m_Handle = m_Session->add_torrent(params);
     if(!m_Handle.is_valid()) {
@@ -210,70 +345,84 @@ void TorrentDownloaderPrivate::handleTorrentFileFinish() {
         return;
     }
 
-    m_Timer.setSingleShot(false);
-    m_Timer.setInterval(100);
+    /// Called from a libtorrent thread whenever the alert queue was empty
+    /// and an alert is posted, the alerts are handled in our thread.
+    m_Session->set_alert_notify(std::bind(&TorrentDownloaderPrivate::notifyAlerts, this));
+
     m_Timer.start();
     m_TimeoutTimer.start();
     return;
 }
 
 void TorrentDownloaderPrivate::handleTimeout() {
-    m_TimeoutTimer.stop();
-
     emit logger(QString::fromStdString(" handleTimeout: Torrent Downloader Timeout, falling back to range downloader."));
-    m_File->setAutoRemove(true);
-    m_File->open();
-    m_Session->abort();
-    b_Running = false;
-    b_Finished = false;
+    stopSession();
     emit error(QNetworkReply::ProtocolFailure);
 }
 
-void TorrentDownloaderPrivate::torrentLoop() {
-    if(!b_Running) {
+void TorrentDownloaderPrivate::postTorrentUpdates() {
+    if(!b_Running || !m_Handle.is_valid()) {
+        return;
+    }
+    m_Session->post_torrent_updates();
+}
+
+void TorrentDownloaderPrivate::handleAlerts() {
+    if(!b_Running || !m_Handle.is_valid()) {
         /// To avoid queued calls from being called
         return;
     }
     if(b_CancelRequested) {
-        m_TimeoutTimer.stop();
-        m_Timer.stop();
-        {
-	// The destruction of session proxy 
-	// assures that all call writes and everything
-	// is finished. This is sync.
-	auto sess_proxy = m_Session->abort();
-	}  
-	m_File->setAutoRemove(true);
-        m_File->open();
+        stopSession();
         b_CancelRequested = false;
-        b_Running = b_Finished = false;
         emit canceled();
         return;
     }
-    auto status = m_Handle.status();
 
+    std::vector<lt::alert*> alerts;
+    m_Session->pop_alerts(&alerts);
+    for (lt::alert const* a : alerts) {
+        if (lt::alert_cast<lt::torrent_error_alert>(a)) {
+            emit logger(QString::fromStdString(a->message()));
+            stopSession();
+            emit error(QNetworkReply::ProtocolFailure);
+            return;
+        }
+
+        if (lt::alert_cast<lt::torrent_finished_alert>(a)) {
+            handleStatus(m_Handle.status());
+            return;
+        }
+
+        auto update = lt::alert_cast<lt::state_update_alert>(a);
+        if (!update) {
+            continue;
+        }
+        for (auto const &status : update->status) {
+            if (status.handle != m_Handle) {
+                continue;
+            }
+            handleStatus(status);
+            if (!b_Running) {
+                return;
+            }
+        }
+    }
+}
+
+void TorrentDownloaderPrivate::handleStatus(const lt::torrent_status &status) {
     emit torrentStatus(status.num_seeds, status.num_peers);
-    if(status.state == lt::torrent_status::seeding) {
+    if(status.state == lt::torrent_status::seeding ||
+       status.state == lt::torrent_status::finished) {
         emit progress((int)(status.progress * 100),
                       (qint64)(status.total_done),
                       n_TargetFileLength,
                       (double)(status.download_payload_rate/1024),
                       QString::fromUtf8(" KB/s "));
-        m_Timer.stop();
-        m_TimeoutTimer.stop();
-        {
-	// The destruction of session proxy 
-	// assures that all call writes and everything
-	// is finished. This is sync.
-	auto sess_proxy = m_Session->abort();
-	}  
-	m_File->setAutoRemove(true);
-        m_File->open();
-        b_Running = false;
+        stopSession();
         b_Finished = true;
         emit finished();
         return;
-
     }
 
     if(status.state == lt::torrent_status::downloading) {
@@ -285,29 +434,27 @@ void TorrentDownloaderPrivate::torrentLoop() {
                       (double)(status.download_payload_rate/1024),
                       QString::fromUtf8(" KB/s "));
     }
+}
 
-    std::vector<lt::alert*> alerts;
-    m_Session->pop_alerts(&alerts);
-    for (lt::alert const* a : alerts) {
-        if (lt::alert_cast<lt::torrent_error_alert>(a)) {
-            emit logger(QString::fromStdString(a->message()));
-            m_Timer.stop();
-            m_TimeoutTimer.stop();
-	    {
-		// The destruction of session proxy 
-		// assures that all call writes and everything
-		// is finished. This is sync.
-	    	auto sess_proxy = m_Session->abort();
-	    }
-       	    m_File->setAutoRemove(true);
-            m_File->open();	
-            b_Running = false;
-            b_Finished = false;
-            emit error(QNetworkReply::ProtocolFailure);
-            return;
-        }
-        QCoreApplication::processEvents();
+void TorrentDownloaderPrivate::stopSession() {
+    m_Timer.stop();
+    m_TimeoutTimer.stop();
+    m_Session->set_alert_notify(std::function<void()>());
+    {
+        // The destruction of session proxy
+        // assures that all call writes and everything
+        // is finished. This is sync.
+        auto sess_proxy = m_Session->abort();
     }
+    m_Handle = lt::torrent_handle();
+    m_File->setAutoRemove(true);
+    m_File->open();
+    b_Running = b_Finished = false;
+}
+
+/// Must not touch the session, it is called with the alert queue locked.
+void TorrentDownloaderPrivate::notifyAlerts(TorrentDownloaderPrivate *obj) {
+    QMetaObject::invokeMethod(obj, "handleAlerts", Qt::QueuedConnection);
 }
 
 #endif // DECENTRALIZED_UPDATE_ENABLED
@@ -0,0 +1,162 @@
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QScopedPointer>
+#include <QThread>
+#include <QVector>
+
+#include "tracer_p.hpp"
+
+/*
+ * Events kept by a single session, anything beyond this is counted but
+ * dropped so a trace which is never finished cannot grow without bound.
+*/
+#define MAX_TRACE_EVENTS (1 << 20)
+
+struct TraceEvent {
+    char phase;
+    const char *name;
+    quintptr id,
+             thread;
+    qint64 timestamp; /* microseconds since the session started. */
+    QString detail;
+};
+
+struct TraceSession {
+    QElapsedTimer clock;
+    QVector<TraceEvent> events;
+    qint64 dropped = 0;
+};
+
+static QMutex g_TraceMutex;
+static QHash<const void*, TraceSession*> g_TraceSessions;
+static QHash<const void*, const void*> g_TraceOwners; /* object -> the object it is attached to. */
+
+QAtomicInt Tracer::s_Enabled;
+
+/* The session the events of the given owner go to, if any. */
+static TraceSession *sessionOf(const void *owner) {
+    while(owner) {
+        auto session = g_TraceSessions.value(owner, nullptr);
+        if(session) {
+            return session;
+        }
+        owner = g_TraceOwners.value(owner, nullptr);
+    }
+    return nullptr;
+}
+
+/*
+ * Starts recording the events of the given session and the objects
+ * attached to it. Starting a session which is in progress starts it
+ * over.
+*/
+void Tracer::start(const void *session) {
+    QMutexLocker locker(&g_TraceMutex);
+    auto trace = g_TraceSessions.value(session, nullptr);
+    if(!trace) {
+        trace = new TraceSession;
+        g_TraceSessions.insert(session, trace);
+        s_Enabled.storeRelease(g_TraceSessions.size());
+    }
+    trace->events.clear();
+    trace->dropped = 0;
+    trace->clock.start();
+}
+
+/* Ends the session without writing its events. */
+void Tracer::abandon(const void *session) {
+    QMutexLocker locker(&g_TraceMutex);
+    delete g_TraceSessions.take(session);
+    s_Enabled.storeRelease(g_TraceSessions.size());
+}
+
+/*
+ * Events recorded by the object belong to the session of the owner from
+ * now on. Objects must be detached before they are destroyed since their
+ * address may be taken by another one.
+*/
+void Tracer::attach(const void *object, const void *owner) {
+    QMutexLocker locker(&g_TraceMutex);
+    g_TraceOwners.insert(object, owner);
+}
+
+void Tracer::detach(const void *object) {
+    QMutexLocker locker(&g_TraceMutex);
+    g_TraceOwners.remove(object);
+}
+
+void Tracer::record(const void *owner, char phase, const char *name, const void *id, const QString &detail) {
+    TraceEvent event;
+    event.phase = phase;
+    event.name = name;
+    event.id = reinterpret_cast<quintptr>(id);
+    event.thread = reinterpret_cast<quintptr>(QThread::currentThreadId());
+    event.detail = detail;
+
+    QMutexLocker locker(&g_TraceMutex);
+    auto session = sessionOf(owner);
+    if(!session) {
+        return;
+    }
+    if(session->events.size() >= MAX_TRACE_EVENTS) {
+        ++(session->dropped);
+        return;
+    }
+    event.timestamp = session->clock.nsecsElapsed() / 1000;
+    session->events.append(event);
+}
+
+/* Writes the events recorded by the session to the given file and ends it. */
+bool Tracer::finish(const void *session, const QString &path) {
+    QMutexLocker locker(&g_TraceMutex);
+    QScopedPointer<TraceSession> trace(g_TraceSessions.take(session));
+    s_Enabled.storeRelease(g_TraceSessions.size());
+    locker.unlock();
+    if(!trace) {
+        return false;
+    }
+
+    QJsonArray events;
+    qint64 pid = QCoreApplication::applicationPid();
+    for(auto iter = trace->events.constBegin(),
+            end = trace->events.constEnd();
+            iter != end;
+            ++iter) {
+        QJsonObject event {
+            {"name", QString::fromUtf8((*iter).name) },
+            {"cat", QString::fromUtf8("QAppImageUpdate") },
+            {"ph", QString(QChar::fromLatin1((*iter).phase)) },
+            {"ts", (*iter).timestamp },
+            {"pid", pid },
+            {"tid", static_cast<qint64>((*iter).thread) }
+        };
+        if((*iter).id) {
+            event["id"] = QString::fromUtf8("0x") + QString::number((*iter).id, 16);
+        }
+        if(!(*iter).detail.isEmpty()) {
+            event["args"] = QJsonObject { {"detail", (*iter).detail } };
+        }
+        events.append(event);
+    }
+
+    QJsonObject result {
+        {"traceEvents", events },
+        {"displayTimeUnit", QString::fromUtf8("ms") }
+    };
+    if(trace->dropped) {
+        result["otherData"] = QJsonObject { {"droppedEvents", trace->dropped } };
+    }
+    QSaveFile file(path);
+    if(!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    file.write(QJsonDocument(result).toJson(QJsonDocument::Compact));
+    return file.commit();
+}
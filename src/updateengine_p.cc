@@ -0,0 +1,234 @@
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QHash>
+#include <QList>
+#include <QMetaObject>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QPair>
+
+#include "updateengine_p.hpp"
+#include "helpers_p.hpp"
+
+struct Sha1Entry {
+    qint64 size;
+    QDateTime modified;
+    QString sha1;
+};
+
+static QMutex g_EngineMutex;
+/* The most I/O threads, updaters beyond that share the least busy one. */
+#define MAX_IO_THREADS 4
+
+static QThread *g_NetworkThread = nullptr;
+static QList<QThread*> g_IOThreads;
+static QHash<QThread*, int> g_IOThreadUsers; /* I/O thread => updaters in it. */
+static QNetworkAccessManager *g_NetworkAccessManager = nullptr;
+static QList<QPair<QNetworkProxy, QNetworkAccessManager*>> g_ProxyManagers;
+static int g_MaxConcurrentRequests = 0,
+           g_RequestsInFlight = 0;
+static QHash<QObject*, int> g_RequestsHeld; /* requester => slots it holds. */
+static QList<QObject*> g_Waiting; /* in the order the slots are handed out. */
+static QHash<QString, Sha1Entry> g_Sha1Cache;
+
+/* Stops the threads when the application goes away. */
+static void shutdownEngine() {
+    QMutexLocker locker(&g_EngineMutex);
+    if(g_NetworkAccessManager) {
+        deleteInThread(g_NetworkAccessManager);
+        g_NetworkAccessManager = nullptr;
+    }
+    for(auto iter = g_ProxyManagers.constBegin(),
+            end = g_ProxyManagers.constEnd();
+            iter != end;
+            ++iter) {
+        deleteInThread((*iter).second);
+    }
+    g_ProxyManagers.clear();
+    QList<QThread*> threads;
+    threads << g_NetworkThread << g_IOThreads;
+    g_NetworkThread = nullptr;
+    g_IOThreads.clear();
+    g_IOThreadUsers.clear();
+    locker.unlock();
+
+    for(auto iter = threads.constBegin(),
+            end = threads.constEnd();
+            iter != end;
+            ++iter) {
+        if(*iter) {
+            (*iter)->quit();
+            (*iter)->wait();
+            delete *iter;
+        }
+    }
+}
+
+/* Needs the engine mutex. */
+static void startEngine() {
+    if(g_NetworkThread) {
+        return;
+    }
+    g_NetworkThread = new QThread;
+    g_NetworkThread->setObjectName("QAppImageUpdateNetwork");
+    g_NetworkThread->start();
+
+    g_NetworkAccessManager = new QNetworkAccessManager;
+    g_NetworkAccessManager->moveToThread(g_NetworkThread);
+    qAddPostRoutine(shutdownEngine);
+}
+
+QThread *UpdateEngine::networkThread() {
+    QMutexLocker locker(&g_EngineMutex);
+    startEngine();
+    return g_NetworkThread;
+}
+
+QThread *UpdateEngine::acquireIOThread() {
+    QMutexLocker locker(&g_EngineMutex);
+    startEngine();
+
+    QThread *least = nullptr;
+    for(auto iter = g_IOThreads.constBegin(),
+            end = g_IOThreads.constEnd();
+            iter != end;
+            ++iter) {
+        if(!least || g_IOThreadUsers.value(*iter) < g_IOThreadUsers.value(least)) {
+            least = *iter;
+        }
+    }
+
+    if(!least || (g_IOThreadUsers.value(least) > 0 && g_IOThreads.size() < MAX_IO_THREADS)) {
+        least = new QThread;
+        least->setObjectName(QString::fromUtf8("QAppImageUpdateIO%1").arg(g_IOThreads.size()));
+        least->start();
+        g_IOThreads.append(least);
+    }
+    ++g_IOThreadUsers[least];
+    return least;
+}
+
+void UpdateEngine::releaseIOThread(QThread *thread) {
+    QMutexLocker locker(&g_EngineMutex);
+    if(g_IOThreadUsers.value(thread) > 0) {
+        --g_IOThreadUsers[thread];
+    }
+}
+
+QNetworkAccessManager *UpdateEngine::networkAccessManager() {
+    QMutexLocker locker(&g_EngineMutex);
+    startEngine();
+    return g_NetworkAccessManager;
+}
+
+QNetworkAccessManager *UpdateEngine::networkAccessManager(const QNetworkProxy &proxy) {
+    QMutexLocker locker(&g_EngineMutex);
+    startEngine();
+    for(auto iter = g_ProxyManagers.constBegin(),
+            end = g_ProxyManagers.constEnd();
+            iter != end;
+            ++iter) {
+        if((*iter).first == proxy) {
+            return (*iter).second;
+        }
+    }
+
+    auto manager = new QNetworkAccessManager;
+    manager->setProxy(proxy);
+    manager->moveToThread(g_NetworkThread);
+    g_ProxyManagers.append(qMakePair(proxy, manager));
+    return manager;
+}
+
+/* Hands out free slots to the requesters in line, needs the engine mutex. */
+static void grantWaiting() {
+    while(!g_Waiting.isEmpty() &&
+            (g_MaxConcurrentRequests <= 0 || g_RequestsInFlight < g_MaxConcurrentRequests)) {
+        auto requester = g_Waiting.takeFirst();
+        ++g_RequestsInFlight;
+        ++g_RequestsHeld[requester];
+        QMetaObject::invokeMethod(requester, "handleRequestSlot", Qt::QueuedConnection);
+    }
+}
+
+void UpdateEngine::setMaxConcurrentRequests(int requests) {
+    QMutexLocker locker(&g_EngineMutex);
+    g_MaxConcurrentRequests = qMax(0, requests);
+    grantWaiting();
+}
+
+int UpdateEngine::maxConcurrentRequests() {
+    QMutexLocker locker(&g_EngineMutex);
+    return g_MaxConcurrentRequests;
+}
+
+bool UpdateEngine::acquireRequest(QObject *requester, bool wait) {
+    QMutexLocker locker(&g_EngineMutex);
+    /* Whoever waits in line goes first. */
+    if(g_Waiting.isEmpty() &&
+            (g_MaxConcurrentRequests <= 0 || g_RequestsInFlight < g_MaxConcurrentRequests)) {
+        ++g_RequestsInFlight;
+        ++g_RequestsHeld[requester];
+        return true;
+    }
+    if(wait && !g_Waiting.contains(requester)) {
+        g_Waiting.append(requester);
+    }
+    return false;
+}
+
+void UpdateEngine::releaseRequests(QObject *requester, int count) {
+    QMutexLocker locker(&g_EngineMutex);
+    auto held = g_RequestsHeld.value(requester);
+    count = qMin(count, held);
+    if(count <= 0) {
+        return;
+    }
+    if(held == count) {
+        g_RequestsHeld.remove(requester);
+    } else {
+        g_RequestsHeld[requester] = held - count;
+    }
+    g_RequestsInFlight -= count;
+    grantWaiting();
+}
+
+/* Leaves the line and gives back every slot, including the ones which
+ * were granted but not handled yet. */
+void UpdateEngine::withdraw(QObject *requester) {
+    QMutexLocker locker(&g_EngineMutex);
+    g_Waiting.removeAll(requester);
+    g_RequestsInFlight -= g_RequestsHeld.take(requester);
+    grantWaiting();
+}
+
+int UpdateEngine::requestsInFlight() {
+    QMutexLocker locker(&g_EngineMutex);
+    return g_RequestsInFlight;
+}
+
+QString UpdateEngine::cachedSha1(const QString &path) {
+    QFileInfo info(path);
+    QMutexLocker locker(&g_EngineMutex);
+    auto iter = g_Sha1Cache.constFind(info.absoluteFilePath());
+    if(iter == g_Sha1Cache.constEnd() ||
+            (*iter).size != info.size() ||
+            (*iter).modified != info.lastModified()) {
+        return QString();
+    }
+    return (*iter).sha1;
+}
+
+void UpdateEngine::cacheSha1(const QString &path, const QString &sha1) {
+    QFileInfo info(path);
+    if(!info.exists()) {
+        return;
+    }
+    Sha1Entry entry;
+    entry.size = info.size();
+    entry.modified = info.lastModified();
+    entry.sha1 = sha1;
+    QMutexLocker locker(&g_EngineMutex);
+    g_Sha1Cache.insert(info.absoluteFilePath(), entry);
+}
@@ -0,0 +1,76 @@
+#include "zsynccontrolfilegenerator.hpp"
+#include "zsynccontrolfilegenerator_p.hpp"
+#include "helpers_p.hpp"
+
+ZsyncControlFileGenerator::ZsyncControlFileGenerator(QObject *parent)
+    : QObject(parent) {
+    m_Private = QSharedPointer<ZsyncControlFileGeneratorPrivate>(new ZsyncControlFileGeneratorPrivate);
+    auto obj = m_Private.data();
+
+    connect(obj, &ZsyncControlFileGeneratorPrivate::started,
+            this, &ZsyncControlFileGenerator::started,
+            Qt::DirectConnection);
+
+    connect(obj, &ZsyncControlFileGeneratorPrivate::canceled,
+            this, &ZsyncControlFileGenerator::canceled,
+            Qt::DirectConnection);
+
+    connect(obj, &ZsyncControlFileGeneratorPrivate::finished,
+            this, &ZsyncControlFileGenerator::finished,
+            Qt::DirectConnection);
+
+    connect(obj, &ZsyncControlFileGeneratorPrivate::progress,
+            this, &ZsyncControlFileGenerator::progress,
+            Qt::DirectConnection);
+
+    connect(obj, &ZsyncControlFileGeneratorPrivate::error,
+            this, &ZsyncControlFileGenerator::error,
+            Qt::DirectConnection);
+}
+
+void ZsyncControlFileGenerator::setTargetFile(const QString &path) {
+    getMethod(m_Private.data(), "setTargetFile(const QString&)")
+    .invoke(m_Private.data(),
+            Qt::QueuedConnection,
+            Q_ARG(QString,path));
+}
+
+void ZsyncControlFileGenerator::setOutputFile(const QString &path) {
+    getMethod(m_Private.data(), "setOutputFile(const QString&)")
+    .invoke(m_Private.data(),
+            Qt::QueuedConnection,
+            Q_ARG(QString,path));
+}
+
+void ZsyncControlFileGenerator::setTargetFileUrl(const QString &url) {
+    getMethod(m_Private.data(), "setTargetFileUrl(const QString&)")
+    .invoke(m_Private.data(),
+            Qt::QueuedConnection,
+            Q_ARG(QString,url));
+}
+
+void ZsyncControlFileGenerator::setBlockSize(qint32 blockSize) {
+    getMethod(m_Private.data(), "setBlockSize(qint32)")
+    .invoke(m_Private.data(),
+            Qt::QueuedConnection,
+            Q_ARG(qint32,blockSize));
+}
+
+void ZsyncControlFileGenerator::setThreads(int threads) {
+    getMethod(m_Private.data(), "setThreads(int)")
+    .invoke(m_Private.data(),
+            Qt::QueuedConnection,
+            Q_ARG(int,threads));
+}
+
+void ZsyncControlFileGenerator::start() {
+    getMethod(m_Private.data(), "start()")
+    .invoke(m_Private.data(),
+            Qt::QueuedConnection);
+}
+
+void ZsyncControlFileGenerator::cancel() {
+    getMethod(m_Private.data(), "cancel()")
+    .invoke(m_Private.data(),
+            Qt::QueuedConnection);
+}
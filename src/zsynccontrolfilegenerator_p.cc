@@ -0,0 +1,296 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2018-2019, Antony jr
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @filename    : zsynccontrolfilegenerator_p.cc
+ * @description : This is where the zsync control file of a file is written.
+ * The file is read in batches of whole blocks, the blocks of a batch are hashed
+ * in parallel while the SHA-1 of the batch is computed on the calling thread.
+*/
+#include <cstring>
+#include <QDateTime>
+#include <QLocale>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QTemporaryFile>
+#include <QtEndian>
+
+#include "zsynccontrolfilegenerator_p.hpp"
+#include "zsyncinternalstructures_p.hpp"
+#include "qappimageupdateenums.hpp"
+#include "helpers_p.hpp"
+
+/* Bytes read and hashed at once, rounded down to whole blocks. */
+#define GENERATOR_BATCH_BYTES (16 * 1024 * 1024)
+
+/*
+ * Writes the checksums of a run of blocks from a batch, that is the last
+ * weak checksum bytes of the rsum in network byte order followed by the
+ * first strong checksum bytes of the MD4 for every block.
+*/
+class BlockHasher : public QRunnable {
+  public:
+    BlockHasher(const char *batch, char *checksums, qint32 blockSize,
+                qint32 weakBytes, qint32 strongBytes, qint32 fromBlock, qint32 toBlock)
+        : p_Batch(batch),
+          p_CheckSums(checksums),
+          n_BlockSize(blockSize),
+          n_WeakCheckSumBytes(weakBytes),
+          n_StrongCheckSumBytes(strongBytes),
+          n_FromBlock(fromBlock),
+          n_ToBlock(toBlock) { }
+
+    void run() {
+        QCryptographicHash md4(QCryptographicHash::Md4);
+        qint64 checkSumSize = n_WeakCheckSumBytes + n_StrongCheckSumBytes;
+        for(qint32 i = n_FromBlock; i < n_ToBlock; ++i) {
+            const char *block = p_Batch + static_cast<qint64>(i) * n_BlockSize;
+            char *out = p_CheckSums + i * checkSumSize;
+
+            rsum r = calc_rsum_block(reinterpret_cast<const unsigned char*>(block), n_BlockSize);
+            uchar weak[4];
+            qToBigEndian<quint16>(r.a, weak);
+            qToBigEndian<quint16>(r.b, weak + 2);
+            memcpy(out, weak + 4 - n_WeakCheckSumBytes, n_WeakCheckSumBytes);
+
+            md4.reset();
+            md4.addData(block, n_BlockSize);
+            memcpy(out + n_WeakCheckSumBytes, md4.result().constData(), n_StrongCheckSumBytes);
+        }
+    }
+  private:
+    const char *p_Batch;
+    char *p_CheckSums;
+    qint32 n_BlockSize,
+           n_WeakCheckSumBytes,
+           n_StrongCheckSumBytes,
+           n_FromBlock,
+           n_ToBlock;
+};
+
+ZsyncControlFileGeneratorPrivate::ZsyncControlFileGeneratorPrivate(QObject *parent)
+    : QObject(parent) {
+    m_HashPool.setMaxThreadCount(QThread::idealThreadCount());
+}
+
+ZsyncControlFileGeneratorPrivate::~ZsyncControlFileGeneratorPrivate() {
+    m_HashPool.waitForDone();
+}
+
+void ZsyncControlFileGeneratorPrivate::setTargetFile(const QString &path) {
+    if(b_Started) {
+        return;
+    }
+    s_TargetFilePath = path;
+}
+
+void ZsyncControlFileGeneratorPrivate::setOutputFile(const QString &path) {
+    if(b_Started) {
+        return;
+    }
+    s_OutputFilePath = path;
+}
+
+void ZsyncControlFileGeneratorPrivate::setTargetFileUrl(const QString &url) {
+    if(b_Started) {
+        return;
+    }
+    s_TargetFileUrl = url;
+}
+
+void ZsyncControlFileGeneratorPrivate::setBlockSize(qint32 blockSize) {
+    if(b_Started) {
+        return;
+    }
+    n_BlockSize = qMax(0, blockSize);
+}
+
+void ZsyncControlFileGeneratorPrivate::setThreads(int threads) {
+    if(b_Started) {
+        return;
+    }
+    m_HashPool.setMaxThreadCount(threads > 0 ? threads : QThread::idealThreadCount());
+}
+
+void ZsyncControlFileGeneratorPrivate::start() {
+    if(b_Started) {
+        return;
+    }
+    b_Started = true;
+    b_CancelRequested = false;
+    emit started();
+
+    short errorCode = 0;
+    QFileInfo info(s_TargetFilePath);
+    QFile target(s_TargetFilePath);
+    QJsonObject result;
+    if(!info.exists() || !info.isFile()) {
+        errorCode = QAppImageUpdateEnums::Error::AppimageNotFound;
+    } else if(!info.isReadable()) {
+        errorCode = QAppImageUpdateEnums::Error::AppimageNotReadable;
+    } else if(!target.open(QIODevice::ReadOnly)) {
+        errorCode = QAppImageUpdateEnums::Error::CannotOpenAppimage;
+    } else {
+        errorCode = writeControlFile(&target, &result);
+    }
+    b_Started = false;
+
+    if(b_CancelRequested) {
+        b_CancelRequested = false;
+        emit canceled();
+    } else if(errorCode) {
+        emit error(errorCode);
+    } else {
+        emit finished(result);
+    }
+}
+
+void ZsyncControlFileGeneratorPrivate::cancel() {
+    if(!b_Started) {
+        return;
+    }
+    b_CancelRequested = true;
+}
+
+short ZsyncControlFileGeneratorPrivate::writeControlFile(QFile *target, QJsonObject *result) {
+    qint64 length = target->size();
+    qint32 blockSize = n_BlockSize ? n_BlockSize : defaultBlockSize(length),
+           seqMatches = 0,
+           weakBytes = 0,
+           strongBytes = 0;
+    zsyncHashLengths(length, blockSize, &seqMatches, &weakBytes, &strongBytes);
+
+    QString fileName = QFileInfo(target->fileName()).fileName(),
+            outputPath = s_OutputFilePath.isEmpty() ? target->fileName() + QString::fromUtf8(".zsync")
+                         : s_OutputFilePath;
+
+    /* The SHA-1 in the headers is only known once the whole file is read,
+     * so the block checksums are kept aside till then. */
+    QTemporaryFile checkSums(outputPath + QString::fromUtf8(".XXXXXX"));
+    if(!checkSums.open()) {
+        return QAppImageUpdateEnums::Error::CannotWriteControlFile;
+    }
+
+    QCryptographicHash sha1(QCryptographicHash::Sha1);
+    qint32 batchBlocks = qMax(1, GENERATOR_BATCH_BYTES / blockSize),
+           threads = qMax(1, m_HashPool.maxThreadCount());
+
+    /* Two batches, the next one is read while the pool hashes the other. */
+    QByteArray batches[2],
+               outs[2];
+    batches[0].resize(batchBlocks * blockSize);
+    batches[1].resize(batchBlocks * blockSize);
+
+    qint64 read = 0,
+           done = 0,
+           hashing = 0; /* bytes of the batch in the pool. */
+    int current = 0;
+    while(read < length || hashing) {
+        qint64 want = qMin(static_cast<qint64>(batches[current].size()), length - read);
+        char *in = batches[current].data();
+        if(want) {
+            if(target->read(in, want) != want) {
+                m_HashPool.waitForDone();
+                return QAppImageUpdateEnums::Error::IoReadError;
+            }
+            /* The last block is padded with zeros. */
+            memset(in + want, 0, static_cast<qint64>(blockCount(want, blockSize)) * blockSize - want);
+            sha1.addData(in, static_cast<int>(want));
+            read += want;
+        }
+
+        m_HashPool.waitForDone();
+        if(hashing) {
+            const QByteArray &out = outs[current ^ 1];
+            if(checkSums.write(out) != out.size()) {
+                return QAppImageUpdateEnums::Error::CannotWriteControlFile;
+            }
+            done += hashing;
+
+            emit progress(static_cast<int>(done * 100 / length));
+            QCoreApplication::processEvents();
+            if(b_CancelRequested) {
+                return 0;
+            }
+        }
+
+        hashing = want;
+        if(want) {
+            qint32 blocks = blockCount(want, blockSize),
+                   perThread = (blocks + threads - 1) / threads;
+            outs[current].resize(blocks * (weakBytes + strongBytes));
+            for(qint32 from = 0; from < blocks; from += perThread) {
+                m_HashPool.start(new BlockHasher(in, outs[current].data(), blockSize, weakBytes, strongBytes,
+                                                 from, qMin(blocks, from + perThread)));
+            }
+        }
+        current ^= 1;
+    }
+
+    QByteArray sha1Hash = sha1.result().toHex();
+    QByteArray header;
+    header += "zsync: 0.6.2\n";
+    header += "Filename: " + fileName.toUtf8() + "\n";
+    header += "MTime: " + QLocale(QLocale::English, QLocale::UnitedStates)
+              .toString(QFileInfo(*target).lastModified().toUTC(), QString::fromUtf8("ddd, dd MMM yyyy HH:mm:ss"))
+              .toUtf8() + " +0000\n";
+    header += "Blocksize: " + QByteArray::number(blockSize) + "\n";
+    header += "Length: " + QByteArray::number(length) + "\n";
+    header += "Hash-Lengths: " + QByteArray::number(seqMatches) + "," +
+              QByteArray::number(weakBytes) + "," + QByteArray::number(strongBytes) + "\n";
+    header += "URL: " + (s_TargetFileUrl.isEmpty() ? fileName : s_TargetFileUrl).toUtf8() + "\n";
+    header += "SHA-1: " + sha1Hash + "\n\n";
+
+    QSaveFile output(outputPath);
+    if(!output.open(QIODevice::WriteOnly) || output.write(header) != header.size()) {
+        return QAppImageUpdateEnums::Error::CannotWriteControlFile;
+    }
+    checkSums.seek(0);
+    while(!checkSums.atEnd()) {
+        auto chunk = checkSums.read(1024 * 1024);
+        if(chunk.isEmpty() || output.write(chunk) != chunk.size()) {
+            output.cancelWriting();
+            return QAppImageUpdateEnums::Error::CannotWriteControlFile;
+        }
+    }
+    if(!output.commit()) {
+        return QAppImageUpdateEnums::Error::CannotWriteControlFile;
+    }
+
+    (*result)["ControlFilePath"] = QFileInfo(outputPath).absoluteFilePath();
+    (*result)["TargetFilePath"] = QFileInfo(target->fileName()).absoluteFilePath();
+    (*result)["TargetFileLength"] = length;
+    (*result)["BlockSize"] = blockSize;
+    (*result)["Blocks"] = blockCount(length, blockSize);
+    (*result)["HashLengths"] = QString::fromUtf8("%1,%2,%3").arg(seqMatches).arg(weakBytes).arg(strongBytes);
+    (*result)["Sha1Hash"] = QString::fromLatin1(sha1Hash);
+    (*result)["Threads"] = threads;
+    return 0;
+}
@@ -36,10 +36,15 @@
  * This also produces information for ZsyncWriterPrivate.
 */
 #include <QFileInfo>
+#include <QMetaMethod>
+#include <QRunnable>
+#include <QVector>
 
 #include "zsyncremotecontrolfileparser_p.hpp"
 #include "qappimageupdateenums.hpp"
 #include "helpers_p.hpp"
+#include "seedindex_p.hpp"
+#include "tracer_p.hpp"
 
 
 /*
@@ -48,11 +53,18 @@
  * 	Hard coded to work only in this source file.
 */
 #ifndef LOGGING_DISABLED
-#define LOGS *(p_Logger.data()) LOGR
+/* Nothing is formatted unless someone listens to the logger signal. */
+static QMetaMethod loggerSignal() {
+    static const QMetaMethod signal = QMetaMethod::fromSignal(&ZsyncRemoteControlFileParserPrivate::logger);
+    return signal;
+}
+
+#define LOGS if(isSignalConnected(loggerSignal())) { *(p_Logger.data()) LOGR
 #define LOGR <<
 #define LOGE ; \
              emit(logger(s_LogBuffer , s_AppImagePath)); \
-             s_LogBuffer.clear();
+             s_LogBuffer.clear(); \
+             }
 #else
 #define LOGS (void)
 #define LOGR ;(void)
@@ -89,6 +101,67 @@
 
 
 
+/*
+ * Joins the block table of a control file against the seed index of the
+ * local AppImage. Building the index reads and hashes the entire AppImage,
+ * so this runs in the pool of the parser and never in the network thread,
+ * the estimate is handed back to the parser once done.
+*/
+class DeltaEstimator : public QRunnable {
+  public:
+    QObject *parser = nullptr;
+    qint64 sequence = 0;
+    QString seedFilePath;
+    QVector<rsum> rsums;
+    QByteArray checksums;
+    qint32 blocks = 0,
+           blockSize = 0,
+           strongCheckSumBytes = 0,
+           consecutiveMatchNeeded = 0;
+    qint64 targetFileLength = 0;
+    unsigned short weakMask = 0;
+    bool acceptRange = false;
+
+    void run() {
+        QVector<zs_blockid> matches(blocks, NO_BLOCK);
+        SeedIndex index(seedFilePath, blockSize);
+        if(acceptRange && index.load()) {
+            matches = index.matchBlocks(rsums.constData(), (const unsigned char*)checksums.constData(),
+                                        blocks, strongCheckSumBytes, weakMask,
+                                        consecutiveMatchNeeded);
+        }
+
+        /* What is missing is requested just like the writer does it. */
+        qint32 matched = blocks - matches.count(NO_BLOCK);
+        qint32 segments = matched ? 1 : FULL_DOWNLOAD_SEGMENTS;
+        qint64 bytes = 0;
+        qint32 requests = 0;
+        for(zs_blockid from = 0; from < blocks;) {
+            if(matches.at(from) != NO_BLOCK) {
+                ++from;
+                continue;
+            }
+            zs_blockid to = from;
+            while(to < blocks && matches.at(to) == NO_BLOCK) {
+                ++to;
+            }
+            bytes += qMin(static_cast<qint64>(to) * blockSize, targetFileLength) -
+                     static_cast<qint64>(from) * blockSize;
+            requests += acceptRange ? splitBlockRange(from, to, blockSize, segments).size() : 1;
+            from = to;
+        }
+
+        QJsonObject estimate;
+        estimate["BytesToDownload"] = static_cast<double>(bytes);
+        estimate["MatchedPercentage"] = static_cast<double>(matched) * 100.0 / blocks;
+        estimate["Requests"] = requests;
+        QMetaObject::invokeMethod(parser, "handleDeltaEstimate",
+                                  Qt::QueuedConnection,
+                                  Q_ARG(qint64, sequence),
+                                  Q_ARG(QJsonObject, estimate));
+    }
+};
+
 /*
  * ZsyncRemoteControlFileParserPrivate is the private class to handle all things
  * related to Zsync Control File. This class must be used privately.
@@ -115,11 +188,13 @@ ZsyncRemoteControlFileParserPrivate::ZsyncRemoteControlFileParserPrivate(QNetwor
     p_Logger.reset(new QDebug(&s_LogBuffer));
 #endif // LOGGING_DISABLED
     p_NManager = networkManager;
+    m_EstimatePool.setMaxThreadCount(1);
     connect(this, SIGNAL(error(short)), this, SLOT(handleErrorSignal(short)));
     return;
 }
 
 ZsyncRemoteControlFileParserPrivate::~ZsyncRemoteControlFileParserPrivate() {
+    m_EstimatePool.waitForDone();
     return;
 }
 
@@ -153,6 +228,32 @@ void ZsyncRemoteControlFileParserPrivate::setUseBittorrent(bool withBt) {
     b_WithBT = withBt;
 }
 
+/* Adds an estimate of the download size to the update check information. */
+void ZsyncRemoteControlFileParserPrivate::setEstimateDeltaSize(bool choice) {
+    b_EstimateDelta = choice;
+}
+
+/*
+ * In a dry run nothing is downloaded, so the target file is not probed and
+ * range requests are assumed. The known information is thrown away when
+ * this changes since it was fetched for the other kind of run.
+*/
+void ZsyncRemoteControlFileParserPrivate::setDryRun(bool choice) {
+    if(b_DryRun != choice) {
+        j_UpdateInformation = QJsonObject();
+    }
+    b_DryRun = choice;
+}
+
+/* Sets the network access manager the requests are made with, which must
+ * live in the thread of the parser. */
+void ZsyncRemoteControlFileParserPrivate::setNetworkAccessManager(QNetworkAccessManager *manager) {
+    if(!manager)
+        return;
+    p_NManager = manager;
+    return;
+}
+
 /* This public method safely sets the zsync control file url. */
 void ZsyncRemoteControlFileParserPrivate::setControlFileUrl(const QUrl &controlFileUrl) {
     INFO_START LOGR " setControlFileUrl : using " LOGR controlFileUrl LOGR " as zsync control file." INFO_END;
@@ -184,6 +285,7 @@ void ZsyncRemoteControlFileParserPrivate::setControlFileUrl(QJsonObject informat
     }
 
     {
+        m_FetchTimer.start();
         j_UpdateInformation = information;
         auto fileInfo = information["FileInformation"].toObject();
         s_AppImagePath = fileInfo["AppImageFilePath"].toString();
@@ -251,6 +353,8 @@ void ZsyncRemoteControlFileParserPrivate::setControlFileUrl(QJsonObject informat
 void ZsyncRemoteControlFileParserPrivate::clear(void) {
     b_AcceptRange = false;
     j_UpdateInformation = QJsonObject();
+    j_PendingCheck = QJsonObject();
+    ++n_EstimateSequence;
     s_ZsyncMakeVersion.clear();
     s_TargetFileName.clear();
     s_TargetFileSHA1.clear();
@@ -260,11 +364,14 @@ void ZsyncRemoteControlFileParserPrivate::clear(void) {
     s_LogBuffer.clear();
 #endif // LOGGING_DISABLED
     m_MTime = QDateTime();
-    n_TargetFileBlockSize = n_TargetFileLength = n_TargetFileBlocks = n_WeakCheckSumBytes = 0;
+    n_TargetFileBlockSize = n_TargetFileBlocks = n_WeakCheckSumBytes = 0;
+    n_TargetFileLength = 0;
     n_StrongCheckSumBytes = n_ConsecutiveMatchNeeded = n_CheckSumBlocksOffset = 0;
     u_TargetFileUrl.clear();
+    u_ResolvedTargetFileUrl.clear();
     u_ControlFileUrl.clear();
     u_TorrentFile.clear();
+    m_MirrorUrls.clear();
     p_ControlFile.reset(nullptr);
     return;
 }
@@ -307,10 +414,79 @@ void ZsyncRemoteControlFileParserPrivate::getUpdateCheckInformation(void) {
 	{ "TorrentFileUrl", u_TorrentFile.isValid() ? u_TorrentFile.toString() : ""}
     };
 
+    /* Only worth it when there is an update, the result is given once
+     * the estimate is done. */
+    auto localSHA1 = (j_UpdateInformation["FileInformation"].toObject())["AppImageSHA1Hash"].toString();
+    if(b_EstimateDelta && localSHA1 != s_TargetFileSHA1) {
+        j_PendingCheck = result;
+        if(startDeltaEstimate()) {
+            return;
+        }
+        j_PendingCheck = QJsonObject();
+        result["DeltaEstimate"] = QJsonObject();
+    }
+
     emit updateCheckInformation(result);
     return;
 }
 
+void ZsyncRemoteControlFileParserPrivate::handleDeltaEstimate(qint64 sequence, QJsonObject estimate) {
+    if(sequence != n_EstimateSequence || j_PendingCheck.isEmpty()) {
+        return;
+    }
+    auto result = j_PendingCheck;
+    j_PendingCheck = QJsonObject();
+    result["DeltaEstimate"] = estimate;
+    emit updateCheckInformation(result);
+}
+
+/*
+ * Estimates what an update would download by joining the block table of the
+ * control file against the seed index of the local AppImage. The index only
+ * has the aligned blocks of the AppImage, so the estimate can only be higher
+ * than what a real update downloads, never lower.
+ * Only the block table is read here, the join runs in the pool of the parser
+ * and ends in handleDeltaEstimate. Returns false if there is nothing to
+ * estimate with.
+*/
+bool ZsyncRemoteControlFileParserPrivate::startDeltaEstimate(void) {
+    qint32 entryBytes = n_WeakCheckSumBytes + n_StrongCheckSumBytes;
+    if(!p_ControlFile || !p_ControlFile->isOpen() || !n_CheckSumBlocksOffset ||
+            n_TargetFileBlocks <= 0 || n_TargetFileBlockSize <= 0 || entryBytes <= 0 ||
+            p_ControlFile->size() - n_CheckSumBlocksOffset < static_cast<qint64>(n_TargetFileBlocks) * entryBytes) {
+        return false;
+    }
+
+    /* The same block table the writer builds. */
+    auto estimator = new DeltaEstimator;
+    estimator->weakMask = n_WeakCheckSumBytes < 3 ? 0 : n_WeakCheckSumBytes == 3 ? 0xff : 0xffff;
+    estimator->rsums.resize(n_TargetFileBlocks);
+    estimator->checksums.fill('\0', n_TargetFileBlocks * n_StrongCheckSumBytes);
+    p_ControlFile->seek(n_CheckSumBlocksOffset);
+    for(zs_blockid id = 0; id < n_TargetFileBlocks; ++id) {
+        rsum r = { 0, 0 };
+        if(p_ControlFile->read(((char *)&r) + 4 - n_WeakCheckSumBytes, n_WeakCheckSumBytes) < 1 ||
+                p_ControlFile->read(estimator->checksums.data() + id * n_StrongCheckSumBytes, n_StrongCheckSumBytes) < 1) {
+            delete estimator;
+            return false;
+        }
+        estimator->rsums[id].a = qFromBigEndian(r.a) & estimator->weakMask;
+        estimator->rsums[id].b = qFromBigEndian(r.b);
+    }
+
+    estimator->parser = this;
+    estimator->sequence = n_EstimateSequence;
+    estimator->seedFilePath = (j_UpdateInformation["FileInformation"].toObject())["AppImageFilePath"].toString();
+    estimator->blocks = n_TargetFileBlocks;
+    estimator->blockSize = n_TargetFileBlockSize;
+    estimator->strongCheckSumBytes = n_StrongCheckSumBytes;
+    estimator->consecutiveMatchNeeded = n_ConsecutiveMatchNeeded;
+    estimator->targetFileLength = n_TargetFileLength;
+    estimator->acceptRange = b_AcceptRange;
+    m_EstimatePool.start(estimator);
+    return true;
+}
+
 /*
  * This signals information needed to configure ZsyncWriterPrivate
  * class which is the main implementation of the zsync algorithm.
@@ -338,7 +514,8 @@ void ZsyncRemoteControlFileParserPrivate::getZsyncInformation(void) {
     /* leave the buffer ownership to the one who called it. */
     emit zsyncInformation(n_TargetFileBlockSize, n_TargetFileBlocks, n_WeakCheckSumBytes, n_StrongCheckSumBytes,
                           n_ConsecutiveMatchNeeded, n_TargetFileLength, SeedFilePath, s_TargetFileName,
-                          s_TargetFileSHA1, u_TargetFileUrl, buffer, b_AcceptRange, u_TorrentFile);
+                          s_TargetFileSHA1, u_TargetFileUrl, buffer, b_AcceptRange, u_TorrentFile,
+                          m_MirrorUrls, u_ResolvedTargetFileUrl);
     return;
 }
 
@@ -509,6 +686,7 @@ void ZsyncRemoteControlFileParserPrivate::handleGithubAPIResponse(void) {
 
 /* This private slot parses the control file. */
 void ZsyncRemoteControlFileParserPrivate::handleControlFile(void) {
+    Tracer::Scope trace(this, "handleControlFile");
     INFO_START LOGR " handleControlFile : starting to parse zsync control file." INFO_END;
     QNetworkReply *senderReply = qobject_cast<QNetworkReply*>(QObject::sender());
     if(!senderReply)
@@ -679,9 +857,9 @@ void ZsyncRemoteControlFileParserPrivate::handleControlFile(void) {
     {
         QString nStr;
         STORE_SPLIT(nStr, ZsyncHeaderList.at(4), "Length: ", QAppImageUpdateEnums::Error::InvalidTargetFileLength);
-        n_TargetFileLength =  nStr.toInt();
+        n_TargetFileLength = nStr.toLongLong();
     }
-    if(n_TargetFileLength == 0) {
+    if(n_TargetFileLength <= 0) {
         emit error(QAppImageUpdateEnums::Error::InvalidTargetFileLength);
         return;
     }
@@ -723,11 +901,34 @@ void ZsyncRemoteControlFileParserPrivate::handleControlFile(void) {
     }
     INFO_START LOGR " handleControlFile : zsync target file url is confirmed to be " LOGR u_TargetFileUrl LOGR "." INFO_END;
 
-    STORE_SPLIT(s_TargetFileSHA1, ZsyncHeaderList.at(7), "SHA-1: ", QAppImageUpdateEnums::Error::InvalidTargetFileSha1);
+    /// A control file can list more than one url for the target file,
+    //  the rest are used as mirrors by the downloader.
+    int headerIndex = 7;
+    m_MirrorUrls.clear();
+    while(headerIndex < ZsyncHeaderList.size() &&
+            ZsyncHeaderList.at(headerIndex).startsWith("URL: ")) {
+        QUrl mirror(ZsyncHeaderList.at(headerIndex).mid(5));
+        ++headerIndex;
+        if(!mirror.isValid()) {
+            WARNING_START LOGR " handleControlFile : ignoring invalid mirror url " LOGR mirror LOGR "." WARNING_END;
+            continue;
+        }
+        if(mirror.isRelative()) {
+            mirror = u_ControlFileUrl.resolved(mirror);
+        }
+        m_MirrorUrls.append(mirror);
+        INFO_START LOGR " handleControlFile : zsync target file mirror " LOGR mirror LOGR "." INFO_END;
+    }
+    if(headerIndex >= ZsyncHeaderList.size()) {
+        emit error(QAppImageUpdateEnums::Error::InvalidZsyncHeadersNumber);
+        return;
+    }
+
+    STORE_SPLIT(s_TargetFileSHA1, ZsyncHeaderList.at(headerIndex), "SHA-1: ", QAppImageUpdateEnums::Error::InvalidTargetFileSha1);
     s_TargetFileSHA1 = s_TargetFileSHA1.toUpper();
     INFO_START LOGR " handleControlFile : zsync target file sha1 hash is confirmed to be " LOGR s_TargetFileSHA1 LOGR "." INFO_END;
 
-    n_TargetFileBlocks = (n_TargetFileLength + n_TargetFileBlockSize - 1) / n_TargetFileBlockSize;
+    n_TargetFileBlocks = blockCount(n_TargetFileLength, n_TargetFileBlockSize);
     INFO_START LOGR " handleControlFile : zsync target file has " LOGR n_TargetFileBlocks LOGR " number of blocks." INFO_END;
 
     /*
@@ -736,26 +937,26 @@ void ZsyncRemoteControlFileParserPrivate::handleControlFile(void) {
      * If the target file url is relative then we have to construct the url from the control
      * file url which is given by the developer.
      *
-     * IMPORTANT: Do not resolve the target url here since the redirected url may expire
-     * anytime, This could cause a force cache clear when all the data are valid.
-     * The redirected url must be checked on the downloader itself to solve this problem.
+     * The url the probe was redirected to is handed to the writer, such that the
+     * downloader does not probe the same url again. The redirected url may expire
+     * anytime, so the writer forgets it when a download from it fails and the
+     * downloader probes again.
      **/
     {
+        u_ResolvedTargetFileUrl.clear();
 	if(u_TargetFileUrl.isRelative()) {
 	        u_TargetFileUrl = QUrl(u_ControlFileUrl.toString().replace(
 					u_ControlFileUrl.fileName(), u_TargetFileUrl.fileName()));        		
 	}
-        QNetworkRequest request;
-        /* Even if the abort does'nt work if range is assumed to be supported then the request will not
-         * spend too much data.
-         **/
-        QByteArray rangeHeaderValue = "bytes=" + QByteArray::number(0) + "-";
-        rangeHeaderValue += QByteArray::number(200); // Just get the first 200 Bytes of data.
-        request.setUrl(u_TargetFileUrl);
-        request.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
-        request.setRawHeader("Range", rangeHeaderValue);
-        auto reply = p_NManager->get(request);
-        connect(reply, &QNetworkReply::downloadProgress,
+        if(b_DryRun) {
+            INFO_START " handleControlFile : dry run, not probing the target file." INFO_END;
+            b_AcceptRange = true;
+            emit timing(QString::fromUtf8("ControlFileFetch"), m_FetchTimer.elapsed());
+            emit receiveControlFile();
+            return;
+        }
+        auto reply = p_NManager->get(makeProbeRequest(u_TargetFileUrl));
+        connect(reply, &QNetworkReply::metaDataChanged,
                 this, &ZsyncRemoteControlFileParserPrivate::checkHeadTargetFileUrl);
         connect(reply, SIGNAL(error(QNetworkReply::NetworkError)),
                 this, SLOT(handleNetworkError(QNetworkReply::NetworkError)));
@@ -768,38 +969,51 @@ void ZsyncRemoteControlFileParserPrivate::handleControlFile(void) {
     return;
 }
 
-void ZsyncRemoteControlFileParserPrivate::checkHeadTargetFileUrl(qint64 bytesReceived, qint64 bytesTotal) {
-    Q_UNUSED(bytesReceived);
-    Q_UNUSED(bytesTotal);
-
+void ZsyncRemoteControlFileParserPrivate::checkHeadTargetFileUrl(void) {
     auto reply = qobject_cast<QNetworkReply*>(QObject::sender());
     if(!reply) {
         WARNING_START "invalid pointer sent to checkHeadTargetFileUrl" WARNING_END;
         return;
     }
 
-    disconnect(reply, &QNetworkReply::downloadProgress,
-               this, &ZsyncRemoteControlFileParserPrivate::checkHeadTargetFileUrl);
-
     if(reply->error() != QNetworkReply::NoError) {
-        reply->abort();
-        reply->deleteLater();
         return;
     }
 
-    auto replyCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
-    /* Check if the server supports Range requests. */
-    b_AcceptRange = reply->hasRawHeader("Accept-Ranges") || replyCode == 206/*HTTP Status code 206 => partial retrival*/;
+    qint64 totalLength = -1;
+    if(!parseProbeReply(reply, &b_AcceptRange, &totalLength)) {
+        return; /* Still redirecting, or failed. */
+    }
+
+    disconnect(reply, &QNetworkReply::metaDataChanged,
+               this, &ZsyncRemoteControlFileParserPrivate::checkHeadTargetFileUrl);
+    disconnect(reply, SIGNAL(error(QNetworkReply::NetworkError)),
+               this, SLOT(handleNetworkError(QNetworkReply::NetworkError)));
+
     if(b_AcceptRange == false) {
         WARNING_START
         " handleControlFile : its confirmed that the remote server does not support range requests." WARNING_END;
-    }
-    reply->abort();
-    reply->deleteLater();
-
-    if(!b_AcceptRange) {
+        /* The server is sending the entire file, we don't need it. */
+        reply->abort();
+        reply->deleteLater();
         u_TorrentFile.clear();
+    } else {
+        if(totalLength > 0 && totalLength != n_TargetFileLength) {
+            WARNING_START " handleControlFile : target file length in the server(" LOGR totalLength
+            LOGR ") does not match with the control file." WARNING_END;
+        } else {
+            u_ResolvedTargetFileUrl = reply->url();
+        }
+        /* Let the single byte arrive such that the connection is kept alive. */
+        if(reply->isFinished()) {
+            reply->deleteLater();
+        } else {
+            connect(reply, &QNetworkReply::finished,
+                    reply, &QObject::deleteLater);
+        }
     }
+
+    emit timing(QString::fromUtf8("ControlFileFetch"), m_FetchTimer.elapsed());
     emit receiveControlFile();
     return;
 }
@@ -812,7 +1026,7 @@ void ZsyncRemoteControlFileParserPrivate::handleNetworkError(QNetworkReply::Netw
     disconnect(senderReply, SIGNAL(error(QNetworkReply::NetworkError)),
                this,SLOT(handleNetworkError(QNetworkReply::NetworkError)));
     disconnect(senderReply, SIGNAL(finished(void)), this, SLOT(handleControlFile(void)));
-    disconnect(senderReply, &QNetworkReply::downloadProgress,
+    disconnect(senderReply, &QNetworkReply::metaDataChanged,
                this, &ZsyncRemoteControlFileParserPrivate::checkHeadTargetFileUrl);
     disconnect(senderReply, SIGNAL(downloadProgress(qint64, qint64)),
                this, SLOT(handleDownloadProgress(qint64, qint64)));
@@ -829,7 +1043,7 @@ void ZsyncRemoteControlFileParserPrivate::handleNetworkError(QNetworkReply::Netw
 
 /* This slot will be called anytime error signal is emitted. */
 void ZsyncRemoteControlFileParserPrivate::handleErrorSignal(short errorCode) {
-    FATAL_START LOGR " error : Code " LOGR errorCode LOGR " occured.";
+    FATAL_START LOGR " error : Code " LOGR errorCode LOGR " occured." FATAL_END;
     clear(); // clear all data to prevent later corrupted data collisions.
     return;
 }
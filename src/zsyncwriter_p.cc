@@ -33,10 +33,14 @@
  * @description : This is where the main zsync algorithm is implemented.
 */
 #include <cstdlib>
+#include <QRunnable>
+#include <QMetaMethod>
 
 #include "zsyncwriter_p.hpp"
 #include "qappimageupdateenums.hpp"
 #include "helpers_p.hpp"
+#include "seedindex_p.hpp"
+#include "tracer_p.hpp"
 
 /*
  * An efficient logging system specially tailored
@@ -48,11 +52,18 @@
  *
 */
 #ifndef LOGGING_DISABLED
-#define LOGS *(p_Logger.data()) <<
+/* Nothing is formatted unless someone listens to the logger signal. */
+static QMetaMethod loggerSignal() {
+    static const QMetaMethod signal = QMetaMethod::fromSignal(&ZsyncWriterPrivate::logger);
+    return signal;
+}
+
+#define LOGS if(isSignalConnected(loggerSignal())) { *(p_Logger.data()) <<
 #define LOGR <<
 #define LOGE ; \
 	     emit(logger(s_LogBuffer , s_SourceFilePath)); \
-	     s_LogBuffer.clear();
+	     s_LogBuffer.clear(); \
+	     }
 #else
 #define LOGS (void)
 #define LOGR ;(void)
@@ -77,25 +88,73 @@
 
 
 
+/* Blocks verified by a single job of the verification pool. */
+#define VERIFY_BATCH_BLOCKS 256
+
+/* Fraction of the target blocks an AppImage found in the seed directories
+ * must have among its own blocks to be used as a seed. */
+#define SEED_OVERLAP_THRESHOLD 0.1
+
+/* Fraction of the blocks of a seed the index join has to use for the
+ * rolling checksum scan of the seed to be skipped, the rest of the seed
+ * could add little. */
+#define JOIN_SKIP_SCAN_RATIO 0.95
+
+/* The most blocks read from a seed at once by the index join. */
+#define JOIN_MAX_RUN_BLOCKS 256
+
 /*
- * Zsync uses the same modified version of the Adler32 checksum
- * as in rsync as the rolling checksum , here after denoted by rsum.
- * Calculate the rsum for a single block of data. */
-static rsum __attribute__ ((pure)) calc_rsum_block(const unsigned char *data, size_t len) {
-    unsigned short a = 0;
-    unsigned short b = 0;
-
-    while (len) {
-        unsigned char c = *data++;
-        a += c;
-        b += len * c;
-        len--;
-    }
-    {
-        struct rsum r = { a, b };
-        return r;
+ * Verifies one batch of blocks of a downloaded range against the strong
+ * checksums and tells the writer when the last batch of the range is done.
+ * The range only holds copies of what it needs, so a job never touches
+ * the state of the writer.
+*/
+class RangeVerifier : public QRunnable {
+  public:
+    RangeVerifier(QObject *writer, qint64 sequence, QSharedPointer<RangeVerification> verification, int batch)
+        : m_Writer(writer),
+          n_Sequence(sequence),
+          m_Verification(verification),
+          n_Batch(batch) { }
+
+    void run() {
+        QCryptographicHash md4(QCryptographicHash::Md4);
+        auto v = m_Verification.data();
+        qint32 blocks = v->toBlock - v->fromBlock;
+        qint32 from = n_Batch * VERIFY_BATCH_BLOCKS,
+               to = qMin(blocks, from + VERIFY_BATCH_BLOCKS);
+
+        for(qint32 i = from; i < to; ++i) {
+            qint64 offset = static_cast<qint64>(i) * v->blockSize;
+            qint64 available = qMax(Q_INT64_C(0), qMin(static_cast<qint64>(v->blockSize), v->data->size() - offset));
+
+            md4.reset();
+            md4.addData(v->data->constData() + offset, static_cast<int>(available));
+            /* Fill with zeros if the block size is less than the required blocksize. */
+            if(available < v->blockSize) {
+                md4.addData(QByteArray(static_cast<int>(v->blockSize - available), '\0'));
+            }
+
+            if(memcmp(md4.result().constData(),
+                      v->expected.constData() + static_cast<qint64>(i) * v->strongCheckSumBytes,
+                      v->strongCheckSumBytes)) {
+                v->firstBad[n_Batch] = v->fromBlock + i;
+                break;
+            }
+        }
+
+        if(!v->pending.deref()) {
+            QMetaObject::invokeMethod(m_Writer, "handleRangeVerified",
+                                      Qt::QueuedConnection,
+                                      Q_ARG(qint64, n_Sequence));
+        }
     }
-}
+  private:
+    QObject *m_Writer;
+    qint64 n_Sequence;
+    QSharedPointer<RangeVerification> m_Verification;
+    int n_Batch;
+};
 
 /*
  * The main class which provides the qt zsync api.
@@ -117,13 +176,14 @@ ZsyncWriterPrivate::ZsyncWriterPrivate(QNetworkAccessManager *manager)
 }
 
 ZsyncWriterPrivate::~ZsyncWriterPrivate() {
+    m_VerifyPool.clear();
+    m_VerifyPool.waitForDone();
     /* Free all c allocator allocated memory */
     if(p_RsumHash)
         free(p_RsumHash);
     if(p_Ranges)
         free(p_Ranges);
-    if(p_BlockHashes)
-        free(p_BlockHashes);
+    freeBlockTable();
     if(p_BitHash)
         free(p_BitHash);
     return;
@@ -137,6 +197,56 @@ void ZsyncWriterPrivate::setOutputDirectory(const QString &dir) {
     return;
 }
 
+/* Allows HTTP/2 for the range requests if the server supports it. */
+void ZsyncWriterPrivate::setHttp2Enabled(bool choice) {
+    if(b_Started)
+        return;
+    b_Http2Enabled = choice;
+    return;
+}
+
+/* Sets the network access manager the downloaders are created with. */
+void ZsyncWriterPrivate::setNetworkAccessManager(QNetworkAccessManager *manager) {
+    if(b_Started || !manager)
+        return;
+    m_Manager = manager;
+    return;
+}
+
+/* Sets extra mirrors of the target file, used along with the target file url. */
+void ZsyncWriterPrivate::setMirrors(const QList<QUrl> &mirrors) {
+    if(b_Started)
+        return;
+    m_Mirrors = mirrors;
+    return;
+}
+
+/* Sets the directories searched for other AppImages to use as extra seeds,
+ * empty disables the search. */
+void ZsyncWriterPrivate::setSeedDirectories(const QStringList &directories) {
+    if(b_Started)
+        return;
+    m_SeedDirectories = directories;
+    return;
+}
+
+/* Sets the threads which verify the downloaded blocks, 0 picks one per core. */
+void ZsyncWriterPrivate::setHashingThreads(int threads) {
+    if(b_Started)
+        return;
+    m_VerifyPool.setMaxThreadCount(threads > 0 ? threads : QThread::idealThreadCount());
+    return;
+}
+
+/* Only plans the update, the seeds are used as usual but nothing is written
+ * and nothing is downloaded. Finishes with the plan instead of the new file. */
+void ZsyncWriterPrivate::setDryRun(bool choice) {
+    if(b_Started)
+        return;
+    b_DryRun = choice;
+    return;
+}
+
 /* Sets the logger name. */
 void ZsyncWriterPrivate::setLoggerName(const QString &name) {
     if(b_Started)
@@ -180,10 +290,33 @@ void ZsyncWriterPrivate::handleLogMessage(QString msg, QString path) {
 
 // Returns the required ranges
 bool ZsyncWriterPrivate::getBlockRanges() {
-    if(!p_Ranges || !n_Ranges || b_AcceptRange == false) {
+    QVector<QPair<qint32, qint32>> ranges;
+    if(!planBlockRanges(&ranges)) {
+        return false;
+    }
+
+    for(auto iter = ranges.constBegin(),
+            end = ranges.constEnd();
+            iter != end;
+            ++iter) {
+        m_RangeDownloader->appendRange((*iter).first, (*iter).second);
+    }
+    return true;
+}
+
+/* Gets the block ranges which are still needed, split into the pieces that
+ * are requested from the server. Returns false if the ranges cannot be
+ * requested, then the entire file has to be downloaded. */
+bool ZsyncWriterPrivate::planBlockRanges(QVector<QPair<qint32, qint32>> *ranges) {
+    if(b_AcceptRange == false || n_Blocks <= 0) {
         return false;
     }
 
+    /* Without any usable seed block the entire file is needed, so split it
+     * into segments which are downloaded in parallel and verified like any
+     * other range instead of a single stream. */
+    qint32 segments = (!p_Ranges || !n_Ranges) ? FULL_DOWNLOAD_SEGMENTS : 1;
+
     INFO_START " getBlockRanges : getting required block ranges." INFO_END;
 
     int i, n;
@@ -192,7 +325,7 @@ bool ZsyncWriterPrivate::getBlockRanges() {
     zs_blockid *r = (zs_blockid*)malloc(2 * alloc_n * sizeof(zs_blockid));
 
     if (!r)
-        return NULL;
+        return false;
 
     r[0] = from;
     r[1] = to;
@@ -225,7 +358,7 @@ bool ZsyncWriterPrivate::getBlockRanges() {
                     r2 = (zs_blockid*)realloc(r, 2 * alloc_n * sizeof *r);
                     if (!r2) {
                         free(r);
-                        return NULL;
+                        return false;
                     }
                     r = r2;
                 }
@@ -245,7 +378,7 @@ bool ZsyncWriterPrivate::getBlockRanges() {
 
         INFO_START " getBlockRanges : (" LOGR from LOGR " , " LOGR to LOGR ")." INFO_END;
 
-        m_RangeDownloader->appendRange(from, to);
+        *ranges += splitBlockRange(from, to, n_BlockSize, segments);
         QCoreApplication::processEvents();
     }
 
@@ -261,7 +394,7 @@ bool ZsyncWriterPrivate::getBlockRanges() {
  * QByteArray.
 */
 void ZsyncWriterPrivate::writeDataSequential(QByteArray *dataFragment, bool isLast) {
-    QScopedPointer<QByteArray> data(dataFragment);
+    QScopedPointer<QByteArray, BufferPool::Deleter> data(dataFragment);
     if(!p_TargetFile->isOpen()) {
         /*
          * If the target file is not opened then it most likely means
@@ -285,24 +418,66 @@ void ZsyncWriterPrivate::writeDataSequential(QByteArray *dataFragment, bool isLa
  * Compares all blocks with the rolling checksum parsed
  * from the zsync control file.
  * Incase there is a mismatch , Only verified blocks are written the working target file.
+ *
+ * The blocks are verified in batches on the verification pool, this only
+ * queues the range. The ranges are committed in the order they were given
+ * by commitVerifiedRange.
 */
 void ZsyncWriterPrivate::writeBlockRanges(qint32 fromBlock, qint32 toBlock, QByteArray *downloadedData, bool isLast) {
-    unsigned char md4sum[CHECKSUM_SIZE];
     /* Build checksum hash tables if we don't have them yet */
     if (!p_RsumHash) {
         if (!buildHash()) {
+            BufferPool::release(downloadedData);
             emit error(QAppImageUpdateEnums::Error::CannotConstructHashTable);
             return;
         }
     }
 
-    bool Md4ChecksumsMatched = true;
-    QScopedPointer<QByteArray> downloaded(downloadedData);
-    QScopedPointer<QBuffer> buffer(new QBuffer(downloadedData));
-    buffer->open(QIODevice::ReadOnly);
+    QSharedPointer<RangeVerification> verification(new RangeVerification);
+    verification->fromBlock = fromBlock;
+    verification->toBlock = toBlock;
+    verification->blockSize = n_BlockSize;
+    verification->strongCheckSumBytes = n_StrongCheckSumBytes;
+    verification->isLast = isLast;
+    verification->data.reset(downloadedData);
+
+    qint32 blocks = qMax(0, toBlock - fromBlock);
+    qint32 batches = (blocks + VERIFY_BATCH_BLOCKS - 1) / VERIFY_BATCH_BLOCKS;
+    verification->expected = QByteArray((const char*)blockChecksum(fromBlock),
+                                        blocks * n_StrongCheckSumBytes);
+    verification->firstBad.fill(NO_BLOCK, batches);
+    verification->pending.storeRelease(batches);
+
+    auto sequence = n_NextVerification++;
+    m_Verifications.insert(sequence, verification);
+
+    if(!batches) {
+        handleRangeVerified(sequence);
+        return;
+    }
+
+    for(int batch = 0; batch < batches; ++batch) {
+        m_VerifyPool.start(new RangeVerifier(this, sequence, verification, batch));
+    }
+    return;
+}
 
+/* Called when all the batches of a range are verified, commits every range
+ * which is verified and has no unverified range before it. */
+void ZsyncWriterPrivate::handleRangeVerified(qint64 sequence) {
+    auto verification = m_Verifications.value(sequence);
+    if(verification.isNull()) {
+        return; /* From before the last setConfiguration. */
+    }
+    verification->done = true;
 
+    while(!m_Verifications.isEmpty() && m_Verifications.first()->done) {
+        verification = m_Verifications.take(m_Verifications.firstKey());
+        commitVerifiedRange(verification.data());
+    }
+}
 
+void ZsyncWriterPrivate::commitVerifiedRange(RangeVerification *verification) {
     // In the original code the author uses the similar with the following equation,
     // bfrom = rangeFrom / blocksize
     // bto = bfrom + blocks - 1 .. (1)
@@ -326,46 +501,37 @@ void ZsyncWriterPrivate::writeBlockRanges(qint32 fromBlock, qint32 toBlock, QByt
     // length = bfrom + bto - bfrom - bfrom - 1 + 1
     //        = bto - bfrom
     //        = actual no. of blocks got.
-    zs_blockid bfrom = fromBlock,
-               bto = toBlock - 1;
-
-    for (zs_blockid x = bfrom; x <= bto; ++x) {
-        QByteArray blockData = buffer->read(n_BlockSize);
-        //// Fill with zeros if the block size is less than the required blocksize.
-        if(blockData.size() != n_BlockSize) {
-            INFO_START " writeBlockRanges : padding block(" LOGR bfrom LOGR "," LOGR bto LOGR ")." INFO_END;
-            QByteArray newBlockData;
-            newBlockData.fill('\0', (n_BlockSize - blockData.size()));
-            blockData.append(newBlockData);
-        }
-        calcMd4Checksum(&md4sum[0], (const unsigned char*)blockData.constData(), n_BlockSize);
-        if(memcmp(&md4sum, &(p_BlockHashes[x].checksum[0]), n_StrongCheckSumBytes)) {
-            Md4ChecksumsMatched = false;
-            WARNING_START " writeBlockRanges : block(" LOGR bfrom LOGR "," LOGR bto LOGR ")." WARNING_END;
-            WARNING_START " writeBlockRanges : MD4 checksums mismatch." WARNING_END;
-            WARNING_START " writeBlockRanges : MD4 Sum of Data : " LOGR
-            QByteArray((const char *)(&md4sum[0])).toHex() WARNING_END;
-            WARNING_START " writeBlockRanges : MD4 Sum of Required :  " LOGR
-            QByteArray((const char *)(&(p_BlockHashes[x].checksum[0]))).toHex() WARNING_END;
-            if (x > bfrom) {    /* Write any good blocks we did get */
-                INFO_START " writeBlockRanges : only writting good blocks. " INFO_END;
-                writeBlocks((const unsigned char*)downloaded->constData(), bfrom, x - 1);
-            }
+    zs_blockid bfrom = verification->fromBlock,
+               bto = verification->toBlock - 1;
+    const unsigned char *data = (const unsigned char*)verification->data->constData();
+
+    zs_blockid firstBad = NO_BLOCK;
+    for(auto iter = verification->firstBad.constBegin(),
+            end = verification->firstBad.constEnd();
+            iter != end;
+            ++iter) {
+        if(*iter != NO_BLOCK) {
+            firstBad = *iter;
             break;
         }
-        QCoreApplication::processEvents();
     }
 
-
-    if(Md4ChecksumsMatched) {
-        writeBlocks((const unsigned char*)downloaded->constData(), bfrom, bto);
+    if(firstBad == NO_BLOCK) {
+        writeBlocks(data, bfrom, bto);
+    } else {
+        WARNING_START " writeBlockRanges : block(" LOGR bfrom LOGR "," LOGR bto LOGR ")." WARNING_END;
+        WARNING_START " writeBlockRanges : MD4 checksums mismatch at block " LOGR firstBad LOGR "." WARNING_END;
+        WARNING_START " writeBlockRanges : MD4 Sum of Required :  " LOGR
+        QByteArray((const char *)blockChecksum(firstBad), n_StrongCheckSumBytes).toHex() WARNING_END;
+        if (firstBad > bfrom) {    /* Write any good blocks we did get */
+            INFO_START " writeBlockRanges : only writting good blocks. " INFO_END;
+            writeBlocks(data, bfrom, firstBad - 1);
+        }
     }
 
-
-    if(isLast) {
+    if(verification->isLast) {
         QTimer::singleShot(2500, this, &ZsyncWriterPrivate::verifyAndConstructTargetFile);
     }
-
     return;
 }
 
@@ -388,31 +554,51 @@ void ZsyncWriterPrivate::setConfiguration(qint32 blocksize,
         qint32 weakChecksumBytes,
         qint32 strongChecksumBytes,
         qint32 seqMatches,
-        qint32 targetFileLength,
+        qint64 targetFileLength,
         const QString &sourceFilePath,
         const QString &targetFileName,
         const QString &targetFileSHA1,
         QUrl targetFileUrl,
         QBuffer *targetFileCheckSumBlocks,
         bool rangeSupported,
-        QUrl torrentFileUrl) {
+        QUrl torrentFileUrl,
+        const QList<QUrl> &mirrors,
+        QUrl resolvedTargetFileUrl) {
     p_CurrentWeakCheckSums = qMakePair(rsum({ 0, 0 }), rsum({ 0, 0 }));
     n_Blocks = nblocks,
     n_BlockSize = blocksize,
     n_BlockShift = (blocksize == 1024) ? 10 : (blocksize == 2048) ? 11 : log2(blocksize);
     n_BytesWritten = 0;
+    n_Retries = 0;
+    n_Requests = 0;
+    n_BytesWasted = 0;
+    n_HashHits = n_WeakHits = n_CheckSummed = n_StrongHits = 0;
+    n_HashBuildTime = n_SeedScanTime = n_DownloadTime = n_VerificationTime = 0;
     n_Context = blocksize * seqMatches;
     n_WeakCheckSumBytes = weakChecksumBytes;
     p_WeakCheckSumMask = n_WeakCheckSumBytes < 3 ? 0 : n_WeakCheckSumBytes == 3 ? 0xff : 0xffff;
     n_StrongCheckSumBytes = strongChecksumBytes;
     n_SeqMatches = seqMatches;
+
+    /* Pick the matcher for this control file, n_SeqMatches is 1 or 2 and
+     * the weak checksum mask is one of 0, 0xff or 0xffff. */
+    if(n_SeqMatches > 1) {
+        p_SubmitSourceData = !p_WeakCheckSumMask ? &ZsyncWriterPrivate::submitSourceData<2, 0> :
+                             p_WeakCheckSumMask == 0xff ? &ZsyncWriterPrivate::submitSourceData<2, 0xff> :
+                             &ZsyncWriterPrivate::submitSourceData<2, 0xffff>;
+    } else {
+        p_SubmitSourceData = !p_WeakCheckSumMask ? &ZsyncWriterPrivate::submitSourceData<1, 0> :
+                             p_WeakCheckSumMask == 0xff ? &ZsyncWriterPrivate::submitSourceData<1, 0xff> :
+                             &ZsyncWriterPrivate::submitSourceData<1, 0xffff>;
+    }
     n_TargetFileLength = targetFileLength;
     p_TargetFileCheckSumBlocks.reset(targetFileCheckSumBlocks);
     n_Skip = n_NextKnown =p_HashMask = p_BitHashMask = 0;
-    p_Rover = p_NextMatch = nullptr;
+    n_Rover = n_NextMatch = NO_BLOCK;
     b_AcceptRange = rangeSupported;
     b_TorrentAvail = torrentFileUrl.isValid();
     u_TorrentFileUrl = torrentFileUrl;
+    m_ControlFileMirrors = mirrors;
 
     // Since Zsync Writer is only finished officially when all the data is sent and SHA-1 hashes match.
     // But sometimes the block range downloader can have a error or could be canceled and the Zsync Writer
@@ -424,12 +610,23 @@ void ZsyncWriterPrivate::setConfiguration(qint32 blocksize,
     // Without the below line, the zsync writer will not recover from a error or cancel.
     b_Started = b_CancelRequested = false;
 
+    if(u_TargetFileUrl != targetFileUrl) {
+        u_ResolvedTargetFileUrl.clear();
+        s_NetworkProtocol.clear();
+    }
     u_TargetFileUrl = targetFileUrl;
-    if(p_BlockHashes) {
-        free(p_BlockHashes);
-        p_BlockHashes = nullptr;
+    /* Already probed by the control file parser, the downloader skips its probe. */
+    if(resolvedTargetFileUrl.isValid()) {
+        u_ResolvedTargetFileUrl = resolvedTargetFileUrl;
+    }
+    m_Verifications.clear(); /* Results of the pending ones are ignored. */
+    freeBlockTable();
+    {
+        size_t entries = n_Blocks + n_SeqMatches;
+        p_BlockRsums = (rsum*)calloc(entries, sizeof(p_BlockRsums[0]));
+        p_BlockChecksums = (unsigned char*)calloc(entries, n_StrongCheckSumBytes);
+        p_BlockNext = (zs_blockid*)calloc(entries, sizeof(p_BlockNext[0]));
     }
-    p_BlockHashes = (hash_entry*)calloc(n_Blocks + n_SeqMatches, sizeof(p_BlockHashes[0]));
 
     if(p_Ranges) {
         free(p_Ranges);
@@ -454,6 +651,18 @@ void ZsyncWriterPrivate::setConfiguration(qint32 blocksize,
     path = (path == "." ) ? QDir::currentPath() : path;
     auto targetFilePath = path + "/" + s_TargetFileName + ".XXXXXXXXXX.part";
 
+    s_TargetFileDirectory = path;
+    m_SeedReuse = QJsonArray();
+
+    if(b_DryRun) {
+        /* Never opened, so nothing is created in the output directory. */
+        p_TargetFile.reset(new QTemporaryFile(targetFilePath));
+        INFO_START " setConfiguration : dry run, no temporary file is created." INFO_END;
+        b_Configured = true;
+        emit finishedConfiguring();
+        return;
+    }
+
     QFileInfo perm(path);
     if(!perm.isWritable() || !perm.isReadable()) {
         emit error(QAppImageUpdateEnums::Error::NoPermissionToReadWriteTargetFile);
@@ -482,6 +691,7 @@ void ZsyncWriterPrivate::setConfiguration(qint32 blocksize,
     } else {
         WARNING_START " setConfiguration : candidate not suitable for decentralized update" WARNING_END;
         m_RangeDownloader.reset(new RangeDownloader(m_Manager));
+        Tracer::attach(m_RangeDownloader.data(), this);
     }
 #else
     if(b_TorrentAvail && b_AcceptRange) {
@@ -489,6 +699,7 @@ void ZsyncWriterPrivate::setConfiguration(qint32 blocksize,
         WARNING_END;
     }
     m_RangeDownloader.reset(new RangeDownloader(m_Manager));
+    Tracer::attach(m_RangeDownloader.data(), this);
 #endif // DECENTRALIZED_UPDATE_ENABLED
 
     b_Configured = true;
@@ -536,6 +747,7 @@ void ZsyncWriterPrivate::start() {
     emit started();
 
     INFO_START " start : starting delta writer." INFO_END;
+    BufferPool::resetPeakBytesInUse();
     short errorCode = 0;
 
     /*
@@ -547,7 +759,7 @@ void ZsyncWriterPrivate::start() {
         QStringList filters;
         filters << s_TargetFileName + ".*.part";
 
-        QDir dir(QFileInfo(p_TargetFile->fileName()).path());
+        QDir dir(s_TargetFileDirectory);
         auto foundGarbageFilesInfo = dir.entryInfoList(filters);
         QDir seedFileDir(QFileInfo(s_SourceFilePath).path());
         foundGarbageFilesInfo << seedFileDir.entryInfoList(filters);
@@ -571,7 +783,7 @@ void ZsyncWriterPrivate::start() {
          * in the output of the target file directory.
         */
         {
-            QString alreadyDownloadedTargetFile = QFileInfo(p_TargetFile->fileName()).path() + "/" + s_TargetFileName;
+            QString alreadyDownloadedTargetFile = s_TargetFileDirectory + "/" + s_TargetFileName;
             QFileInfo info(alreadyDownloadedTargetFile);
             if(info.exists() && info.isReadable()) {
                 QFile *targetFile = nullptr;
@@ -582,7 +794,10 @@ void ZsyncWriterPrivate::start() {
 
 
                 int r = 0;
-                if((r = submitSourceFile(targetFile)) < 0) {
+                qint64 before = n_BytesWritten;
+                QElapsedTimer scan;
+                scan.start();
+                if((r = submitSeedFile(targetFile)) < 0) {
                     if(r == -2) {
                         /// Cannot construst hash table.
                         b_Started = b_CancelRequested = false;
@@ -598,6 +813,7 @@ void ZsyncWriterPrivate::start() {
                     }
                 }
                 delete targetFile;
+                recordSeedReuse(alreadyDownloadedTargetFile, n_BytesWritten - before, scan.elapsed());
             }
         }
 
@@ -613,6 +829,9 @@ void ZsyncWriterPrivate::start() {
                 }
 
                 int r = 0;
+                qint64 before = n_BytesWritten;
+                QElapsedTimer scan;
+                scan.start();
                 if((r = submitSourceFile(sourceFile)) < 0) {
                     if(r == -2) {
                         /// Cannot construst hash table.
@@ -628,7 +847,10 @@ void ZsyncWriterPrivate::start() {
                     }
                 }
                 delete sourceFile;
-                QFile::remove((*iter));
+                recordSeedReuse(*iter, n_BytesWritten - before, scan.elapsed());
+                if(!b_DryRun) {
+                    QFile::remove((*iter));
+                }
             }
         }
 
@@ -641,7 +863,10 @@ void ZsyncWriterPrivate::start() {
             }
 
             int r = 0;
-            if((r = submitSourceFile(sourceFile)) < 0) {
+            qint64 before = n_BytesWritten;
+            QElapsedTimer scan;
+            scan.start();
+            if((r = submitSeedFile(sourceFile)) < 0) {
                 delete sourceFile;
                 if(r == -1) {
                     /// Cannot allocate buffer memory
@@ -659,9 +884,63 @@ void ZsyncWriterPrivate::start() {
                 return;
             }
             delete sourceFile;
+            recordSeedReuse(s_SourceFilePath, n_BytesWritten - before, scan.elapsed());
+        }
+
+        if(n_BytesWritten < n_TargetFileLength) {
+            auto seedFiles = findSeedFiles();
+            if(b_CancelRequested) {
+                b_Started = b_CancelRequested = false;
+                emit canceled();
+                return;
+            }
+            for(auto iter = seedFiles.constBegin(),
+                    end  = seedFiles.constEnd();
+                    iter != end && n_BytesWritten < n_TargetFileLength;
+                    ++iter) {
+                QFile *seedFile = nullptr;
+                if(tryOpenSourceFile(*iter, &seedFile) > 0) {
+                    continue; /* Not usable as a seed, not an error. */
+                }
+
+                INFO_START " start : using " LOGR *iter LOGR " as a seed." INFO_END;
+                int r = 0;
+                qint64 before = n_BytesWritten;
+                QElapsedTimer scan;
+                scan.start();
+                if((r = submitSeedFile(seedFile)) < 0) {
+                    delete seedFile;
+                    if(r == -2) {
+                        /// Cannot construst hash table.
+                        b_Started = b_CancelRequested = false;
+                        emit error(QAppImageUpdateEnums::Error::HashTableNotAllocated);
+                    } else if(r == -3) {
+                        /// Canceled the update
+                        b_Started = false;
+                    }
+                    if(r != -1) {
+                        /// -1 cannot allocate memory.
+                        return;
+                    }
+                    continue;
+                }
+                delete seedFile;
+                recordSeedReuse(*iter, n_BytesWritten - before, scan.elapsed());
+            }
         }
     }
 
+    if(b_DryRun) {
+        QCoreApplication::processEvents(); // Check if cancel requested.
+        if(b_CancelRequested) {
+            b_Started = b_CancelRequested = false;
+            emit canceled();
+            return;
+        }
+        finishDryRun();
+        return;
+    }
+
     p_TransferSpeed.reset(new QElapsedTimer); // Refresh timer.
     p_TransferSpeed->start();
 
@@ -682,6 +961,19 @@ void ZsyncWriterPrivate::start() {
     /// the update will just be quietly waiting for seeds forever.
     /// So the best way is to just do a dumb http download.
     else if(b_TorrentAvail && b_AcceptRange) {
+        /// The byte ranges of the blocks we already have, such that the
+        /// torrent client only asks for the pieces which are missing.
+        QVector<qint64> knownRanges;
+        for(qint32 i = 0; i < n_Ranges; ++i) {
+            knownRanges << static_cast<qint64>(p_Ranges[2 * i]) * n_BlockSize
+                        << qMin(static_cast<qint64>(p_Ranges[2 * i + 1] + 1) * n_BlockSize, n_TargetFileLength);
+        }
+
+        /// libtorrent rechecks every piece if the size of the file on disk
+        /// is not what the torrent says.
+        p_TargetFile->resize(n_TargetFileLength);
+
+        m_TorrentDownloader->setKnownRanges(knownRanges);
         m_TorrentDownloader->setTargetFileDone(n_BytesWritten);
         m_TorrentDownloader->setTargetFileLength(n_TargetFileLength);
         m_TorrentDownloader->setTorrentFileUrl(u_TorrentFileUrl);
@@ -714,7 +1006,7 @@ void ZsyncWriterPrivate::start() {
         m_RangeDownloader->setTargetFileLength(n_TargetFileLength);
         m_RangeDownloader->setBytesWritten(n_BytesWritten);
 
-        if(!p_Ranges || !n_Ranges || b_AcceptRange == false) {
+        if(b_AcceptRange == false) {
             m_RangeDownloader->setFullDownload(true);
             // Full Download
             connect(m_RangeDownloader.data(), &RangeDownloader::data,
@@ -744,19 +1036,170 @@ void ZsyncWriterPrivate::start() {
         connect(m_RangeDownloader.data(), &RangeDownloader::error,
                 this, &ZsyncWriterPrivate::handleNetworkError, Qt::QueuedConnection);
 
+        connect(m_RangeDownloader.data(), &RangeDownloader::targetFileUrlResolved,
+                this, &ZsyncWriterPrivate::handleTargetFileUrlResolved, Qt::QueuedConnection);
+
+        connect(m_RangeDownloader.data(), &RangeDownloader::networkProtocol,
+                this, &ZsyncWriterPrivate::handleNetworkProtocol, Qt::QueuedConnection);
+
+        connect(m_RangeDownloader.data(), &RangeDownloader::retryCounters,
+                this, &ZsyncWriterPrivate::handleRetryCounters, Qt::QueuedConnection);
+
+        connect(m_RangeDownloader.data(), &RangeDownloader::requestCounter,
+                this, &ZsyncWriterPrivate::handleRequestCounter, Qt::QueuedConnection);
+
         m_RangeDownloader->setBlockSize(n_BlockSize);
+        m_RangeDownloader->setHttp2Enabled(b_Http2Enabled);
         m_RangeDownloader->setTargetFileUrl(u_TargetFileUrl);
+        appendMirrors();
+        if(!u_ResolvedTargetFileUrl.isEmpty()) {
+            m_RangeDownloader->setResolvedTargetFileUrl(u_ResolvedTargetFileUrl);
+        }
         m_RangeDownloader->start();
     }
     return;
 }
 
+/* Remembers how much of the target file a seed gave and how long it took. */
+void ZsyncWriterPrivate::recordSeedReuse(const QString &path, qint64 bytes, qint64 scanTime) {
+    QJsonObject seed {
+        {"Path", QFileInfo(path).absoluteFilePath() },
+        {"BytesReused", bytes },
+        {"ScanTime", scanTime }
+    };
+    m_SeedReuse.append(seed);
+    n_SeedScanTime += scanTime;
+    return;
+}
+
+/*
+ * Where the time of the update went, in ms, how the matcher did on the
+ * seeds and what the download took. The seed scan time includes the
+ * hash build since the hash is built by the first scan.
+*/
+QJsonObject ZsyncWriterPrivate::statistics() {
+    QJsonObject timings {
+        {"HashBuild", n_HashBuildTime },
+        {"SeedScan", n_SeedScanTime },
+        {"Download", n_DownloadTime },
+        {"Verification", n_VerificationTime }
+    };
+    QJsonObject matcher {
+        {"HashHits", n_HashHits },
+        {"WeakHits", n_WeakHits },
+        {"Checksummed", n_CheckSummed },
+        {"StrongHits", n_StrongHits }
+    };
+    QJsonObject stats {
+        {"Timings", timings },
+        {"Matcher", matcher },
+        {"Seeds", m_SeedReuse },
+        {"Requests", n_Requests },
+        {"Retries", n_Retries },
+        {"BytesWasted", n_BytesWasted },
+        {"PeakBufferMemory", BufferPool::peakBytesInUse() }
+    };
+    return stats;
+}
+
+/*
+ * Finishes a dry run with the plan of the update, that is the ranges which
+ * would be requested from the server, the bytes they take and how much
+ * each seed gave.
+*/
+void ZsyncWriterPrivate::finishDryRun() {
+    QVector<QPair<qint32, qint32>> ranges;
+    bool full = false;
+    if(n_BytesWritten < n_TargetFileLength) {
+        full = !planBlockRanges(&ranges);
+    }
+
+    qint64 bytesToDownload = full ? n_TargetFileLength : 0;
+    QJsonArray rangesArray;
+    for(auto iter = ranges.constBegin(),
+            end = ranges.constEnd();
+            iter != end;
+            ++iter) {
+        /* The server sends up to the last byte of the file. */
+        qint64 from = static_cast<qint64>((*iter).first) * n_BlockSize,
+               to = qMin(static_cast<qint64>((*iter).second) * n_BlockSize, n_TargetFileLength - 1);
+        bytesToDownload += to - from + 1;
+
+        QJsonObject range {
+            {"FromBlock", (*iter).first },
+            {"ToBlock", (*iter).second },
+            {"Range", QString::fromLatin1(makeRangeHeaderValue((*iter).first, (*iter).second, n_BlockSize, 0)) }
+        };
+        rangesArray.append(range);
+    }
+
+    QJsonObject plan {
+        {"DryRun", true },
+        {"TargetFileLength", n_TargetFileLength },
+        {"BlockSize", n_BlockSize },
+        {"Blocks", n_Blocks },
+        {"FullDownload", full },
+        {"BytesReused", qMin(n_BytesWritten, n_TargetFileLength) },
+        {"BytesToDownload", bytesToDownload },
+        {"Requests", full ? 1 : ranges.size() },
+        {"Ranges", rangesArray },
+        {"Seeds", m_SeedReuse },
+        {"Statistics", statistics() }
+    };
+
+    INFO_START " finishDryRun : " LOGR bytesToDownload LOGR " bytes would be downloaded in "
+    LOGR ranges.size() LOGR " requests." INFO_END;
+
+    b_Started = b_CancelRequested = false;
+    emit finished(plan, s_SourceFilePath);
+    return;
+}
+
 void ZsyncWriterPrivate::handleNetworkError(QNetworkReply::NetworkError code) {
     b_Started = false;
+    u_ResolvedTargetFileUrl.clear(); // The redirected url could have expired.
     FATAL_START " handleNetworkError : " LOGR code FATAL_END;
     emit error(translateQNetworkReplyError(code));
 }
 
+/* Gives all the known mirrors to the range downloader, a mirror which is a
+ * directory(ends with a slash) gets the target file name appended. */
+void ZsyncWriterPrivate::appendMirrors(void) {
+    auto mirrors = m_ControlFileMirrors + m_Mirrors;
+    for(auto iter = mirrors.constBegin(),
+            end = mirrors.constEnd();
+            iter != end;
+            ++iter) {
+        auto mirror = *iter;
+        if(mirror.path().endsWith('/')) {
+            mirror = mirror.resolved(QUrl(u_TargetFileUrl.fileName()));
+        }
+        INFO_START " appendMirrors : using mirror " LOGR mirror LOGR "." INFO_END;
+        m_RangeDownloader->appendMirror(mirror);
+    }
+}
+
+void ZsyncWriterPrivate::handleTargetFileUrlResolved(QUrl url) {
+    INFO_START " handleTargetFileUrlResolved : target file url resolved to " LOGR url LOGR "." INFO_END;
+    u_ResolvedTargetFileUrl = url;
+}
+
+void ZsyncWriterPrivate::handleNetworkProtocol(QString protocol) {
+    INFO_START " handleNetworkProtocol : using " LOGR protocol LOGR " for the target file." INFO_END;
+    s_NetworkProtocol = protocol;
+}
+
+void ZsyncWriterPrivate::handleRetryCounters(qint32 retries, qint64 bytesWasted) {
+    WARNING_START " handleRetryCounters : " LOGR retries LOGR " retries so far, " LOGR bytesWasted
+    LOGR " bytes thrown away." WARNING_END;
+    n_Retries = retries;
+    n_BytesWasted = bytesWasted;
+}
+
+void ZsyncWriterPrivate::handleRequestCounter(qint32 requests) {
+    n_Requests = requests;
+}
+
 #if defined(DECENTRALIZED_UPDATE_ENABLED) && LIBTORRENT_VERSION_NUM >= 10208
 void ZsyncWriterPrivate::handleTorrentError(QNetworkReply::NetworkError code) {
     Q_UNUSED(code);
@@ -770,10 +1213,12 @@ void ZsyncWriterPrivate::handleTorrentError(QNetworkReply::NetworkError code) {
     b_TorrentAvail = false;
 
     m_RangeDownloader.reset(new RangeDownloader(m_Manager));
+
+    Tracer::attach(m_RangeDownloader.data(), this);
     m_RangeDownloader->setTargetFileLength(n_TargetFileLength);
     m_RangeDownloader->setBytesWritten(n_BytesWritten);
 
-    if(!p_Ranges || !n_Ranges || b_AcceptRange == false) {
+    if(b_AcceptRange == false) {
         m_RangeDownloader->setFullDownload(true);
         // Full Download
         connect(m_RangeDownloader.data(), &RangeDownloader::data,
@@ -802,8 +1247,25 @@ void ZsyncWriterPrivate::handleTorrentError(QNetworkReply::NetworkError code) {
     connect(m_RangeDownloader.data(), &RangeDownloader::error,
             this, &ZsyncWriterPrivate::handleNetworkError, Qt::QueuedConnection);
 
+    connect(m_RangeDownloader.data(), &RangeDownloader::targetFileUrlResolved,
+            this, &ZsyncWriterPrivate::handleTargetFileUrlResolved, Qt::QueuedConnection);
+
+    connect(m_RangeDownloader.data(), &RangeDownloader::networkProtocol,
+            this, &ZsyncWriterPrivate::handleNetworkProtocol, Qt::QueuedConnection);
+
+    connect(m_RangeDownloader.data(), &RangeDownloader::retryCounters,
+            this, &ZsyncWriterPrivate::handleRetryCounters, Qt::QueuedConnection);
+
+    connect(m_RangeDownloader.data(), &RangeDownloader::requestCounter,
+            this, &ZsyncWriterPrivate::handleRequestCounter, Qt::QueuedConnection);
+
     m_RangeDownloader->setBlockSize(n_BlockSize);
+    m_RangeDownloader->setHttp2Enabled(b_Http2Enabled);
     m_RangeDownloader->setTargetFileUrl(u_TargetFileUrl);
+    appendMirrors();
+    if(!u_ResolvedTargetFileUrl.isEmpty()) {
+        m_RangeDownloader->setResolvedTargetFileUrl(u_ResolvedTargetFileUrl);
+    }
     m_RangeDownloader->start();
 }
 
@@ -834,7 +1296,7 @@ void ZsyncWriterPrivate::handleCancel() {
  * 		// Handle error.
 */
 short ZsyncWriterPrivate::parseTargetFileCheckSumBlocks() {
-    if(!p_BlockHashes) {
+    if(!p_BlockRsums || !p_BlockChecksums || !p_BlockNext) {
         return QAppImageUpdateEnums::Error::HashTableNotAllocated;
     } else if(!p_TargetFileCheckSumBlocks ||
               p_TargetFileCheckSumBlocks->size() < (n_WeakCheckSumBytes + n_StrongCheckSumBytes)) {
@@ -871,13 +1333,10 @@ short ZsyncWriterPrivate::parseTargetFileCheckSumBlocks() {
         }
 
 
-        /* Get hash entry with checksums for this block */
-        hash_entry *e = &(p_BlockHashes[id]);
-
-        /* Enter checksums */
-        memcpy(e->checksum, checksum, n_StrongCheckSumBytes);
-        e->r.a = r.a & p_WeakCheckSumMask;
-        e->r.b = r.b;
+        /* Enter checksums for this block */
+        memcpy(p_BlockChecksums + (size_t)id * n_StrongCheckSumBytes, checksum, n_StrongCheckSumBytes);
+        p_BlockRsums[id].a = r.a & p_WeakCheckSumMask;
+        p_BlockRsums[id].b = r.b;
 
         QCoreApplication::processEvents();
     }
@@ -934,6 +1393,63 @@ short ZsyncWriterPrivate::tryOpenSourceFile(const QString &filePath, QFile **sou
 }
 
 
+/*
+ * Looks for other AppImages in the seed directories and returns the ones
+ * which have enough blocks in common with the target file, the most
+ * promising first. Telling that only needs the index of each AppImage,
+ * so only the returned ones are scanned with the rolling checksum.
+*/
+QStringList ZsyncWriterPrivate::findSeedFiles() {
+    QStringList seedFiles;
+    if(m_SeedDirectories.isEmpty()) {
+        return seedFiles;
+    }
+
+    QSet<QString> seen;
+    seen << QFileInfo(s_SourceFilePath).canonicalFilePath()
+         << QFileInfo(p_TargetFile->fileName()).canonicalFilePath()
+         << QFileInfo(s_TargetFileDirectory + "/" + s_TargetFileName).canonicalFilePath();
+
+    QMultiMap<double, QString> candidates;
+    for(auto dirIter = m_SeedDirectories.constBegin(),
+            dirEnd = m_SeedDirectories.constEnd();
+            dirIter != dirEnd && !b_CancelRequested;
+            ++dirIter) {
+        auto files = QDir(*dirIter).entryInfoList(QStringList() << "*.AppImage",
+                     QDir::Files | QDir::Readable);
+        for(auto iter = files.constBegin(),
+                end = files.constEnd();
+                iter != end && !b_CancelRequested;
+                ++iter) {
+            auto path = (*iter).canonicalFilePath();
+            if(path.isEmpty() || seen.contains(path)) {
+                continue;
+            }
+            seen << path;
+
+            SeedIndex index(path, n_BlockSize);
+            if(!index.load(&b_CancelRequested)) {
+                continue;
+            }
+
+            auto overlap = index.overlap(p_BlockRsums, n_Blocks, p_WeakCheckSumMask);
+            INFO_START " findSeedFiles : " LOGR path LOGR " has " LOGR overlap * 100 LOGR "% of the blocks." INFO_END;
+            if(overlap >= SEED_OVERLAP_THRESHOLD) {
+                candidates.insert(overlap, path);
+            }
+            QCoreApplication::processEvents();
+        }
+    }
+
+    for(auto iter = candidates.constEnd(),
+            begin = candidates.constBegin();
+            iter != begin;) {
+        --iter;
+        seedFiles << iter.value();
+    }
+    return seedFiles;
+}
+
 /*
  * This private slot verifies if the current working target file matches
  * the final SHA1 Hash of the actual target file which resides in a remote
@@ -944,6 +1460,10 @@ bool ZsyncWriterPrivate::verifyAndConstructTargetFile() {
     if(!p_TargetFile->isOpen() || !p_TargetFile->autoRemove()) {
         return true;
     }
+    Tracer::Scope trace(this, "verifyAndConstructTargetFile");
+    n_DownloadTime = p_TransferSpeed.isNull() ? 0 : p_TransferSpeed->elapsed();
+    QElapsedTimer verification;
+    verification.start();
 
     bool constructed = false;
     QString UnderConstructionFileSHA1;
@@ -972,6 +1492,7 @@ bool ZsyncWriterPrivate::verifyAndConstructTargetFile() {
         QCoreApplication::processEvents();
     }
     UnderConstructionFileSHA1 = QString(SHA1Hasher->result().toHex().toUpper());
+    n_VerificationTime = verification.elapsed();
 
     INFO_START " verifyAndConstructTargetFile : comparing temporary target file sha1 hash(" LOGR UnderConstructionFileSHA1
     LOGR ") and remote target file sha1 hash(" LOGR s_TargetFileSHA1 INFO_END;
@@ -1024,7 +1545,11 @@ bool ZsyncWriterPrivate::verifyAndConstructTargetFile() {
         {"AbsolutePath", QFileInfo(p_TargetFile->fileName()).absoluteFilePath() },
         {"Sha1Hash", UnderConstructionFileSHA1},
         {"UsedTorrent", b_TorrentAvail && b_AcceptRange},
-	{"TorrentFileUrl", u_TorrentFileUrl.isValid() ? u_TorrentFileUrl.toString() : ""}
+	{"TorrentFileUrl", u_TorrentFileUrl.isValid() ? u_TorrentFileUrl.toString() : ""},
+        {"NetworkProtocol", s_NetworkProtocol},
+        {"Retries", n_Retries},
+        {"BytesWasted", n_BytesWasted},
+        {"Statistics", statistics()}
     };
     b_Started = b_CancelRequested = false;
     emit finished(newVersionDetails, s_SourceFilePath);
@@ -1041,43 +1566,41 @@ bool ZsyncWriterPrivate::verifyAndConstructTargetFile() {
  *
  * Return the number of blocks successfully obtained.
  */
-qint32 ZsyncWriterPrivate::checkCheckSumsOnHashChain(const struct hash_entry *e, const unsigned char *data,int onlyone) {
+template <int SeqMatches, unsigned short WeakMask>
+qint32 ZsyncWriterPrivate::checkCheckSumsOnHashChain(zs_blockid e, const unsigned char *data,int onlyone) {
     unsigned char md4sum[2][CHECKSUM_SIZE];
     signed int done_md4 = -1;
     qint32 got_blocks = 0;
     rsum rs = p_CurrentWeakCheckSums.first;
 
     /* This is a hint to the caller that they should try matching the next
-     * block against a particular hash entry (because at least n_SeqMatches
+     * block against a particular hash entry (because at least SeqMatches
      * prior blocks to it matched in sequence). Clear it here and set it below
      * if and when we get such a set of matches. */
-    p_NextMatch = NULL;
+    n_NextMatch = NO_BLOCK;
 
-    /* This is essentially a for (;e;e=e->next), but we want to remove links from
-     * the list as we find matches, without keeping too many temp variables.
+    /* This is essentially a for (;e != NO_BLOCK;e=next[e]), but we want to remove
+     * links from the list as we find matches, without keeping too many temp variables.
      */
-    p_Rover = e;
-    while (p_Rover) {
-        zs_blockid id;
+    n_Rover = e;
+    while (n_Rover != NO_BLOCK) {
+        zs_blockid id = n_Rover;
 
-        e = p_Rover;
-        p_Rover = onlyone ? NULL : e->next;
+        n_Rover = onlyone ? NO_BLOCK : p_BlockNext[id];
 
         /* Check weak checksum first */
 
-        // HashHit++
-        if (e->r.a != (rs.a & p_WeakCheckSumMask) || e->r.b != rs.b) {
+        ++n_HashHits;
+        if (p_BlockRsums[id].a != (rs.a & WeakMask) || p_BlockRsums[id].b != rs.b) {
             continue;
         }
 
-        id = getHashEntryBlockId( e);
-
-        if (!onlyone && n_SeqMatches > 1
-                && (p_BlockHashes[id + 1].r.a != (p_CurrentWeakCheckSums.second.a & p_WeakCheckSumMask)
-                    || p_BlockHashes[id + 1].r.b != p_CurrentWeakCheckSums.second.b))
+        if (!onlyone && SeqMatches > 1
+                && (p_BlockRsums[id + 1].a != (p_CurrentWeakCheckSums.second.a & WeakMask)
+                    || p_BlockRsums[id + 1].b != p_CurrentWeakCheckSums.second.b))
             continue;
 
-        // WeakHit++
+        ++n_WeakHits;
 
         {
             int ok = 1;
@@ -1085,7 +1608,7 @@ qint32 ZsyncWriterPrivate::checkCheckSumsOnHashChain(const struct hash_entry *e,
             zs_blockid next_known = -1;
 
             /* This block at least must match; we must match at least
-             * n_SeqMatches-1 others, which could either be trailing stuff,
+             * SeqMatches-1 others, which could either be trailing stuff,
              * or these could be preceding blocks that we have verified
              * already. */
             do {
@@ -1095,19 +1618,19 @@ qint32 ZsyncWriterPrivate::checkCheckSumsOnHashChain(const struct hash_entry *e,
                                     data + n_BlockSize * check_md4,
                                     n_BlockSize);
                     done_md4 = check_md4;
-                    // Checksummed++
+                    ++n_CheckSummed;
                 }
 
                 /* Now check the strong checksum for this block */
                 if (memcmp(&md4sum[check_md4],
-                           &p_BlockHashes[id + check_md4].checksum[0],
+                           blockChecksum(id + check_md4),
                            n_StrongCheckSumBytes)) {
                     ok = 0;
                 } else if (next_known == -1) {
                 }
                 check_md4++;
                 QCoreApplication::processEvents();
-            } while (ok && !onlyone && check_md4 < n_SeqMatches);
+            } while (ok && !onlyone && check_md4 < SeqMatches);
 
             if (ok) {
                 qint32 num_write_blocks;
@@ -1117,13 +1640,13 @@ qint32 ZsyncWriterPrivate::checkCheckSumsOnHashChain(const struct hash_entry *e,
                  * as ->next_known. */
                 zs_blockid next_known = onlyone ? n_NextKnown : nextKnownBlock( id);
 
-                // stronghit++
+                ++n_StrongHits;
 
                 if (next_known > id + check_md4) {
                     num_write_blocks = check_md4;
 
                     /* Save state for this run of matches */
-                    p_NextMatch = &(p_BlockHashes[id + check_md4]);
+                    n_NextMatch = id + check_md4;
                     if (!onlyone) n_NextKnown = next_known;
                 } else {
                     /* We've reached the EOF, or data we already know. Just
@@ -1159,6 +1682,7 @@ qint32 ZsyncWriterPrivate::checkCheckSumsOnHashChain(const struct hash_entry *e,
  * p_CurrentWeakCheckSums.first - rolling checksum of the first blocksize bytes of the buffer
  * p_CurrentWeakCheckSums.second - rolling checksum of the next blocksize bytes of the buffer (if n_SeqMatches > 1)
  */
+template <int SeqMatches, unsigned short WeakMask>
 qint32 ZsyncWriterPrivate::submitSourceData(unsigned char *data,size_t len, off_t offset) {
     /* The window in data[] currently being considered is
      * [x, x+bs)
@@ -1170,12 +1694,12 @@ qint32 ZsyncWriterPrivate::submitSourceData(unsigned char *data,size_t len, off_
     if (offset) {
         x = n_Skip;
     } else {
-        p_NextMatch = NULL;
+        n_NextMatch = NO_BLOCK;
     }
 
     if (x || !offset) {
         p_CurrentWeakCheckSums.first = calc_rsum_block(data + x, bs);
-        if (n_SeqMatches > 1)
+        if (SeqMatches > 1)
             p_CurrentWeakCheckSums.second = calc_rsum_block(data + x + bs, bs);
     }
     n_Skip = 0;
@@ -1197,27 +1721,27 @@ qint32 ZsyncWriterPrivate::submitSourceData(unsigned char *data,size_t len, off_
             /* If the previous block was a match, but we're looking for
              * sequential matches, then test this block against the block in
              * the target immediately after our previous hit. */
-            if (p_NextMatch && n_SeqMatches > 1) {
-                if (0 != (thismatch = checkCheckSumsOnHashChain( p_NextMatch, data + x, 1))) {
+            if (n_NextMatch != NO_BLOCK && SeqMatches > 1) {
+                if (0 != (thismatch = checkCheckSumsOnHashChain<SeqMatches, WeakMask>( n_NextMatch, data + x, 1))) {
                     blocks_matched = 1;
                 }
             }
             if (!thismatch) {
-                const struct hash_entry *e;
+                zs_blockid e;
 
                 /* Do a hash table lookup - first in the p_BitHash (fast negative
                  * check) and then in the rsum hash */
                 unsigned hash = p_CurrentWeakCheckSums.first.b;
-                hash ^= ((n_SeqMatches > 1) ? p_CurrentWeakCheckSums.second.b
-                         : p_CurrentWeakCheckSums.first.a & p_WeakCheckSumMask) << BITHASHBITS;
+                hash ^= ((SeqMatches > 1) ? p_CurrentWeakCheckSums.second.b
+                         : p_CurrentWeakCheckSums.first.a & WeakMask) << BITHASHBITS;
                 if ((p_BitHash[(hash & p_BitHashMask) >> 3] & (1 << (hash & 7))) != 0
-                        && (e = p_RsumHash[hash & p_HashMask]) != NULL) {
+                        && (e = p_RsumHash[hash & p_HashMask]) != NO_BLOCK) {
 
                     /* Okay, we have a hash hit. Follow the hash chain and
                      * check our block against all the entries. */
-                    thismatch = checkCheckSumsOnHashChain( e, data + x, 0);
+                    thismatch = checkCheckSumsOnHashChain<SeqMatches, WeakMask>( e, data + x, 0);
                     if (thismatch)
-                        blocks_matched = n_SeqMatches;
+                        blocks_matched = SeqMatches;
                 }
             }
             got_blocks += thismatch;
@@ -1239,11 +1763,11 @@ qint32 ZsyncWriterPrivate::submitSourceData(unsigned char *data,size_t len, off_
                 /* If we are moving forward just 1 block, we already have the
                  * following block rsum. If we are skipping both, then
                  * recalculate both */
-                if (n_SeqMatches > 1 && blocks_matched == 1)
+                if (SeqMatches > 1 && blocks_matched == 1)
                     p_CurrentWeakCheckSums.first = p_CurrentWeakCheckSums.second;
                 else
                     p_CurrentWeakCheckSums.first = calc_rsum_block(data + x, bs);
-                if (n_SeqMatches > 1)
+                if (SeqMatches > 1)
                     p_CurrentWeakCheckSums.second = calc_rsum_block(data + x + bs, bs);
                 continue;
             }
@@ -1256,21 +1780,134 @@ qint32 ZsyncWriterPrivate::submitSourceData(unsigned char *data,size_t len, off_
             unsigned char nc = data[x + bs];
             unsigned char oc = data[x];
             UPDATE_RSUM(p_CurrentWeakCheckSums.first.a, p_CurrentWeakCheckSums.first.b, oc, nc, n_BlockShift);
-            if (n_SeqMatches > 1)
+            if (SeqMatches > 1)
                 UPDATE_RSUM(p_CurrentWeakCheckSums.second.a, p_CurrentWeakCheckSums.second.b, nc, Nc, n_BlockShift);
         }
         x++;
     }
 }
 
+/*
+ * Gets the blocks the given seed has in common with the target file, first
+ * by joining the cached index of the seed against the block table and then
+ * by scanning it with the rolling checksum for the blocks which are not
+ * aligned, unless the join already used nearly all of the seed.
+ * Without a cached index the join would read the seed once more than the
+ * scan does, so the seed is only scanned and the index is built from what
+ * the scan reads.
+ * Returns the same as submitSourceFile.
+*/
+qint32 ZsyncWriterPrivate::submitSeedFile(QFile *file) {
+    if(!file) {
+        return 0;
+    }
+
+    SeedIndex index(file->fileName(), n_BlockSize);
+    if(!index.loadCached()) {
+        return submitSourceFile(file, index.beginBuild() ? &index : nullptr);
+    }
+
+    qint32 used = joinSeedIndex(file, index);
+    if(used < 0) {
+        return used;
+    }
+
+    qint32 seedBlocks = blockCount(file->size(), n_BlockSize);
+    if(n_BytesWritten >= n_TargetFileLength ||
+            (seedBlocks > 0 && used >= seedBlocks * JOIN_SKIP_SCAN_RATIO)) {
+        INFO_START " submitSeedFile : index join used " LOGR used LOGR " of " LOGR seedBlocks LOGR
+        " blocks, skipping the scan." INFO_END;
+        file->close();
+        return 0;
+    }
+    return submitSourceFile(file);
+}
+
+/*
+ * Joins the signatures of the aligned blocks of the seed, taken from its
+ * cached index, against the block table and writes every run of blocks
+ * found. As long as the blocks are aligned in the seed this finds what
+ * the rolling checksum finds, but with a hash lookup per block instead
+ * of a checksum per byte.
+ * Returns the number of distinct seed blocks used or the same errors as
+ * submitSourceFile.
+*/
+qint32 ZsyncWriterPrivate::joinSeedIndex(QFile *file, const SeedIndex &index) {
+    if (!p_RsumHash) {
+        if (!buildHash()) {
+            return -2;
+        }
+    }
+
+    auto matches = index.matchBlocks(p_BlockRsums, p_BlockChecksums, n_Blocks,
+                                     n_StrongCheckSumBytes, p_WeakCheckSumMask, n_SeqMatches);
+    qint32 used = 0;
+    QBitArray usedBlocks(index.blocks()); /* a seed block can fill many target blocks. */
+    QByteArray buffer;
+    zs_blockid id = 0;
+    while(id < n_Blocks) {
+        if(matches.at(id) == NO_BLOCK || alreadyGotBlock(id)) {
+            ++id;
+            continue;
+        }
+
+        /* Blocks which follow each other in the seed are read at once. */
+        zs_blockid runFrom = matches.at(id);
+        qint32 runLength = 1;
+        while(runLength < JOIN_MAX_RUN_BLOCKS &&
+                id + runLength < n_Blocks &&
+                matches.at(id + runLength) == runFrom + runLength &&
+                !alreadyGotBlock(id + runLength)) {
+            ++runLength;
+        }
+
+        qint64 offset = static_cast<qint64>(runFrom) * n_BlockSize,
+               bytes = static_cast<qint64>(runLength) * n_BlockSize,
+               expected = qMin(bytes, file->size() - offset),
+               got = -1;
+        buffer.resize(static_cast<int>(bytes));
+        if(file->seek(offset)) {
+            got = file->read(buffer.data(), expected);
+        }
+        if(got != expected) {
+            break; /* Leave the rest to the scan. */
+        }
+        /* Fill with zeros if the last block of the seed is short. */
+        memset(buffer.data() + got, 0, bytes - got);
+
+        writeBlocks((const unsigned char*)buffer.constData(), id, id + runLength - 1);
+        for(qint32 i = runFrom; i < runFrom + runLength; ++i) {
+            if(!usedBlocks.testBit(i)) {
+                usedBlocks.setBit(i);
+                ++used;
+            }
+        }
+        id += runLength;
+
+        QCoreApplication::processEvents();
+        if(b_CancelRequested == true) {
+            b_CancelRequested = false;
+            emit canceled();
+            return -3;
+        }
+    }
+    file->seek(0);
+
+    INFO_START " joinSeedIndex : got " LOGR used LOGR " blocks from the index of " LOGR file->fileName() LOGR "." INFO_END;
+    return used;
+}
+
 /* Read the given stream, applying the rsync rolling checksum algorithm to
  * identify any blocks of data in common with the target file. Blocks found are
  * written to our working target output.
+ * Everything read is also fed to the given index being built, if any, which
+ * is written to the cache once the entire stream was read.
  */
-qint32 ZsyncWriterPrivate::submitSourceFile(QFile *file) {
+qint32 ZsyncWriterPrivate::submitSourceFile(QFile *file, SeedIndex *index) {
     if(!file) {
         return 0;
     }
+    Tracer::Scope trace(this, "submitSourceFile", QFileInfo(file->fileName()).fileName());
 
     qint32 error = 0;
     off_t in = 0;
@@ -1298,6 +1935,8 @@ qint32 ZsyncWriterPrivate::submitSourceFile(QFile *file) {
         /* If this is the start, fill the buffer for the first time */
         if (!in) {
             len = file->read((char*)buf, bufsize);
+            if (index)
+                index->addData((const char*)buf, len);
             in += len;
         }
 
@@ -1306,7 +1945,10 @@ qint32 ZsyncWriterPrivate::submitSourceFile(QFile *file) {
         else {
             memcpy(buf, buf + (bufsize - n_Context), n_Context);
             in += bufsize - n_Context;
-            len = n_Context + file->read((char*)(buf + n_Context), (bufsize - n_Context));
+            qint64 got = file->read((char*)(buf + n_Context), (bufsize - n_Context));
+            if (index)
+                index->addData((const char*)(buf + n_Context), got);
+            len = n_Context + got;
         }
 
         if (file->atEnd()) {          /* 0 pad to complete a block */
@@ -1315,7 +1957,7 @@ qint32 ZsyncWriterPrivate::submitSourceFile(QFile *file) {
         }
 
         /* Process the data in the buffer, and report progress */
-        submitSourceData( buf, len, start_in);
+        (this->*p_SubmitSourceData)(buf, len, start_in);
         {
             qint64 bytesReceived = n_BytesWritten,
                    bytesTotal = n_TargetFileLength;
@@ -1354,6 +1996,8 @@ qint32 ZsyncWriterPrivate::submitSourceFile(QFile *file) {
     p_TransferSpeed.reset(new QElapsedTimer);
     file->close();
     free(buf);
+    if (index && !error)
+        index->finishBuild();
     return error;
 }
 
@@ -1363,8 +2007,11 @@ qint32 ZsyncWriterPrivate::submitSourceFile(QFile *file) {
  * Returns non-zero if successful.
  */
 qint32 ZsyncWriterPrivate::buildHash() {
+    Tracer::Scope trace(this, "buildHash");
     zs_blockid id;
     qint32 i = 16;
+    QElapsedTimer timer;
+    timer.start();
 
     /* Try hash size of 2^i; step down the value of i until we find a good size
      */
@@ -1375,9 +2022,12 @@ qint32 ZsyncWriterPrivate::buildHash() {
 
     /* Allocate hash based on rsum */
     p_HashMask = (2 << i) - 1;
-    p_RsumHash = (hash_entry**)calloc(p_HashMask + 1, sizeof *(p_RsumHash));
+    p_RsumHash = (zs_blockid*)malloc((p_HashMask + 1) * sizeof *(p_RsumHash));
     if (!p_RsumHash)
         return 0;
+    for (quint32 h = 0; h <= p_HashMask; ++h) {
+        p_RsumHash[h] = NO_BLOCK;
+    }
 
     /* Allocate bit-table based on rsum */
     p_BitHashMask = (2 << (i + BITHASHBITS)) - 1;
@@ -1395,19 +2045,20 @@ qint32 ZsyncWriterPrivate::buildHash() {
      * That's improves our pattern of I/O when writing out identical blocks
      * once we are processing data; we will write them in order. */
     for (id = n_Blocks; id > 0;) {
-        /* Decrement the loop variable here, and get the hash entry. */
-        hash_entry *e = p_BlockHashes + (--id);
+        /* Decrement the loop variable here. */
+        --id;
 
-        /* Prepend to linked list for this hash entry */
-        unsigned h = calcRHash( e);
-        e->next = p_RsumHash[h & p_HashMask];
-        p_RsumHash[h & p_HashMask] = e;
+        /* Prepend to the hash chain for this block */
+        unsigned h = calcRHash(id);
+        p_BlockNext[id] = p_RsumHash[h & p_HashMask];
+        p_RsumHash[h & p_HashMask] = id;
 
         /* And set relevant bit in the p_BitHash to 1 */
         p_BitHash[(h & p_BitHashMask) >> 3] |= 1 << (h & 7);
 
         QCoreApplication::processEvents();
     }
+    n_HashBuildTime += timer.elapsed();
     return 1;
 }
 
@@ -1415,19 +2066,17 @@ qint32 ZsyncWriterPrivate::buildHash() {
  * returned in a hash lookup again (e.g. because we now have the data)
  */
 void ZsyncWriterPrivate::removeBlockFromHash(zs_blockid id) {
-    hash_entry *t = &(p_BlockHashes[id]);
+    zs_blockid *p = &(p_RsumHash[calcRHash(id) & p_HashMask]);
 
-    hash_entry **p = &(p_RsumHash[calcRHash(t) & p_HashMask]);
-
-    while (*p != NULL) {
-        if (*p == t) {
-            if (t == p_Rover) {
-                p_Rover = t->next;
+    while (*p != NO_BLOCK) {
+        if (*p == id) {
+            if (id == n_Rover) {
+                n_Rover = p_BlockNext[id];
             }
-            *p = (*p)->next;
+            *p = p_BlockNext[id];
             return;
         } else {
-            p = &((*p)->next);
+            p = &(p_BlockNext[*p]);
         }
         QCoreApplication::processEvents();
     }
@@ -1531,26 +2180,36 @@ zs_blockid ZsyncWriterPrivate::nextKnownBlock(zs_blockid x) {
     return p_Ranges[2*r];
 }
 
-/* Calculates the rsum hash table hash for the given hash entry. */
-unsigned ZsyncWriterPrivate::calcRHash(const hash_entry *const e) {
-    unsigned h = e[0].r.b;
+/* Calculates the rsum hash table hash for the given block. */
+unsigned ZsyncWriterPrivate::calcRHash(zs_blockid id) {
+    unsigned h = p_BlockRsums[id].b;
 
-    h ^= ((n_SeqMatches > 1) ? e[1].r.b
-          : e[0].r.a & p_WeakCheckSumMask) << BITHASHBITS;
+    h ^= ((n_SeqMatches > 1) ? p_BlockRsums[id + 1].b
+          : p_BlockRsums[id].a & p_WeakCheckSumMask) << BITHASHBITS;
 
     return h;
 }
 
-/* Returns the hash entry's blockid. */
-zs_blockid ZsyncWriterPrivate::getHashEntryBlockId(const hash_entry *e) {
-    return e - p_BlockHashes;
+/* Returns the strong checksum bytes of the given block. */
+const unsigned char *ZsyncWriterPrivate::blockChecksum(zs_blockid id) {
+    return p_BlockChecksums + (size_t)id * n_StrongCheckSumBytes;
+}
+
+/* Frees the block table. */
+void ZsyncWriterPrivate::freeBlockTable() {
+    free(p_BlockRsums);
+    free(p_BlockChecksums);
+    free(p_BlockNext);
+    p_BlockRsums = nullptr;
+    p_BlockChecksums = nullptr;
+    p_BlockNext = nullptr;
 }
 
 
 /* Writes the block range (inclusive) from the supplied buffer to the given
  * under-construction output file */
 void ZsyncWriterPrivate::writeBlocks(const unsigned char *data, zs_blockid bfrom, zs_blockid bto) {
-    if(!p_TargetFile->isOpen() || !p_TargetFile->autoRemove())
+    if(!b_DryRun && (!p_TargetFile->isOpen() || !p_TargetFile->autoRemove()))
         return;
 
     // Equation of length with
@@ -1564,10 +2223,14 @@ void ZsyncWriterPrivate::writeBlocks(const unsigned char *data, zs_blockid bfrom
     off_t len = ((off_t) (bto - bfrom + 1)) << n_BlockShift;
     off_t offset = ((off_t)bfrom) << n_BlockShift;
 
-    auto pos = p_TargetFile->pos();
-    p_TargetFile->seek(offset);
-    n_BytesWritten += p_TargetFile->write((char*)data, len);
-    p_TargetFile->seek(pos);
+    if(b_DryRun) {
+        n_BytesWritten += len; /* Only counted. */
+    } else {
+        auto pos = p_TargetFile->pos();
+        p_TargetFile->seek(offset);
+        n_BytesWritten += p_TargetFile->write((char*)data, len);
+        p_TargetFile->seek(pos);
+    }
 
     {
         /* Having written those blocks, discard them from the rsum hashes (as
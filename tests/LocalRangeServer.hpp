@@ -0,0 +1,308 @@
+#ifndef LOCAL_RANGE_SERVER_HPP_INCLUDED
+#define LOCAL_RANGE_SERVER_HPP_INCLUDED
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QHostAddress>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QTimer>
+#include <QUrl>
+
+// Serves files from memory over HTTP/1.1 on the loopback interface, with
+// single range requests, such that updates can be tested and measured
+// without the network. Latency, a bandwidth cap, failing requests and a
+// server without range support can be simulated.
+class LocalRangeServer : public QTcpServer {
+    Q_OBJECT
+
+    struct Response {
+        qint64 readyAt = 0; // ms since the server was started.
+        QByteArray head;
+        QString file;
+        qint64 offset = 0,
+               remaining = 0;
+        bool truncate = false; // close the connection after the remaining bytes.
+    };
+
+    struct Connection {
+        QByteArray request;
+        QList<Response> responses;
+    };
+
+    QHash<QString, QByteArray> m_Files;
+    QHash<QString, qint64> m_BytesSent;
+    QHash<QTcpSocket*, Connection> m_Connections;
+    QElapsedTimer m_Clock;
+    QTimer m_Ticker;
+    qint64 n_Latency = 0,
+           n_Bandwidth = 0,
+           n_Budget = 0,
+           n_LastTick = 0,
+           n_TotalBytesSent = 0;
+    qint32 n_Requests = 0,
+           n_FailEvery = 0,
+           n_FailCode = 503;
+    bool b_AcceptRanges = true;
+  public:
+    explicit LocalRangeServer(QObject *parent = nullptr)
+        : QTcpServer(parent) {
+        m_Ticker.setInterval(5);
+        connect(&m_Ticker, &QTimer::timeout, this, &LocalRangeServer::serve);
+    }
+
+    ~LocalRangeServer() {
+        m_Ticker.stop();
+        close();
+    }
+
+    // Listens on a free port of the loopback interface.
+    bool start() {
+        if(!listen(QHostAddress::LocalHost, 0)) {
+            return false;
+        }
+        m_Clock.start();
+        n_LastTick = 0;
+        m_Ticker.start();
+        return true;
+    }
+
+    QUrl url(const QString &name) const {
+        return QUrl(QString::fromUtf8("http://127.0.0.1:%1/%2").arg(serverPort()).arg(name));
+    }
+
+    void addFile(const QString &name, const QByteArray &contents) {
+        m_Files.insert(name, contents);
+    }
+
+    // Delay in ms before every response starts.
+    void setLatency(qint64 ms) {
+        n_Latency = ms;
+    }
+
+    // Bytes per second shared by all connections, 0 is unlimited.
+    void setBandwidth(qint64 bytesPerSecond) {
+        n_Bandwidth = bytesPerSecond;
+    }
+
+    // Without range support every request gets the entire file.
+    void setAcceptRanges(bool choice) {
+        b_AcceptRanges = choice;
+    }
+
+    // Fails every nth request with the given status code, a code of 0
+    // sends the headers and half of the body, then closes the connection.
+    void setFailEvery(qint32 n, qint32 code = 503) {
+        n_FailEvery = n;
+        n_FailCode = code;
+    }
+
+    qint32 requests() const {
+        return n_Requests;
+    }
+
+    // Bytes of response bodies sent for the given file.
+    qint64 bytesSent(const QString &name) const {
+        return m_BytesSent.value(name);
+    }
+
+    qint64 bytesSent() const {
+        return n_TotalBytesSent;
+    }
+
+    void resetCounters() {
+        n_Requests = 0;
+        n_TotalBytesSent = 0;
+        m_BytesSent.clear();
+    }
+
+  protected:
+    void incomingConnection(qintptr descriptor) override {
+        auto socket = new QTcpSocket(this);
+        if(!socket->setSocketDescriptor(descriptor)) {
+            delete socket;
+            return;
+        }
+        m_Connections.insert(socket, Connection());
+        connect(socket, &QTcpSocket::readyRead, this, &LocalRangeServer::handleReadyRead);
+        connect(socket, &QTcpSocket::disconnected, this, &LocalRangeServer::handleDisconnected);
+    }
+
+  private Q_SLOTS:
+    void handleReadyRead() {
+        auto socket = qobject_cast<QTcpSocket*>(QObject::sender());
+        if(!socket || !m_Connections.contains(socket)) {
+            return;
+        }
+
+        auto &connection = m_Connections[socket];
+        connection.request += socket->readAll();
+
+        int end = 0;
+        while((end = connection.request.indexOf("\r\n\r\n")) >= 0) {
+            auto head = connection.request.left(end);
+            connection.request.remove(0, end + 4);
+            connection.responses.append(respond(head));
+        }
+    }
+
+    void handleDisconnected() {
+        auto socket = qobject_cast<QTcpSocket*>(QObject::sender());
+        if(!socket) {
+            return;
+        }
+        m_Connections.remove(socket);
+        socket->deleteLater();
+    }
+
+    // Writes what the latency and the bandwidth allow.
+    void serve() {
+        qint64 now = m_Clock.elapsed();
+        if(n_Bandwidth > 0) {
+            n_Budget = qMin(n_Budget + n_Bandwidth * (now - n_LastTick) / 1000, qMax<qint64>(n_Bandwidth / 10, 1));
+        }
+        n_LastTick = now;
+
+        QList<QTcpSocket*> closing;
+        for(auto iter = m_Connections.begin(),
+                end = m_Connections.end();
+                iter != end;
+                ++iter) {
+            auto socket = iter.key();
+            auto &responses = iter.value().responses;
+            while(!responses.isEmpty() && responses.first().readyAt <= now &&
+                    socket->bytesToWrite() < 256 * 1024) {
+                auto &response = responses.first();
+                if(!response.head.isEmpty()) {
+                    socket->write(response.head);
+                    response.head.clear();
+                }
+
+                qint64 chunk = qMin<qint64>(response.remaining, 64 * 1024);
+                if(n_Bandwidth > 0) {
+                    chunk = qMin(chunk, n_Budget);
+                }
+                if(chunk > 0) {
+                    socket->write(m_Files[response.file].constData() + response.offset, chunk);
+                    response.offset += chunk;
+                    response.remaining -= chunk;
+                    m_BytesSent[response.file] += chunk;
+                    n_TotalBytesSent += chunk;
+                    if(n_Bandwidth > 0) {
+                        n_Budget -= chunk;
+                    }
+                }
+
+                if(response.remaining > 0) {
+                    break;
+                }
+                if(response.truncate) {
+                    responses.clear();
+                    closing.append(socket);
+                    break;
+                }
+                responses.removeFirst();
+            }
+        }
+
+        for(auto iter = closing.constBegin(),
+                end = closing.constEnd();
+                iter != end;
+                ++iter) {
+            (*iter)->disconnectFromHost();
+        }
+    }
+
+  private:
+    Response respond(const QByteArray &head) {
+        Response response;
+        response.readyAt = m_Clock.elapsed() + n_Latency;
+        ++n_Requests;
+
+        auto lines = head.split('\n');
+        auto requestLine = lines.value(0).trimmed().split(' ');
+        auto method = requestLine.value(0);
+        auto name = QUrl(QString::fromUtf8(requestLine.value(1))).path().mid(1);
+
+        QByteArray range;
+        for(int i = 1; i < lines.size(); ++i) {
+            auto line = lines.at(i).trimmed();
+            if(line.toLower().startsWith("range:")) {
+                range = line.mid(6).trimmed();
+            }
+        }
+
+        if(n_FailEvery > 0 && n_FailCode > 0 && n_Requests % n_FailEvery == 0) {
+            response.head = status(n_FailCode, "Injected Failure") + "Content-Length: 0\r\n\r\n";
+            return response;
+        }
+
+        if(method != "GET" && method != "HEAD") {
+            response.head = status(405, "Method Not Allowed") + "Content-Length: 0\r\n\r\n";
+            return response;
+        }
+        if(!m_Files.contains(name)) {
+            response.head = status(404, "Not Found") + "Content-Length: 0\r\n\r\n";
+            return response;
+        }
+
+        qint64 size = m_Files[name].size(),
+               from = 0,
+               to = size - 1;
+        bool partial = false;
+        if(b_AcceptRanges && range.startsWith("bytes=")) {
+            // Only the first range of the header is served.
+            auto bounds = range.mid(6).split(',').value(0).split('-');
+            auto first = bounds.value(0).trimmed(),
+                 last = bounds.value(1).trimmed();
+            if(first.isEmpty()) {
+                from = qMax<qint64>(0, size - last.toLongLong());
+            } else {
+                from = first.toLongLong();
+                if(!last.isEmpty()) {
+                    to = qMin(last.toLongLong(), size - 1);
+                }
+            }
+            if(from >= size || from > to) {
+                response.head = status(416, "Range Not Satisfiable") +
+                                "Content-Range: bytes */" + QByteArray::number(size) + "\r\n" +
+                                "Content-Length: 0\r\n\r\n";
+                return response;
+            }
+            partial = true;
+        }
+
+        auto length = to - from + 1;
+        response.head = partial ? status(206, "Partial Content") : status(200, "OK");
+        response.head += "Content-Type: application/octet-stream\r\n";
+        response.head += "Content-Length: " + QByteArray::number(length) + "\r\n";
+        if(partial) {
+            response.head += "Content-Range: bytes " + QByteArray::number(from) + "-" +
+                             QByteArray::number(to) + "/" + QByteArray::number(size) + "\r\n";
+        }
+        if(b_AcceptRanges) {
+            response.head += "Accept-Ranges: bytes\r\n";
+        }
+        response.head += "\r\n";
+
+        if(method == "GET") {
+            response.file = name;
+            response.offset = from;
+            response.remaining = length;
+            if(n_FailEvery > 0 && n_FailCode == 0 && n_Requests % n_FailEvery == 0) {
+                response.remaining = length / 2;
+                response.truncate = true;
+            }
+        }
+        return response;
+    }
+
+    static QByteArray status(qint32 code, const QByteArray &reason) {
+        return "HTTP/1.1 " + QByteArray::number(code) + " " + reason + "\r\n" +
+               "Connection: keep-alive\r\n";
+    }
+};
+
+#endif
@@ -4,16 +4,29 @@
 #include <QSignalSpy>
 #include <QTemporaryDir>
 #include <QAppImageUpdate>
+#include <ZsyncControlFileGenerator>
 #include <QScopedPointer>
 #include <QDebug>
 #include <QStringList>
 #include <QCoreApplication>
 #include <QJsonObject>
+#include <QJsonArray>
+#include <QJsonDocument>
 #include <QtConcurrent>
 #include <QFuture>
 #include <QEventLoop>
+#include <QStandardPaths>
+#include <QDir>
+#include <QVector>
+#include <QCryptographicHash>
 
 #include "SimpleDownload.hpp"
+#include "LocalRangeServer.hpp"
+#include "SyntheticAppImage.hpp"
+#include "bufferpool_p.hpp"
+#include "helpers_p.hpp"
+#include "seedindex_p.hpp"
+#include "updateengine_p.hpp"
 
 class QAppImageUpdateTests : public QObject {
     Q_OBJECT
@@ -586,6 +599,391 @@ class QAppImageUpdateTests : public QObject {
         QVERIFY(action == QAppImageUpdate::Action::Update);
     }
 
+    /// Exercises the range math for a target file larger than 4 GiB
+    //  without any network, using a sparse file as the target.
+    void largeTargetRangeMath(void) {
+        const qint32 blockSize = 4096;
+        const qint64 targetLength = Q_INT64_C(5) * 1024 * 1024 * 1024 + 123;
+
+        /// The last block is partial and starts past 4 GiB.
+        auto blocks = blockCount(targetLength, blockSize);
+        QCOMPARE(blocks, static_cast<qint32>(targetLength / blockSize) + 1);
+        qint64 lastBlockOffset = static_cast<qint64>(blocks - 1) * blockSize;
+        QVERIFY(lastBlockOffset > Q_INT64_C(4) * 1024 * 1024 * 1024);
+
+        QCOMPARE(makeRangeHeaderValue(blocks - 1, blocks, blockSize),
+                 QByteArray("bytes=") + QByteArray::number(lastBlockOffset) + "-" +
+                 QByteArray::number(lastBlockOffset + blockSize));
+        QCOMPARE(makeRangeHeaderValue(blocks - 1, blocks, blockSize, 100),
+                 QByteArray("bytes=") + QByteArray::number(lastBlockOffset + 100) + "-" +
+                 QByteArray::number(lastBlockOffset + blockSize));
+
+        /// A target which changed entirely is split into pieces which
+        //  cover it without gaps.
+        auto pieces = splitBlockRange(0, blocks, blockSize);
+        QVERIFY(pieces.size() > 1);
+        qint32 next = 0;
+        for(auto iter = pieces.constBegin(),
+                end = pieces.constEnd();
+                iter != end;
+                ++iter) {
+            QCOMPARE((*iter).first, next);
+            QVERIFY((*iter).second > (*iter).first);
+            QVERIFY(static_cast<qint64>((*iter).second - (*iter).first) * blockSize <= MAX_RANGE_BYTES);
+            next = (*iter).second;
+        }
+        QCOMPARE(next, blocks);
+
+        /// A full download is split into segments, but a small target
+        //  is not split into tiny ones.
+        QCOMPARE(splitBlockRange(0, 4096, blockSize, 8).size(), 8);
+        QCOMPARE(splitBlockRange(0, 300, blockSize, 8).size(), 2);
+        QCOMPARE(splitBlockRange(0, blocks, blockSize, 8).size(), pieces.size());
+
+        /// Write the last block of the sparse target at its offset and read it back.
+        QFile target(m_TempDir->path() + "/large-target.AppImage");
+        QVERIFY(target.open(QIODevice::ReadWrite));
+        if(!target.resize(targetLength)) {
+            target.remove();
+            QSKIP("Cannot create a sparse file larger than 4 GiB here");
+        }
+
+        QByteArray block(static_cast<int>(targetLength - lastBlockOffset), 'x');
+        QVERIFY(target.seek(lastBlockOffset));
+        QCOMPARE(target.write(block), static_cast<qint64>(block.size()));
+        QVERIFY(target.flush());
+        QCOMPARE(target.size(), targetLength);
+
+        QVERIFY(target.seek(lastBlockOffset));
+        QCOMPARE(target.read(block.size()), block);
+        target.close();
+        target.remove();
+    }
+
+    /// Range buffers, with the extra byte of the inclusive end, are handed
+    //  out again instead of allocated for every range.
+    void bufferPoolReusesRangeBuffers(void) {
+        const qint32 blockSize = 4096;
+        QList<int> sizes;
+        sizes << BufferPool::BufferSize / blockSize * blockSize + 1
+              << 100 * blockSize + 1
+              << MAX_RANGE_BYTES / blockSize * blockSize + 1;
+        for(auto iter = sizes.constBegin(),
+                end = sizes.constEnd();
+                iter != end;
+                ++iter) {
+            auto buffer = BufferPool::acquire(*iter);
+            QVERIFY(buffer->capacity() >= *iter);
+            buffer->resize(*iter);
+            BufferPool::release(buffer);
+
+            auto again = BufferPool::acquire(*iter);
+            QCOMPARE(again, buffer);
+            QCOMPARE(again->size(), 0);
+            QVERIFY(again->capacity() >= *iter);
+            BufferPool::release(again);
+        }
+    }
+
+    void seedIndexOverlap(void) {
+        QStandardPaths::setTestModeEnabled(true);
+        const qint32 blockSize = 1024;
+
+        /// 8 full blocks and a partial one.
+        QByteArray contents;
+        for(quint32 i = 0; i < 8 * blockSize + 100; ++i) {
+            contents.append(static_cast<char>((i * 2654435761u) >> 24));
+        }
+        QFile seed(m_TempDir->path() + "/seed.AppImage");
+        QVERIFY(seed.open(QIODevice::WriteOnly));
+        QCOMPARE(seed.write(contents), static_cast<qint64>(contents.size()));
+        seed.close();
+
+        /// The target has the first 4 blocks of the seed and 5 of its own.
+        QByteArray padded = contents + QByteArray(blockSize - 100, '\0');
+        QVector<rsum> target;
+        for(qint32 i = 0; i < 9; ++i) {
+            const unsigned char *block = reinterpret_cast<const unsigned char*>(padded.constData()) + i * blockSize;
+            target.append(calc_rsum_block(block, blockSize));
+            if(i >= 4) {
+                target[i].a ^= 0x5a5a;
+            }
+        }
+
+        SeedIndex index(seed.fileName(), blockSize);
+        QVERIFY(index.load());
+        QCOMPARE(index.blocks(), 9);
+        QCOMPARE(index.overlap(target.constData(), 4, 0xffff), 1.0);
+        QCOMPARE(index.overlap(target.constData(), 8, 0xffff), 0.5);
+
+        /// The cached index is used as long as the seed is unchanged, and
+        //  built again when it changed.
+        SeedIndex cached(seed.fileName(), blockSize);
+        QVERIFY(cached.load());
+        QCOMPARE(cached.blocks(), 9);
+        QCOMPARE(QByteArray(reinterpret_cast<const char*>(cached.checksum(1)), CHECKSUM_SIZE),
+                 QCryptographicHash::hash(contents.mid(blockSize, blockSize), QCryptographicHash::Md4));
+        QCOMPARE(QByteArray(reinterpret_cast<const char*>(cached.checksum(8)), CHECKSUM_SIZE),
+                 QCryptographicHash::hash(padded.mid(8 * blockSize), QCryptographicHash::Md4));
+
+        QVERIFY(seed.open(QIODevice::Append));
+        QCOMPARE(seed.write(QByteArray(blockSize, 'x')), static_cast<qint64>(blockSize));
+        seed.close();
+        SeedIndex changed(seed.fileName(), blockSize);
+        QVERIFY(changed.load());
+        QCOMPARE(changed.blocks(), 10);
+
+        /// An index fed in pieces which do not line up with the blocks is
+        //  the same as the one built by reading the seed, and is cached.
+        QDir(SeedIndex::cacheDirectory()).removeRecursively();
+        SeedIndex fed(seed.fileName(), blockSize);
+        QVERIFY(!fed.loadCached());
+        QVERIFY(fed.beginBuild());
+        QVERIFY(seed.open(QIODevice::ReadOnly));
+        auto data = seed.readAll();
+        seed.close();
+        for(int offset = 0; offset < data.size(); offset += 700) {
+            fed.addData(data.constData() + offset, qMin(700, data.size() - offset));
+        }
+        QVERIFY(fed.finishBuild());
+        QCOMPARE(fed.blocks(), 10);
+        SeedIndex reloaded(seed.fileName(), blockSize);
+        QVERIFY(reloaded.loadCached());
+        for(qint32 i = 0; i < 10; ++i) {
+            QCOMPARE(QByteArray(reinterpret_cast<const char*>(reloaded.checksum(i)), CHECKSUM_SIZE),
+                     QByteArray(reinterpret_cast<const char*>(changed.checksum(i)), CHECKSUM_SIZE));
+            QCOMPARE(reloaded.rsums()[i].a, changed.rsums()[i].a);
+            QCOMPARE(reloaded.rsums()[i].b, changed.rsums()[i].b);
+        }
+
+        seed.remove();
+        QDir(SeedIndex::cacheDirectory()).removeRecursively();
+    }
+
+    /// Updates a synthetic AppImage from a local server, so this needs
+    //  no network and fetches a known amount of data.
+    void actionUpdateLocal(void) {
+        LocalRangeServer server;
+        QVERIFY(server.start());
+        auto newVersion = addLocalUpdate(&server, 7);
+        auto oldPath = writeLocalAppImage("Synthetic-1.AppImage", 7);
+        QVERIFY(!oldPath.isEmpty());
+
+        QString tracePath = m_TempDir->path() + "/Synthetic-1.trace.json";
+        auto result = runLocalUpdate(oldPath, QAppImageUpdate::Action::Update, QList<QUrl>(), tracePath);
+        QCOMPARE(result["NewVersionSha1Hash"].toString().toUpper(),
+                 QString::fromLatin1(QCryptographicHash::hash(newVersion, QCryptographicHash::Sha1).toHex().toUpper()));
+
+        /// Only the changed part of the target is fetched.
+        QVERIFY(server.bytesSent("Synthetic.AppImage") < newVersion.size() / 4);
+
+        auto statistics = result["Statistics"].toObject();
+        QVERIFY(statistics["Requests"].toInt() > 0);
+        QVERIFY(!statistics["Seeds"].toArray().isEmpty());
+        QVERIFY(statistics["Timings"].toObject().contains("ControlFileFetch"));
+        QVERIFY(statistics["Timings"].toObject().contains("Download"));
+
+        /// The trace is written by the time finished is emitted.
+        QFile trace(tracePath);
+        QVERIFY(trace.open(QIODevice::ReadOnly));
+        QStringList traced;
+        auto events = QJsonDocument::fromJson(trace.readAll()).object()["traceEvents"].toArray();
+        for(auto iter = events.constBegin(),
+                end = events.constEnd();
+                iter != end;
+                ++iter) {
+            traced << (*iter).toObject()["name"].toString();
+        }
+        QVERIFY(traced.contains("getInfo"));
+        QVERIFY(traced.contains("handleControlFile"));
+        QVERIFY(traced.contains("RangeReply"));
+        QVERIFY(traced.contains("verifyAndConstructTargetFile"));
+        trace.remove();
+
+        QFile::remove(result["NewVersionPath"].toString());
+        QFile::remove(oldPath);
+    }
+
+    /// Replies which are cut off halfway are resumed from the last whole
+    //  block instead of being requested again from the start.
+    void actionUpdateLocalResume(void) {
+        LocalRangeServer server;
+        QVERIFY(server.start());
+        auto newVersion = addLocalUpdate(&server, 23);
+        auto oldPath = writeLocalAppImage("SyntheticResume-1.AppImage", 23);
+        server.setFailEvery(3, 0);
+
+        auto result = runLocalUpdate(oldPath);
+        QCOMPARE(result["NewVersionSha1Hash"].toString().toUpper(),
+                 QString::fromLatin1(QCryptographicHash::hash(newVersion, QCryptographicHash::Sha1).toHex().toUpper()));
+        auto statistics = result["Statistics"].toObject();
+        QVERIFY(statistics["Retries"].toInt() > 0);
+
+        /// Only the partial blocks of the cut off replies are fetched twice.
+        QVERIFY(server.bytesSent("Synthetic.AppImage") < newVersion.size() / 2);
+
+        QFile::remove(result["NewVersionPath"].toString());
+        QFile::remove(oldPath);
+    }
+
+    /// A server without range support gets the entire target file.
+    void actionUpdateLocalWithoutRanges(void) {
+        LocalRangeServer server;
+        QVERIFY(server.start());
+        auto newVersion = addLocalUpdate(&server, 29);
+        auto oldPath = writeLocalAppImage("SyntheticNoRanges-1.AppImage", 29);
+        server.setAcceptRanges(false);
+
+        auto result = runLocalUpdate(oldPath);
+        QCOMPARE(result["NewVersionSha1Hash"].toString().toUpper(),
+                 QString::fromLatin1(QCryptographicHash::hash(newVersion, QCryptographicHash::Sha1).toHex().toUpper()));
+        QVERIFY(server.bytesSent("Synthetic.AppImage") >= newVersion.size());
+
+        QFile::remove(result["NewVersionPath"].toString());
+        QFile::remove(oldPath);
+    }
+
+    /// When the target file url cannot be used, the ranges come from a
+    //  mirror which can.
+    void actionUpdateLocalMirror(void) {
+        LocalRangeServer server, mirror;
+        QVERIFY(server.start());
+        QVERIFY(mirror.start());
+        auto newVersion = addLocalUpdate(&server, 31);
+        auto oldPath = writeLocalAppImage("SyntheticMirror-1.AppImage", 31);
+
+        /// The length does not match the control file, so the target file
+        //  url is only probed.
+        server.addFile("Synthetic.AppImage", newVersion.left(newVersion.size() - 1));
+        mirror.addFile("Synthetic.AppImage", newVersion);
+
+        auto result = runLocalUpdate(oldPath, QAppImageUpdate::Action::Update,
+                                     QList<QUrl>() << mirror.url("Synthetic.AppImage"));
+        QCOMPARE(result["NewVersionSha1Hash"].toString().toUpper(),
+                 QString::fromLatin1(QCryptographicHash::hash(newVersion, QCryptographicHash::Sha1).toHex().toUpper()));
+        QVERIFY(server.bytesSent("Synthetic.AppImage") <= 2);
+        QVERIFY(mirror.bytesSent("Synthetic.AppImage") > 0);
+        QVERIFY(mirror.bytesSent("Synthetic.AppImage") < newVersion.size() / 4);
+
+        QFile::remove(result["NewVersionPath"].toString());
+        QFile::remove(oldPath);
+    }
+
+    /// A dry run plans the update without fetching any of the target,
+    //  and the update which follows fetches just what was planned.
+    void actionDryRunUpdateLocal(void) {
+        LocalRangeServer server;
+        QVERIFY(server.start());
+        auto newVersion = addLocalUpdate(&server, 17);
+        auto oldPath = writeLocalAppImage("SyntheticDryRun-1.AppImage", 17);
+        QVERIFY(!oldPath.isEmpty());
+
+        auto plan = runLocalUpdate(oldPath, QAppImageUpdate::Action::DryRunUpdate);
+        QVERIFY(!plan.isEmpty());
+
+        /// Nothing of the target is fetched or written.
+        QCOMPARE(server.bytesSent("Synthetic.AppImage"), Q_INT64_C(0));
+        QVERIFY(!QFile::exists(m_TempDir->path() + "/Synthetic.AppImage"));
+        QVERIFY(QDir(m_TempDir->path()).entryList(QStringList() << "Synthetic.AppImage.*.part").isEmpty());
+        QVERIFY(plan["DryRun"].toBool());
+        QVERIFY(!plan["FullDownload"].toBool());
+        QCOMPARE(plan["TargetFileLength"].toVariant().toLongLong(), static_cast<qint64>(newVersion.size()));
+
+        /// The ranges add up to the bytes to download, which is only the
+        //  changed part of the target.
+        auto ranges = plan["Ranges"].toArray();
+        QVERIFY(!ranges.isEmpty());
+        QCOMPARE(plan["Requests"].toInt(), ranges.size());
+        qint64 planned = 0;
+        qint32 blockSize = plan["BlockSize"].toInt();
+        for(auto iter = ranges.constBegin(),
+                end = ranges.constEnd();
+                iter != end;
+                ++iter) {
+            auto range = (*iter).toObject();
+            qint64 from = static_cast<qint64>(range["FromBlock"].toInt()) * blockSize,
+                   to = qMin(static_cast<qint64>(range["ToBlock"].toInt()) * blockSize,
+                             static_cast<qint64>(newVersion.size()) - 1);
+            QVERIFY(range["ToBlock"].toInt() > range["FromBlock"].toInt());
+            planned += to - from + 1;
+        }
+        auto bytesToDownload = plan["BytesToDownload"].toVariant().toLongLong();
+        QCOMPARE(planned, bytesToDownload);
+        QVERIFY(bytesToDownload < newVersion.size() / 4);
+        QVERIFY(plan["BytesReused"].toVariant().toLongLong() > 0);
+
+        QFile::remove(oldPath);
+    }
+
+    /// The request slots of the engine are handed out in turns once
+    //  the limit is reached.
+    void updateEngineRequestBudget(void) {
+        QObject first, second;
+        UpdateEngine::setMaxConcurrentRequests(1);
+        QVERIFY(UpdateEngine::acquireRequest(&first));
+        QVERIFY(!UpdateEngine::acquireRequest(&second));
+        QVERIFY(!UpdateEngine::acquireRequest(&first, /*wait=*/false));
+        QCOMPARE(UpdateEngine::requestsInFlight(), 1);
+
+        /// The slot goes to the one waiting in line.
+        UpdateEngine::releaseRequests(&first);
+        QCOMPARE(UpdateEngine::requestsInFlight(), 1);
+        QVERIFY(!UpdateEngine::acquireRequest(&first, /*wait=*/false));
+
+        UpdateEngine::withdraw(&second);
+        QCOMPARE(UpdateEngine::requestsInFlight(), 0);
+        UpdateEngine::setMaxConcurrentRequests(0);
+    }
+
+    /// The generated control file matches the reference one but for
+    //  the modification time, whatever the number of threads.
+    void zsyncControlFileGenerator(void) {
+        auto target = SyntheticAppImage::make("zsync|http://127.0.0.1/Synthetic.AppImage.zsync",
+                                              SyntheticAppImage::payload(3 * 1024 * 1024 + 123, 5));
+        QFile targetFile(m_TempDir->path() + "/Synthetic.AppImage");
+        QVERIFY(targetFile.open(QIODevice::WriteOnly));
+        QCOMPARE(targetFile.write(target), static_cast<qint64>(target.size()));
+        targetFile.close();
+
+        auto withoutMTime = [](QByteArray control) {
+            int from = control.indexOf("MTime: ");
+            return control.remove(from, control.indexOf('\n', from) - from + 1);
+        };
+        auto expected = withoutMTime(SyntheticAppImage::controlFile(target, "Synthetic.AppImage",
+                                     QUrl("http://127.0.0.1/Synthetic.AppImage")));
+
+        QList<int> threads;
+        threads << 1 << 4;
+        for(auto iter = threads.constBegin(),
+                end = threads.constEnd();
+                iter != end;
+                ++iter) {
+            ZsyncControlFileGenerator generator;
+            QSignalSpy spyError(&generator, SIGNAL(error(short)));
+            QSignalSpy spyInfo(&generator, SIGNAL(finished(QJsonObject)));
+            QEventLoop loop;
+            connect(&generator, &ZsyncControlFileGenerator::finished, &loop, &QEventLoop::quit, Qt::QueuedConnection);
+            connect(&generator, &ZsyncControlFileGenerator::error, &loop, &QEventLoop::quit, Qt::QueuedConnection);
+
+            generator.setTargetFile(targetFile.fileName());
+            generator.setTargetFileUrl("http://127.0.0.1/Synthetic.AppImage");
+            generator.setBlockSize(2048);
+            generator.setThreads(*iter);
+            generator.start();
+            loop.exec();
+
+            QCOMPARE(spyError.count(), 0);
+            QCOMPARE(spyInfo.count(), 1);
+            auto result = spyInfo.takeFirst().at(0).toJsonObject();
+            QCOMPARE(result["Threads"].toInt(), *iter);
+            QFile control(result["ControlFilePath"].toString());
+            QVERIFY(control.open(QIODevice::ReadOnly));
+            QVERIFY(withoutMTime(control.readAll()) == expected);
+            control.remove();
+        }
+        targetFile.remove();
+    }
+
     void cleanupTestCase(void) {
         m_TempDir->remove();
         emit finished();
@@ -599,6 +997,57 @@ class QAppImageUpdateTests : public QObject {
         QFAIL(QTest::toString(scode));
         return;
     }
+  private:
+    /// Serves the control file and a new version of the synthetic AppImage
+    //  for the given seed, and returns the new version.
+    QByteArray addLocalUpdate(LocalRangeServer *server, quint32 seed) {
+        auto updateInformation = "zsync|" + server->url("Synthetic.AppImage.zsync").toEncoded();
+        auto oldPayload = SyntheticAppImage::payload(2 * 1024 * 1024, seed);
+        auto newVersion = SyntheticAppImage::make(updateInformation,
+                          SyntheticAppImage::change(oldPayload, 0.05, seed + 1));
+        server->addFile("Synthetic.AppImage", newVersion);
+        server->addFile("Synthetic.AppImage.zsync",
+                        SyntheticAppImage::controlFile(newVersion, "Synthetic.AppImage",
+                                server->url("Synthetic.AppImage")));
+        m_UpdateInformation = updateInformation;
+        return newVersion;
+    }
+
+    /// Writes the old version for the seed of the last addLocalUpdate.
+    QString writeLocalAppImage(const QString &name, quint32 seed) {
+        auto oldVersion = SyntheticAppImage::make(m_UpdateInformation,
+                          SyntheticAppImage::payload(2 * 1024 * 1024, seed));
+        QFile oldFile(m_TempDir->path() + "/" + name);
+        if(!oldFile.open(QIODevice::WriteOnly) || oldFile.write(oldVersion) != oldVersion.size()) {
+            return QString();
+        }
+        return oldFile.fileName();
+    }
+
+    /// Runs the given action on the AppImage and returns what finished gave.
+    QJsonObject runLocalUpdate(const QString &appImage, short action = QAppImageUpdate::Action::Update,
+                               const QList<QUrl> &mirrors = QList<QUrl>(), const QString &traceFile = QString()) {
+        QAppImageUpdate updater;
+        connect(&updater, &QAppImageUpdate::error, this, &QAppImageUpdateTests::defaultErrorHandler);
+        QSignalSpy spyInfo(&updater, SIGNAL(finished(QJsonObject, short)));
+        QEventLoop loop;
+        connect(&updater, &QAppImageUpdate::finished, &loop, &QEventLoop::quit, Qt::QueuedConnection);
+        connect(&updater, &QAppImageUpdate::error, &loop, &QEventLoop::quit, Qt::QueuedConnection);
+
+        updater.setAppImage(appImage);
+        updater.setMirrors(mirrors);
+        if(!traceFile.isEmpty()) {
+            updater.setTraceFile(traceFile);
+        }
+        updater.start(action);
+        loop.exec();
+        if(spyInfo.count() != 1) {
+            return QJsonObject();
+        }
+        return spyInfo.takeFirst().at(0).toJsonObject();
+    }
+
+    QByteArray m_UpdateInformation;
   Q_SIGNALS:
     void finished(void);
 };
@@ -0,0 +1,145 @@
+#ifndef SYNTHETIC_APPIMAGE_HPP_INCLUDED
+#define SYNTHETIC_APPIMAGE_HPP_INCLUDED
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QLocale>
+#include <QString>
+#include <QUrl>
+#include <QtEndian>
+#include <cmath>
+#include <cstring>
+
+#include "zsyncinternalstructures_p.hpp"
+
+// Builds type 2 AppImages which are just an ELF header with the update
+// information section followed by a payload, and the zsync control files
+// for them, such that updates can be done against a local server.
+class SyntheticAppImage {
+  public:
+    // The payload starts at this offset of the AppImage.
+    static constexpr qint64 HeaderSize = 4096;
+
+    static QByteArray make(const QByteArray &updateInformation, const QByteArray &payload) {
+        const QByteArray names("\0.upd_info\0.shstrtab\0", 21);
+        const qint64 updInfoOffset = 64,
+                     updInfoSize = 512,
+                     namesOffset = updInfoOffset + updInfoSize,
+                     sectionsOffset = (namesOffset + names.size() + 7) & ~7;
+
+        QByteArray image(HeaderSize, '\0');
+        auto data = reinterpret_cast<uchar*>(image.data());
+
+        // ELF identification with the AppImage type 2 magic in its padding.
+        memcpy(data, "\x7f" "ELF", 4);
+        data[4] = 2; // 64 bits.
+        data[5] = 1; // little endian.
+        data[6] = 1;
+        data[8] = 'A';
+        data[9] = 'I';
+        data[10] = 2;
+        qToLittleEndian<quint16>(2, data + 16); // executable.
+        qToLittleEndian<quint16>(62, data + 18); // x86_64.
+        qToLittleEndian<quint32>(1, data + 20);
+        qToLittleEndian<quint64>(sectionsOffset, data + 40);
+        qToLittleEndian<quint16>(64, data + 52);
+        qToLittleEndian<quint16>(64, data + 58);
+        qToLittleEndian<quint16>(3, data + 60);
+        qToLittleEndian<quint16>(2, data + 62);
+
+        memcpy(data + updInfoOffset, updateInformation.constData(),
+               qMin<qint64>(updateInformation.size(), updInfoSize - 1));
+        memcpy(data + namesOffset, names.constData(), names.size());
+
+        // The first section header is the null one.
+        writeSection(data + sectionsOffset + 64, 1, 7, updInfoOffset, updInfoSize);
+        writeSection(data + sectionsOffset + 128, 11, 3, namesOffset, names.size());
+        return image + payload;
+    }
+
+    // Deterministic bytes which do not repeat in blocks.
+    static QByteArray payload(qint64 size, quint32 seed) {
+        QByteArray data(static_cast<int>(size), '\0');
+        quint32 state = seed ? seed : 1;
+        for(qint64 i = 0; i < size; ++i) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            data[static_cast<int>(i)] = static_cast<char>(state >> 24);
+        }
+        return data;
+    }
+
+    // Changes about the given fraction of the payload in runs of chunk bytes
+    // and inserts a few bytes in the middle, such that the rest of the
+    // payload is no longer aligned to the blocks.
+    static QByteArray change(const QByteArray &old, double fraction, quint32 seed, qint32 chunk = 4096) {
+        QByteArray data(old);
+        qint32 chunks = data.size() / chunk;
+        qint32 changed = static_cast<qint32>(std::ceil(chunks * fraction));
+        if(changed >= chunks) {
+            return payload(data.size(), seed);
+        }
+        auto noise = payload(static_cast<qint64>(changed) * chunk, seed);
+
+        quint32 state = seed ? seed : 1;
+        for(qint32 i = 0; i < changed; ++i) {
+            state = state * 1664525u + 1013904223u;
+            qint32 at = static_cast<qint32>(state % static_cast<quint32>(chunks));
+            memcpy(data.data() + static_cast<qint64>(at) * chunk, noise.constData() + static_cast<qint64>(i) * chunk, chunk);
+        }
+        if(fraction > 0) {
+            data.insert(data.size() / 2, payload(123, seed + 1));
+        }
+        return data;
+    }
+
+    // A control file with the hash lengths zsyncmake would choose.
+    static QByteArray controlFile(const QByteArray &target, const QString &fileName,
+                                  const QUrl &url, qint32 blockSize = 2048) {
+        double length = qMax(1, target.size()),
+               blocks = qMax(1, target.size()) / blockSize; // whole blocks, as zsyncmake counts them.
+        qint32 seqMatches = length > blockSize ? 2 : 1;
+        qint32 weakBytes = static_cast<qint32>(std::ceil(((std::log(length) + std::log(blockSize)) / std::log(2) - 8.6) / seqMatches / 8));
+        weakBytes = qBound(2, weakBytes, 4);
+        qint32 strongBytes = static_cast<qint32>(std::ceil((20 + (std::log(length) + std::log(1 + blocks)) / std::log(2)) / seqMatches / 8));
+        strongBytes = qBound(static_cast<qint32>((7.9 + (20 + std::log(1 + blocks) / std::log(2))) / 8), strongBytes, 16);
+
+        QByteArray control;
+        control += "zsync: 0.6.2\n";
+        control += "Filename: " + fileName.toUtf8() + "\n";
+        control += "MTime: " + QLocale(QLocale::English, QLocale::UnitedStates)
+                   .toString(QDateTime::currentDateTimeUtc(), "ddd, dd MMM yyyy HH:mm:ss").toUtf8() + " +0000\n";
+        control += "Blocksize: " + QByteArray::number(blockSize) + "\n";
+        control += "Length: " + QByteArray::number(target.size()) + "\n";
+        control += "Hash-Lengths: " + QByteArray::number(seqMatches) + "," +
+                   QByteArray::number(weakBytes) + "," + QByteArray::number(strongBytes) + "\n";
+        control += "URL: " + url.toEncoded() + "\n";
+        control += "SHA-1: " + QCryptographicHash::hash(target, QCryptographicHash::Sha1).toHex() + "\n\n";
+
+        // The last block is padded with zeros.
+        for(qint64 offset = 0; offset < target.size(); offset += blockSize) {
+            QByteArray block = target.mid(static_cast<int>(offset), blockSize);
+            block.append(QByteArray(blockSize - block.size(), '\0'));
+
+            rsum r = calc_rsum_block(reinterpret_cast<const unsigned char*>(block.constData()), blockSize);
+            uchar weak[4];
+            qToBigEndian<quint16>(r.a, weak);
+            qToBigEndian<quint16>(r.b, weak + 2);
+            control.append(reinterpret_cast<const char*>(weak) + 4 - weakBytes, weakBytes);
+            control.append(QCryptographicHash::hash(block, QCryptographicHash::Md4).left(strongBytes));
+        }
+        return control;
+    }
+
+  private:
+    static void writeSection(uchar *header, quint32 name, quint32 type, quint64 offset, quint64 size) {
+        qToLittleEndian<quint32>(name, header);
+        qToLittleEndian<quint32>(type, header + 4);
+        qToLittleEndian<quint64>(offset, header + 24);
+        qToLittleEndian<quint64>(size, header + 32);
+        qToLittleEndian<quint64>(1, header + 48);
+    }
+};
+
+#endif
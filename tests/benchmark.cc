@@ -0,0 +1,167 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QJsonObject>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QAppImageUpdate>
+#include <sys/resource.h>
+
+#include "LocalRangeServer.hpp"
+#include "SyntheticAppImage.hpp"
+
+// Runs check for update and update end to end against a local server for
+// synthetic old and new AppImages, and reports the wall time, the bytes
+// fetched and the peak resident set size of every run.
+
+struct Scenario {
+    QString name;
+    double changed;
+    bool acceptRanges;
+};
+
+struct Measurement {
+    bool ok = false;
+    qint64 ms = 0,
+           bytes = 0;
+    qint32 requests = 0;
+    qint64 peakRss = 0; // KiB.
+};
+
+// Starts the peak resident set size over from the current one, such that
+// every run reports its own peak instead of the one of the process.
+static bool resetPeakRss() {
+    QFile clearRefs("/proc/self/clear_refs");
+    return clearRefs.open(QIODevice::WriteOnly) && clearRefs.write("5") == 1;
+}
+
+static qint64 peakRssKiB() {
+    QFile status("/proc/self/status");
+    if(status.open(QIODevice::ReadOnly)) {
+        for(auto line = status.readLine(); !line.isEmpty(); line = status.readLine()) {
+            if(line.startsWith("VmHWM:")) {
+                return line.mid(6).trimmed().split(' ').value(0).toLongLong();
+            }
+        }
+    }
+
+    // Without procfs only the peak of the entire process is known.
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+    return usage.ru_maxrss; // KiB on Linux.
+}
+
+static Measurement run(LocalRangeServer *server, const QString &appImage, short action) {
+    Measurement measurement;
+    resetPeakRss();
+    QAppImageUpdate updater;
+    QEventLoop loop;
+    QObject::connect(&updater, &QAppImageUpdate::finished, &loop, &QEventLoop::quit, Qt::QueuedConnection);
+    QObject::connect(&updater, &QAppImageUpdate::error, &loop, &QEventLoop::quit, Qt::QueuedConnection);
+
+    QJsonObject result;
+    bool failed = false;
+    QObject::connect(&updater, &QAppImageUpdate::finished, [&result](QJsonObject info, short) {
+        result = info;
+    });
+    QObject::connect(&updater, &QAppImageUpdate::error, [&failed](short code, short) {
+        failed = true;
+        QTextStream(stderr) << "error: " << QAppImageUpdate::errorCodeToString(code) << "\n";
+    });
+
+    server->resetCounters();
+    QElapsedTimer timer;
+    timer.start();
+    updater.setAppImage(appImage);
+    updater.start(action);
+    loop.exec();
+
+    measurement.ms = timer.elapsed();
+    measurement.bytes = server->bytesSent();
+    measurement.requests = server->requests();
+    measurement.ok = !failed;
+    measurement.peakRss = peakRssKiB();
+    if(action == QAppImageUpdate::Action::Update && !failed) {
+        QFile::remove(result["NewVersionPath"].toString());
+    }
+    return measurement;
+}
+
+int main(int argc, char **argv) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("QAppImageUpdateBenchmark");
+    QStandardPaths::setTestModeEnabled(true); // keeps the seed index cache out of the user's.
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("End to end update benchmark against a local server.");
+    parser.addHelpOption();
+    QCommandLineOption sizeOption("size", "Payload size in MiB.", "MiB", "32");
+    QCommandLineOption blockSizeOption("block-size", "Block size of the control file.", "bytes", "2048");
+    QCommandLineOption latencyOption("latency", "Latency of every response in ms.", "ms", "0");
+    QCommandLineOption bandwidthOption("bandwidth", "Bandwidth cap in KiB/s, 0 is unlimited.", "KiB/s", "0");
+    QCommandLineOption failOption("fail-every", "Fail every nth request with 503, 0 never.", "n", "0");
+    parser.addOption(sizeOption);
+    parser.addOption(blockSizeOption);
+    parser.addOption(latencyOption);
+    parser.addOption(bandwidthOption);
+    parser.addOption(failOption);
+    parser.process(app);
+
+    QTemporaryDir dir;
+    LocalRangeServer server;
+    if(!dir.isValid() || !server.start()) {
+        QTextStream(stderr) << "cannot set up the benchmark\n";
+        return 1;
+    }
+    server.setLatency(parser.value(latencyOption).toLongLong());
+    server.setBandwidth(parser.value(bandwidthOption).toLongLong() * 1024);
+    server.setFailEvery(parser.value(failOption).toInt());
+
+    auto updateInformation = "zsync|" + server.url("Benchmark.AppImage.zsync").toEncoded();
+    auto oldPayload = SyntheticAppImage::payload(parser.value(sizeOption).toLongLong() * 1024 * 1024, 7);
+    auto oldVersion = SyntheticAppImage::make(updateInformation, oldPayload);
+    QString oldPath = dir.path() + "/Benchmark-1.AppImage";
+    {
+        QFile file(oldPath);
+        if(!file.open(QIODevice::WriteOnly) || file.write(oldVersion) != oldVersion.size()) {
+            QTextStream(stderr) << "cannot write " << oldPath << "\n";
+            return 1;
+        }
+    }
+
+    QList<Scenario> scenarios;
+    scenarios << Scenario({ "1% changed", 0.01, true })
+              << Scenario({ "10% changed", 0.10, true })
+              << Scenario({ "all changed", 1.0, true })
+              << Scenario({ "10% changed, no ranges", 0.10, false });
+
+    QTextStream out(stdout);
+    out << "scenario,action,ok,wall ms,bytes fetched,requests,peak rss KiB\n";
+    for(auto iter = scenarios.constBegin(),
+            end = scenarios.constEnd();
+            iter != end;
+            ++iter) {
+        auto newVersion = SyntheticAppImage::make(updateInformation,
+                          SyntheticAppImage::change(oldPayload, (*iter).changed, 11));
+        server.setAcceptRanges((*iter).acceptRanges);
+        server.addFile("Benchmark.AppImage", newVersion);
+        server.addFile("Benchmark.AppImage.zsync",
+                       SyntheticAppImage::controlFile(newVersion, "Benchmark.AppImage",
+                               server.url("Benchmark.AppImage"),
+                               parser.value(blockSizeOption).toInt()));
+
+        auto check = run(&server, oldPath, QAppImageUpdate::Action::CheckForUpdate);
+        out << (*iter).name << ",check," << check.ok << "," << check.ms << ","
+            << check.bytes << "," << check.requests << "," << check.peakRss << "\n";
+        auto update = run(&server, oldPath, QAppImageUpdate::Action::Update);
+        out << (*iter).name << ",update," << update.ok << "," << update.ms << ","
+            << update.bytes << "," << update.requests << "," << update.peakRss << "\n";
+        out.flush();
+    }
+    return 0;
+}
@@ -0,0 +1,6 @@
+include(../QAppImageUpdate.pri)
+INCLUDEPATH += .
+CONFIG += release
+TARGET = benchmark
+SOURCES += benchmark.cc
+HEADERS += LocalRangeServer.hpp SyntheticAppImage.hpp
@@ -4,7 +4,7 @@ CONFIG += release
 TARGET = tests
 QT += testlib concurrent
 SOURCES += main.cc
-HEADERS += QAppImageUpdateTests.hpp SimpleDownload.hpp
+HEADERS += QAppImageUpdateTests.hpp SimpleDownload.hpp LocalRangeServer.hpp SyntheticAppImage.hpp
 
 QUICK_TEST {
 	DEFINES += QUICK_TEST
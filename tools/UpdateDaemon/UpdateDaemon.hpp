@@ -0,0 +1,384 @@
+#ifndef UPDATE_DAEMON_HPP_INCLUDED
+#define UPDATE_DAEMON_HPP_INCLUDED
+#include <QByteArray>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QHash>
+#include <QList>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QString>
+#include <QStringList>
+#include <QAppImageUpdate>
+
+// Serves check for update and update requests of local clients over a
+// Unix domain socket. Every request and every reply is a JSON object on a
+// line of its own, the progress of a request is streamed back until it
+// finishes, fails or is canceled.
+//
+// All updaters of the daemon share the network and file threads, the
+// connections and the SHA-1s of local files, and the results of checks are
+// kept until the AppImage changes or they expire, such that repeated
+// checks of the same AppImage are answered without the network.
+//
+// Requests for an AppImage which already has the same action running are
+// attached to that job, and an update or a dry run is refused while the
+// other one runs for the same AppImage, since both work on its partial
+// target file.
+class UpdateDaemon : public QObject {
+    Q_OBJECT
+
+    struct Client {
+        QLocalSocket *socket = nullptr;
+        QJsonValue id;
+    };
+
+    struct Job {
+        QList<Client> clients;
+        QString path;
+        short action = QAppImageUpdate::Action::None;
+        bool canceled = false; // nobody waits for it anymore.
+    };
+
+    struct CachedCheck {
+        qint64 size = 0;
+        QDateTime modified;
+        qint64 checkedAt = 0; // ms since the daemon was started.
+        QJsonObject result;
+    };
+
+    QLocalServer m_Server;
+    QElapsedTimer m_Clock;
+    QHash<QLocalSocket*, QByteArray> m_Buffers;
+    QHash<QAppImageUpdate*, Job> m_Jobs;
+    QHash<QString, CachedCheck> m_Checks;
+    qint64 n_CacheTtl = 5 * 60 * 1000;
+    QString s_Error;
+  public:
+    explicit UpdateDaemon(QObject *parent = nullptr)
+        : QObject(parent) {
+        m_Clock.start();
+        connect(&m_Server, &QLocalServer::newConnection, this, &UpdateDaemon::handleNewConnection);
+    }
+
+    ~UpdateDaemon() {
+        m_Server.close();
+        auto updaters = m_Jobs.keys();
+        m_Jobs.clear();
+        qDeleteAll(updaters);
+    }
+
+    // Fails when another daemon answers on the socket, otherwise a stale
+    // socket of a daemon which did not exit cleanly is removed.
+    bool listen(const QString &name) {
+        s_Error.clear();
+        QLocalSocket probe;
+        probe.connectToServer(name);
+        if(probe.waitForConnected(1000)) {
+            probe.disconnectFromServer();
+            s_Error = QString::fromUtf8("another daemon is listening on ") + name;
+            return false;
+        }
+
+        QLocalServer::removeServer(name);
+        m_Server.setSocketOptions(QLocalServer::UserAccessOption);
+        return m_Server.listen(name);
+    }
+
+    QString serverName() const {
+        return m_Server.fullServerName();
+    }
+
+    QString errorString() const {
+        if(!s_Error.isEmpty()) {
+            return s_Error;
+        }
+        return m_Server.errorString();
+    }
+
+    // How long the result of a check is reused in ms, 0 never reuses it.
+    void setCacheTtl(qint64 ms) {
+        n_CacheTtl = ms;
+    }
+
+  private Q_SLOTS:
+    void handleNewConnection() {
+        while(m_Server.hasPendingConnections()) {
+            auto client = m_Server.nextPendingConnection();
+            m_Buffers.insert(client, QByteArray());
+            connect(client, &QLocalSocket::readyRead, this, &UpdateDaemon::handleReadyRead);
+            connect(client, &QLocalSocket::disconnected, this, &UpdateDaemon::handleDisconnected);
+        }
+    }
+
+    void handleReadyRead() {
+        auto client = qobject_cast<QLocalSocket*>(QObject::sender());
+        if(!client || !m_Buffers.contains(client)) {
+            return;
+        }
+
+        auto &buffer = m_Buffers[client];
+        buffer += client->readAll();
+
+        int end = 0;
+        while((end = buffer.indexOf('\n')) >= 0) {
+            auto line = buffer.left(end).trimmed();
+            buffer.remove(0, end + 1);
+            if(line.isEmpty()) {
+                continue;
+            }
+
+            QJsonParseError parseError;
+            auto request = QJsonDocument::fromJson(line, &parseError);
+            if(parseError.error != QJsonParseError::NoError || !request.isObject()) {
+                QJsonObject reply {
+                    { "event", "error" },
+                    { "message", "request is not a JSON object" }
+                };
+                send(client, reply);
+                continue;
+            }
+            handleRequest(client, request.object());
+        }
+    }
+
+    // The requests of a client which went away are canceled.
+    void handleDisconnected() {
+        auto client = qobject_cast<QLocalSocket*>(QObject::sender());
+        if(!client) {
+            return;
+        }
+        m_Buffers.remove(client);
+        detach(client, QJsonValue(), /*anyId=*/true);
+        client->deleteLater();
+    }
+
+  private:
+    void handleRequest(QLocalSocket *client, const QJsonObject &request) {
+        auto id = request["id"];
+        auto name = request["action"].toString();
+
+        if(name == "cancel") {
+            detach(client, id, /*anyId=*/false);
+            return;
+        }
+
+        short action = QAppImageUpdate::Action::None;
+        if(name == "info") {
+            action = QAppImageUpdate::Action::GetEmbeddedInfo;
+        } else if(name == "check") {
+            action = QAppImageUpdate::Action::CheckForUpdate;
+        } else if(name == "update") {
+            action = QAppImageUpdate::Action::Update;
+        } else if(name == "dry-run") {
+            action = QAppImageUpdate::Action::DryRunUpdate;
+        } else {
+            sendError(client, id, QAppImageUpdate::Error::InvalidAction);
+            return;
+        }
+
+        if(request["appimage"].toString().isEmpty()) {
+            sendError(client, id, QAppImageUpdate::Error::NoAppimagePathGiven);
+            return;
+        }
+        QFileInfo info(request["appimage"].toString());
+        if(!info.exists()) {
+            sendError(client, id, QAppImageUpdate::Error::AppimageNotFound);
+            return;
+        }
+        auto path = info.absoluteFilePath();
+
+        for(auto iter = m_Jobs.begin(),
+                end = m_Jobs.end();
+                iter != end;
+                ++iter) {
+            if(iter.value().path != path) {
+                continue;
+            }
+            if(iter.value().action == action && !iter.value().canceled) {
+                Client attached;
+                attached.socket = client;
+                attached.id = id;
+                iter.value().clients.append(attached);
+                send(client, QJsonObject { { "id", id }, { "event", "started" } });
+                return;
+            }
+            if(writesTarget(action) && writesTarget(iter.value().action)) {
+                QJsonObject reply {
+                    { "id", id },
+                    { "event", "error" },
+                    { "message", "another update of this AppImage is running" }
+                };
+                send(client, reply);
+                return;
+            }
+        }
+
+        if(action == QAppImageUpdate::Action::CheckForUpdate && !request["force"].toBool()) {
+            auto iter = m_Checks.constFind(path);
+            if(iter != m_Checks.constEnd() &&
+                    iter.value().size == info.size() &&
+                    iter.value().modified == info.lastModified() &&
+                    m_Clock.elapsed() - iter.value().checkedAt < n_CacheTtl) {
+                auto result = iter.value().result;
+                result["Cached"] = true;
+                QJsonObject reply {
+                    { "id", id },
+                    { "event", "finished" },
+                    { "result", result }
+                };
+                send(client, reply);
+                return;
+            }
+        }
+
+        // Not single threaded, such that the updater uses the threads and
+        // the caches shared by the daemon.
+        auto updater = new QAppImageUpdate(path, /*singleThreaded=*/false);
+        if(request.contains("outputDirectory")) {
+            updater->setOutputDirectory(request["outputDirectory"].toString());
+        }
+        if(request.contains("seedDirectories")) {
+            QStringList seeds;
+            auto list = request["seedDirectories"].toArray();
+            for(auto iter = list.constBegin(),
+                    end = list.constEnd();
+                    iter != end;
+                    ++iter) {
+                seeds << (*iter).toString();
+            }
+            updater->setSeedDirectories(seeds);
+        }
+
+        Client first;
+        first.socket = client;
+        first.id = id;
+        Job job;
+        job.clients.append(first);
+        job.path = path;
+        job.action = action;
+        m_Jobs.insert(updater, job);
+
+        connect(updater, &QAppImageUpdate::started, [this, updater](short) {
+            sendEvent(updater, QJsonObject { { "event", "started" } });
+        });
+        connect(updater, &QAppImageUpdate::progress,
+        [this, updater](int percentage, qint64 received, qint64 total, double speed, QString units, short) {
+            QJsonObject reply {
+                { "event", "progress" },
+                { "percentage", percentage },
+                { "bytesReceived", received },
+                { "bytesTotal", total },
+                { "speed", speed },
+                { "units", units }
+            };
+            sendEvent(updater, reply);
+        });
+        connect(updater, &QAppImageUpdate::finished, [this, updater](QJsonObject result, short action) {
+            if(action == QAppImageUpdate::Action::CheckForUpdate) {
+                cacheCheck(m_Jobs.value(updater).path, result);
+            } else if(action == QAppImageUpdate::Action::Update) {
+                m_Checks.remove(m_Jobs.value(updater).path);
+            }
+            sendEvent(updater, QJsonObject { { "event", "finished" }, { "result", result } });
+            finishJob(updater);
+        });
+        connect(updater, &QAppImageUpdate::error, [this, updater](short code, short) {
+            QJsonObject reply {
+                { "event", "error" },
+                { "code", code },
+                { "message", QAppImageUpdate::errorCodeToString(code) }
+            };
+            sendEvent(updater, reply);
+            finishJob(updater);
+        });
+        connect(updater, &QAppImageUpdate::canceled, [this, updater](short) {
+            sendEvent(updater, QJsonObject { { "event", "canceled" } });
+            finishJob(updater);
+        });
+        updater->start(action);
+    }
+
+    // Keeps the result along with what identifies the AppImage it was
+    // checked for.
+    void cacheCheck(const QString &path, const QJsonObject &result) {
+        QFileInfo info(path);
+        if(n_CacheTtl <= 0 || !info.exists()) {
+            return;
+        }
+        CachedCheck check;
+        check.size = info.size();
+        check.modified = info.lastModified();
+        check.checkedAt = m_Clock.elapsed();
+        check.result = result;
+        m_Checks.insert(path, check);
+    }
+
+    // Both use and remove the partial target file of the AppImage.
+    static bool writesTarget(short action) {
+        return action == QAppImageUpdate::Action::Update ||
+               action == QAppImageUpdate::Action::DryRunUpdate;
+    }
+
+    // Takes the client off the jobs it waits for, the job is canceled once
+    // nobody waits for it.
+    void detach(QLocalSocket *client, const QJsonValue &id, bool anyId) {
+        for(auto iter = m_Jobs.begin(),
+                end = m_Jobs.end();
+                iter != end;
+                ++iter) {
+            auto &clients = iter.value().clients;
+            bool detached = false;
+            for(int i = clients.size() - 1; i >= 0; --i) {
+                if(clients.at(i).socket == client && (anyId || clients.at(i).id == id)) {
+                    clients.removeAt(i);
+                    detached = true;
+                }
+            }
+            if(detached && clients.isEmpty() && !iter.value().canceled) {
+                iter.value().canceled = true;
+                iter.key()->cancel();
+            }
+        }
+    }
+
+    void finishJob(QAppImageUpdate *updater) {
+        if(m_Jobs.remove(updater)) {
+            updater->deleteLater();
+        }
+    }
+
+    void sendEvent(QAppImageUpdate *updater, QJsonObject reply) {
+        auto iter = m_Jobs.constFind(updater);
+        if(iter == m_Jobs.constEnd()) {
+            return;
+        }
+        for(auto client = iter.value().clients.constBegin(),
+                end = iter.value().clients.constEnd();
+                client != end;
+                ++client) {
+            reply["id"] = (*client).id;
+            send((*client).socket, reply);
+        }
+    }
+
+    void sendError(QLocalSocket *client, const QJsonValue &id, short code) {
+        QJsonObject reply {
+            { "id", id },
+            { "event", "error" },
+            { "code", code },
+            { "message", QAppImageUpdate::errorCodeToString(code) }
+        };
+        send(client, reply);
+    }
+
+    void send(QLocalSocket *client, const QJsonObject &reply) {
+        client->write(QJsonDocument(reply).toJson(QJsonDocument::Compact) + '\n');
+    }
+};
+
+#endif
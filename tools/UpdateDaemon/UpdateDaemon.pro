@@ -0,0 +1,7 @@
+include(../../QAppImageUpdate.pri)
+INCLUDEPATH += .
+TEMPLATE = app
+TARGET = UpdateDaemon
+
+HEADERS += UpdateDaemon.hpp
+SOURCES += main.cc
@@ -0,0 +1,115 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocalSocket>
+#include <QStandardPaths>
+#include <QTextStream>
+#include <QAppImageUpdate>
+
+#include "UpdateDaemon.hpp"
+
+static QString defaultSocket() {
+    auto runtime = QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation);
+    if(runtime.isEmpty()) {
+        return QString::fromUtf8("QAppImageUpdateDaemon");
+    }
+    return runtime + QString::fromUtf8("/QAppImageUpdateDaemon");
+}
+
+// Sends a single request to a running daemon and prints every reply to it
+// until it finishes, fails or is canceled.
+static int runClient(QCoreApplication &app, const QString &socketName,
+                     const QString &action, const QString &appImage, bool force) {
+    QLocalSocket socket;
+    QByteArray buffer;
+    int exitCode = 0;
+
+    QObject::connect(&socket, &QLocalSocket::connected, [&]() {
+        QJsonObject request {
+            { "id", 1 },
+            { "action", action },
+            { "appimage", QFileInfo(appImage).absoluteFilePath() },
+            { "force", force }
+        };
+        socket.write(QJsonDocument(request).toJson(QJsonDocument::Compact) + '\n');
+    });
+
+    QObject::connect(&socket, &QLocalSocket::readyRead, [&]() {
+        buffer += socket.readAll();
+        int end = 0;
+        while((end = buffer.indexOf('\n')) >= 0) {
+            auto line = buffer.left(end);
+            buffer.remove(0, end + 1);
+            QTextStream(stdout) << line << "\n";
+
+            auto event = QJsonDocument::fromJson(line).object()["event"].toString();
+            if(event == "finished") {
+                app.quit();
+            } else if(event == "error" || event == "canceled") {
+                exitCode = -1;
+                app.quit();
+            }
+        }
+    });
+
+    QObject::connect(&socket,
+                     static_cast<void (QLocalSocket::*)(QLocalSocket::LocalSocketError)>(&QLocalSocket::error),
+    [&](QLocalSocket::LocalSocketError) {
+        qCritical().noquote() << "error:: " << socket.errorString();
+        exitCode = -1;
+        app.quit();
+    });
+
+    socket.connectToServer(socketName);
+    app.exec();
+    return exitCode;
+}
+
+int main(int ac, char **av) {
+    QCoreApplication app(ac, av);
+    QCoreApplication::setApplicationName("QAppImageUpdateDaemon");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Serves AppImage updates over a local socket.");
+    parser.addHelpOption();
+    QCommandLineOption socketOption(QStringList() << "s" << "socket",
+                                    "Socket to listen on or to connect to.", "path", defaultSocket());
+    QCommandLineOption ttlOption(QStringList() << "t" << "cache-ttl",
+                                 "Seconds the result of a check is reused, 0 never reuses it.", "seconds", "300");
+    QCommandLineOption requestsOption(QStringList() << "r" << "max-requests",
+                                      "Range requests in flight for all updates, 0 is unlimited.", "n", "0");
+    QCommandLineOption forceOption(QStringList() << "f" << "force",
+                                   "Do not answer a check from the cache, for clients.");
+    parser.addOption(socketOption);
+    parser.addOption(ttlOption);
+    parser.addOption(requestsOption);
+    parser.addOption(forceOption);
+    parser.addPositionalArgument("action", "info, check, update or dry-run, to send a request as a client.");
+    parser.addPositionalArgument("appimage", "The AppImage of the request.");
+    parser.process(app);
+
+    auto args = parser.positionalArguments();
+    if(args.count() == 2) {
+        return runClient(app, parser.value(socketOption), args.at(0), args.at(1), parser.isSet(forceOption));
+    } else if(!args.isEmpty()) {
+        qInfo().noquote() << "\nUsage: " << app.arguments().at(0)
+                          << " [-s SOCKET] [-t TTL] [-r REQUESTS] [ACTION APPIMAGE].";
+        return -1;
+    }
+
+    qInfo().noquote() << "UpdateDaemon, Serve AppImage updates over a local socket.";
+    qInfo().noquote() << "Copyright (C) 2020, Antony Jr.";
+
+    QAppImageUpdate::setMaxConcurrentRequests(parser.value(requestsOption).toInt());
+
+    UpdateDaemon daemon;
+    daemon.setCacheTtl(parser.value(ttlOption).toLongLong() * 1000);
+    if(!daemon.listen(parser.value(socketOption))) {
+        qCritical().noquote() << "error:: " << daemon.errorString();
+        return -1;
+    }
+    qInfo().noquote() << "Listening on " << daemon.serverName();
+    return app.exec();
+}
@@ -0,0 +1,6 @@
+include(../../QAppImageUpdate.pri)
+INCLUDEPATH += .
+TEMPLATE = app
+TARGET = ZsyncMake
+
+SOURCES += main.cc
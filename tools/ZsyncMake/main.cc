@@ -0,0 +1,59 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QAppImageUpdate>
+#include <ZsyncControlFileGenerator>
+
+int main(int ac, char **av) {
+    qInfo().noquote() << "ZsyncMake, Write zsync control files.";
+    qInfo().noquote() << "Copyright (C) 2020, Antony Jr.";
+
+    QCoreApplication app(ac, av);
+    ZsyncControlFileGenerator generator;
+
+    QCommandLineParser parser;
+    QCommandLineOption blockSizeOption(QStringList() << "b" << "blocksize",
+                                       "Block size, picked from the file size by default.", "bytes", "0");
+    QCommandLineOption urlOption(QStringList() << "u" << "url",
+                                 "URL of the file, relative to the control file by default.", "url");
+    QCommandLineOption outputOption(QStringList() << "o" << "output",
+                                    "Control file to write, [FILE].zsync by default.", "path");
+    QCommandLineOption threadsOption(QStringList() << "j" << "threads",
+                                     "Threads to hash with, all cores by default.", "n", "0");
+    parser.addOption(blockSizeOption);
+    parser.addOption(urlOption);
+    parser.addOption(outputOption);
+    parser.addOption(threadsOption);
+    parser.process(app);
+    auto args = parser.positionalArguments();
+    if(args.count() != 1) {
+        qInfo().noquote() << "\nUsage: " << app.arguments().at(0)
+                          << " [-b BLOCKSIZE] [-u URL] [-o OUTPUT] [-j THREADS] [FILE].";
+        return -1;
+    }
+
+    QObject::connect(&generator, &ZsyncControlFileGenerator::error, [&](short ecode) {
+        qCritical().noquote() << "error:: " << QAppImageUpdate::errorCodeToString(ecode);
+        app.exit(-1);
+    });
+
+    QObject::connect(&generator, &ZsyncControlFileGenerator::progress, [&](int percentage) {
+        qInfo().noquote() << "Hashing " << percentage << "%... ";
+    });
+
+    QObject::connect(&generator, &ZsyncControlFileGenerator::finished, [&](QJsonObject info) {
+        qInfo().noquote() << info;
+        app.quit();
+    });
+
+    generator.setTargetFile(args.at(0));
+    generator.setBlockSize(parser.value(blockSizeOption).toInt());
+    generator.setThreads(parser.value(threadsOption).toInt());
+    if(parser.isSet(urlOption)) {
+        generator.setTargetFileUrl(parser.value(urlOption));
+    }
+    if(parser.isSet(outputOption)) {
+        generator.setOutputFile(parser.value(outputOption));
+    }
+    generator.start();
+    return app.exec();
+}